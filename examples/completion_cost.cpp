@@ -0,0 +1,84 @@
+// Measures the cost of completing an operation through the usb device
+// service for different I/O executor types. Each operation is allocated from
+// an op_arena, handed to the scheduler the way completed transfers are and
+// completed through handler_work, so the numbers show the per-completion
+// overhead of the executor without any usb traffic.
+//
+// Usage: completion_cost [operations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <boost/asio.hpp>
+#include "libusb/detail/async_open_op.hpp"
+#include "libusb/detail/op_arena.hpp"
+
+namespace asio = boost::asio;
+
+struct counting_handler
+{
+  void operator()(const boost::system::error_code&)
+  {
+    ++*count_;
+  }
+
+  std::size_t* count_;
+};
+
+template <typename Executor>
+double completion_cost(std::size_t operations)
+{
+  typedef libusb::detail::async_open_op<counting_handler, Executor> op;
+  typedef asio::detail::scheduler scheduler_impl;
+
+  asio::io_context io_context;
+  scheduler_impl& scheduler = asio::use_service<scheduler_impl>(io_context);
+  Executor ex(io_context.get_executor());
+  libusb::detail::op_arena arena;
+
+  const std::size_t batch = 256;
+  std::size_t completed = 0;
+  counting_handler handler = { &completed };
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < operations; i += batch)
+  {
+    for (std::size_t j = 0; j < batch; ++j)
+    {
+      typename op::ptr p = { asio::detail::addressof(handler),
+        op::ptr::allocate(handler, &arena), 0, &arena };
+      p.p = new (p.v) op(&arena, handler, ex);
+
+      scheduler.work_started();
+      scheduler.post_deferred_completion(p.p);
+      p.v = p.p = 0;
+    }
+
+    io_context.restart();
+    io_context.run();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  if (completed < operations)
+    std::abort();
+
+  return std::chrono::duration<double, std::nano>(elapsed).count()
+    / static_cast<double>(completed);
+}
+
+int main(int argc, char* argv[])
+{
+  std::size_t operations = argc > 1 ? std::strtoul(argv[1], 0, 10) : 100000;
+
+  std::cout << "io_context::executor_type: "
+    << completion_cost<asio::io_context::executor_type>(operations)
+    << " ns/completion\n";
+#if BOOST_ASIO_VERSION >= 101800
+  std::cout << "any_io_executor:           "
+    << completion_cost<asio::any_io_executor>(operations)
+    << " ns/completion\n";
+#endif
+  std::cout << "executor:                  "
+    << completion_cost<asio::executor>(operations)
+    << " ns/completion\n";
+}
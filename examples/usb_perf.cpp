@@ -0,0 +1,515 @@
+// Measures the throughput and latency of a usb device through the library.
+// A number of transfers are kept in flight on one endpoint for a fixed time;
+// the tool then reports MB/s, transfers per second and percentiles of the time
+// from starting a transfer to running its handler.
+//
+// Tests:
+//   sink       sends only (host to device)
+//   source     receives only (device to host)
+//   loopback   each slot sends a buffer and receives it back; the latency is
+//              the round trip. Every buffer repeats an 8 byte sequence number,
+//              so echoed data is checked whatever order it comes back in
+//   ping-pong  loopback with a single slot
+//
+// With --simulate the transfers go to an in-process device with a fixed bus
+// rate and latency instead of to hardware, so the tool runs anywhere.
+//
+// Usage: usb_perf [options]
+//   --device VID:PID        open the first device with these ids (hex)
+//   --path BUS-PORT[.PORT]  open the device at this bus and port path
+//   --simulate              use the simulated device
+//   --interface N           interface to claim (default 0)
+//   --endpoint N            endpoint number, without direction (default 1)
+//   --type interrupt|bulk   transfer type (default bulk)
+//   --test NAME             sink, source, loopback or ping-pong (default sink)
+//   --size BYTES            bytes per transfer (default 16384)
+//   --depth N               transfers in flight (default 8)
+//   --duration SECONDS      length of the run (default 5)
+//   --mode resolver|event|busy-poll
+//                           event handling of the service (default event)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <libusb.h>
+#include "libusb/usb_device.hpp"
+
+namespace asio = boost::asio;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct settings
+{
+  settings()
+    : vendor_id(0)
+    , product_id(0)
+    , bus(0)
+    , simulate(false)
+    , interface_number(0)
+    , endpoint(1)
+    , bulk(true)
+    , test("sink")
+    , size(16384)
+    , depth(8)
+    , duration(5.0)
+    , mode(libusb::usb_service_options::event_thread)
+  {
+  }
+
+  std::uint16_t vendor_id;
+  std::uint16_t product_id;
+  std::uint8_t bus;
+  std::vector<std::uint8_t> ports;
+  bool simulate;
+  int interface_number;
+  std::uint8_t endpoint;
+  bool bulk;
+  std::string test;
+  std::size_t size;
+  std::size_t depth;
+  double duration;
+  libusb::usb_service_options::event_mode mode;
+};
+
+// In-process stand-in for a usb device. Transfers occupy a shared bus at a
+// fixed rate and complete after a fixed latency on top; sent data is kept and
+// returned by the following receives, so it echoes like a loopback device.
+class simulated_device
+{
+public:
+  typedef asio::io_context::executor_type executor_type;
+
+  simulated_device(asio::io_context& io, double bytes_per_second,
+      clock_type::duration latency)
+    : io_(io)
+    , rate_(bytes_per_second)
+    , latency_(latency)
+    , bus_free_(clock_type::now())
+  {
+  }
+
+  executor_type get_executor()
+  {
+    return io_.get_executor();
+  }
+
+  template <typename Handler>
+  void async_send(asio::const_buffer buffer, Handler handler)
+  {
+    const unsigned char* data = static_cast<const unsigned char*>(
+        buffer.data());
+    if (echo_.size() < max_echo)
+      echo_.emplace_back(data, data + buffer.size());
+    complete(buffer.size(), handler);
+  }
+
+  template <typename Handler>
+  void async_receive(asio::mutable_buffer buffer, Handler handler)
+  {
+    unsigned char* data = static_cast<unsigned char*>(buffer.data());
+    std::size_t n = buffer.size();
+    if (!echo_.empty())
+    {
+      n = std::min(n, echo_.front().size());
+      std::memcpy(data, echo_.front().data(), n);
+      echo_.pop_front();
+    }
+    else
+      std::memset(data, 0xa5, n);
+    complete(n, handler);
+  }
+
+private:
+  enum { max_echo = 1024 };
+
+  template <typename Handler>
+  void complete(std::size_t n, Handler handler)
+  {
+    clock_type::time_point now = clock_type::now();
+    bus_free_ = std::max(bus_free_, now)
+      + std::chrono::duration_cast<clock_type::duration>(
+          std::chrono::duration<double>(static_cast<double>(n) / rate_));
+
+    auto timer = std::make_shared<asio::steady_timer>(io_,
+        bus_free_ + latency_);
+    timer->async_wait([timer, handler, n](const boost::system::error_code&)
+        {
+          handler(boost::system::error_code(), n);
+        });
+  }
+
+  asio::io_context& io_;
+  double rate_;
+  clock_type::duration latency_;
+  clock_type::time_point bus_free_;
+  std::deque<std::vector<unsigned char> > echo_;
+};
+
+struct results
+{
+  results()
+    : transfers(0)
+    , bytes(0)
+    , errors(0)
+    , mismatches(0)
+  {
+  }
+
+  std::uint64_t transfers;
+  std::uint64_t bytes;
+  std::uint64_t errors;
+  std::uint64_t mismatches;
+  boost::system::error_code first_error;
+  std::vector<std::int64_t> latencies; // ns
+  clock_type::duration elapsed;
+};
+
+// Keeps one transfer, or one send and receive pair, in flight and restarts it
+// until the run ends.
+template <typename Device>
+class slot
+  : public std::enable_shared_from_this<slot<Device> >
+{
+public:
+  slot(Device& device, const settings& s, results& r,
+      clock_type::time_point end, std::size_t id)
+    : device_(device)
+    , settings_(s)
+    , results_(r)
+    , end_(end)
+    , out_(s.size)
+    , in_(s.size)
+    , sequence_(static_cast<std::uint64_t>(id) << 32)
+  {
+  }
+
+  void start()
+  {
+    if (clock_type::now() >= end_)
+      return;
+
+    start_ = clock_type::now();
+    if (settings_.test == "source")
+      receive();
+    else
+    {
+      // A running sequence number makes every loopback buffer distinct.
+      ++sequence_;
+      for (std::size_t i = 0; i < out_.size(); ++i)
+        out_[i] = static_cast<unsigned char>(sequence_ >> (8 * (i % 8)));
+      send();
+    }
+  }
+
+private:
+  void send()
+  {
+    auto self(this->shared_from_this());
+    device_.async_send(asio::buffer(out_),
+        [self](const boost::system::error_code& ec, std::size_t n)
+        {
+          if (ec)
+            return self->fail(ec);
+          if (self->settings_.test == "sink")
+            return self->done(n);
+          self->receive();
+        });
+  }
+
+  void receive()
+  {
+    auto self(this->shared_from_this());
+    device_.async_receive(asio::buffer(in_),
+        [self](const boost::system::error_code& ec, std::size_t n)
+        {
+          if (ec)
+            return self->fail(ec);
+          if (self->settings_.test != "source" && !self->intact(n))
+            ++self->results_.mismatches;
+          self->done(n);
+        });
+  }
+
+  // Whether a received buffer is a whole one sent by some slot.
+  bool intact(std::size_t n) const
+  {
+    if (n != in_.size())
+      return false;
+    for (std::size_t i = 8; i < n; ++i)
+      if (in_[i] != in_[i % 8])
+        return false;
+    return true;
+  }
+
+  void done(std::size_t n)
+  {
+    ++results_.transfers;
+    results_.bytes += n;
+    results_.latencies.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          clock_type::now() - start_).count());
+    start();
+  }
+
+  void fail(const boost::system::error_code& ec)
+  {
+    if (results_.errors++ == 0)
+      results_.first_error = ec;
+
+    // A device that fails once usually fails again at once; stop this slot
+    // instead of spinning on the error.
+  }
+
+  Device& device_;
+  const settings& settings_;
+  results& results_;
+  clock_type::time_point end_;
+  std::vector<unsigned char> out_;
+  std::vector<unsigned char> in_;
+  std::uint64_t sequence_;
+  clock_type::time_point start_;
+};
+
+template <typename Device>
+results run(asio::io_context& io, Device& device, const settings& s)
+{
+  results r;
+  r.latencies.reserve(1 << 16);
+
+  clock_type::time_point begin = clock_type::now();
+  clock_type::time_point end = begin
+    + std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(s.duration));
+
+  std::size_t depth = s.test == "ping-pong" ? 1 : s.depth;
+  for (std::size_t i = 0; i < depth; ++i)
+    std::make_shared<slot<Device> >(device, s, r, end, i)->start();
+
+  io.run();
+  r.elapsed = clock_type::now() - begin;
+  return r;
+}
+
+static double percentile(const std::vector<std::int64_t>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0.0;
+  std::size_t i = static_cast<std::size_t>(
+      p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+  return static_cast<double>(sorted[i]) / 1000.0;
+}
+
+static void report(const settings& s, results& r)
+{
+  double seconds = std::chrono::duration<double>(r.elapsed).count();
+  std::sort(r.latencies.begin(), r.latencies.end());
+
+  std::cout << "test: " << s.test
+    << ", type: " << (s.bulk ? "bulk" : "interrupt")
+    << ", size: " << s.size
+    << ", depth: " << (s.test == "ping-pong" ? 1 : s.depth)
+    << (s.simulate ? ", simulated" : "") << "\n";
+  std::cout << "transfers: " << r.transfers
+    << ", bytes: " << r.bytes
+    << ", elapsed: " << seconds << " s\n";
+  std::cout << "throughput: "
+    << static_cast<double>(r.bytes) / seconds / 1e6 << " MB/s, "
+    << static_cast<double>(r.transfers) / seconds << " IOPS\n";
+  std::cout << "latency (us): min " << percentile(r.latencies, 0)
+    << ", p50 " << percentile(r.latencies, 50)
+    << ", p90 " << percentile(r.latencies, 90)
+    << ", p99 " << percentile(r.latencies, 99)
+    << ", p99.9 " << percentile(r.latencies, 99.9)
+    << ", max " << percentile(r.latencies, 100) << "\n";
+  if (r.errors)
+    std::cout << "errors: " << r.errors << " (" << r.first_error.message()
+      << ")\n";
+  if (r.mismatches)
+    std::cout << "mismatches: " << r.mismatches << "\n";
+}
+
+static bool parse_ids(const std::string& arg, settings& s)
+{
+  std::size_t colon = arg.find(':');
+  if (colon == std::string::npos)
+    return false;
+  s.vendor_id = static_cast<std::uint16_t>(
+      std::strtoul(arg.substr(0, colon).c_str(), 0, 16));
+  s.product_id = static_cast<std::uint16_t>(
+      std::strtoul(arg.substr(colon + 1).c_str(), 0, 16));
+  return true;
+}
+
+static bool parse_path(const std::string& arg, settings& s)
+{
+  std::size_t dash = arg.find('-');
+  if (dash == std::string::npos)
+    return false;
+  s.bus = static_cast<std::uint8_t>(
+      std::strtoul(arg.substr(0, dash).c_str(), 0, 10));
+  std::istringstream ports(arg.substr(dash + 1));
+  std::string port;
+  while (std::getline(ports, port, '.'))
+    s.ports.push_back(static_cast<std::uint8_t>(
+          std::strtoul(port.c_str(), 0, 10)));
+  return !s.ports.empty();
+}
+
+static bool matches(libusb_device* dev, const settings& s)
+{
+  if (!s.ports.empty())
+  {
+    std::uint8_t ports[7];
+    int depth = libusb_get_port_numbers(dev, ports, 7);
+    return libusb_get_bus_number(dev) == s.bus && depth > 0
+      && std::equal(s.ports.begin(), s.ports.end(), ports, ports + depth);
+  }
+
+  struct libusb_device_descriptor desc;
+  return libusb_get_device_descriptor(dev, &desc) == LIBUSB_SUCCESS
+    && desc.idVendor == s.vendor_id && desc.idProduct == s.product_id;
+}
+
+// Returns a new reference to the device to test, or null.
+static libusb_device* find_device(const settings& s)
+{
+  libusb_device** devs;
+  int cnt = libusb_get_device_list(NULL, &devs);
+  if (cnt < 0)
+    return NULL;
+
+  libusb_device* found = NULL;
+  for (int i = 0; i < cnt && !found; ++i)
+  {
+    if (matches(devs[i], s))
+      found = libusb_ref_device(devs[i]);
+  }
+  libusb_free_device_list(devs, 1);
+  return found;
+}
+
+static int usage()
+{
+  std::cerr << "usage: usb_perf (--device VID:PID | --path BUS-PORT[.PORT]"
+    " | --simulate)\n"
+    "  [--interface N] [--endpoint N] [--type interrupt|bulk]\n"
+    "  [--test sink|source|loopback|ping-pong] [--size BYTES] [--depth N]\n"
+    "  [--duration SECONDS] [--mode resolver|event|busy-poll]\n";
+  return 2;
+}
+
+int main(int argc, char* argv[])
+{
+  settings s;
+  bool target = false;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if (arg == "--simulate")
+    {
+      s.simulate = target = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return usage();
+
+    std::string value(argv[++i]);
+    if (arg == "--device")
+    {
+      if (!parse_ids(value, s))
+        return usage();
+      target = true;
+    }
+    else if (arg == "--path")
+    {
+      if (!parse_path(value, s))
+        return usage();
+      target = true;
+    }
+    else if (arg == "--interface")
+      s.interface_number = std::atoi(value.c_str());
+    else if (arg == "--endpoint")
+      s.endpoint = static_cast<std::uint8_t>(std::atoi(value.c_str()) & 0x0f);
+    else if (arg == "--type" && (value == "bulk" || value == "interrupt"))
+      s.bulk = value == "bulk";
+    else if (arg == "--test" && (value == "sink" || value == "source"
+          || value == "loopback" || value == "ping-pong"))
+      s.test = value;
+    else if (arg == "--size")
+      s.size = std::strtoul(value.c_str(), 0, 10);
+    else if (arg == "--depth")
+      s.depth = std::max<std::size_t>(1, std::strtoul(value.c_str(), 0, 10));
+    else if (arg == "--duration")
+      s.duration = std::atof(value.c_str());
+    else if (arg == "--mode" && value == "resolver")
+      s.mode = libusb::usb_service_options::resolver_thread;
+    else if (arg == "--mode" && value == "event")
+      s.mode = libusb::usb_service_options::event_thread;
+    else if (arg == "--mode" && value == "busy-poll")
+      s.mode = libusb::usb_service_options::busy_poll;
+    else
+      return usage();
+  }
+
+  if (!target || s.size == 0)
+    return usage();
+
+  asio::io_context io;
+  results r;
+
+  if (s.simulate)
+  {
+    // Roughly a high-speed bulk endpoint: 40 MB/s and one microframe.
+    simulated_device device(io, 40e6, std::chrono::microseconds(125));
+    r = run(io, device, s);
+  }
+  else
+  {
+    libusb::set_service_options(io,
+        libusb::usb_service_options().mode(s.mode));
+
+    // In busy_poll mode handlers also run on the polling thread; the strand
+    // keeps the slots' bookkeeping on one thread at a time.
+    libusb::usb_device<asio::strand<asio::io_context::executor_type> >
+      device(asio::make_strand(io));
+    libusb_device* dev = find_device(s);
+    if (!dev)
+    {
+      std::cerr << "usb_perf: device not found\n";
+      return 1;
+    }
+
+    try
+    {
+      device.assign(dev);
+      device.set_option(libusb::usb_device_base::interface_number(
+            s.interface_number));
+      device.set_option(libusb::usb_device_base::endpoint_address(
+            s.endpoint));
+      device.set_option(libusb::usb_device_base::transfer_type(s.bulk
+            ? libusb::usb_device_base::transfer_type::bulk
+            : libusb::usb_device_base::transfer_type::interrupt));
+      device.open();
+    }
+    catch (const boost::system::system_error& e)
+    {
+      std::cerr << "usb_perf: " << e.what() << "\n";
+      return 1;
+    }
+
+    r = run(io, device, s);
+  }
+
+  report(s, r);
+  return r.errors || r.mismatches || r.transfers == 0 ? 1 : 0;
+}
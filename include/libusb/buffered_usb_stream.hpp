@@ -0,0 +1,386 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Read-ahead buffering for the IN endpoint of a usb device.
+/**
+ * A buffered_usb_stream keeps a number of large receive transfers outstanding
+ * on the usb device, each into its own chunk of an internal ring. Small reads
+ * are satisfied from the received chunks, so a parser reading a few bytes at
+ * a time does not cause a transfer per read.
+ *
+ * The stream models the AsyncReadStream concept and may be used with
+ * boost::asio::async_read() and boost::asio::async_read_until(). For reading
+ * without copying, wait for data with async_fill(), inspect it through data()
+ * and release it with consume().
+ *
+ * Read-ahead starts with the first read. Once a receive fails, the remaining
+ * buffered data can still be read, after which reads complete with the error.
+ * The device must outlive the stream.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe. Only one read or fill may be outstanding at a
+ * time.
+ */
+template <typename Device>
+class buffered_usb_stream
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// The type of the next layer.
+  typedef Device next_layer_type;
+
+  /// Construct a buffered stream on a usb device.
+  /**
+   * @param device The usb device to read from.
+   *
+   * @param chunk_size The size of each read-ahead transfer.
+   *
+   * @param depth The number of read-ahead transfers kept outstanding.
+   */
+  explicit buffered_usb_stream(Device& device, std::size_t chunk_size = 16384,
+      std::size_t depth = 2)
+    : state_(std::make_shared<state>(device, chunk_size, depth))
+  {
+  }
+
+  /// Destroys the stream.
+  /**
+   * An outstanding read completes with boost::asio::error::operation_aborted.
+   * Outstanding receive transfers keep the internal buffers alive until they
+   * complete.
+   */
+  ~buffered_usb_stream()
+  {
+    state_->abort();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->device_.get_executor();
+  }
+
+  /// Get a reference to the next layer.
+  next_layer_type& next_layer()
+  {
+    return state_->device_;
+  }
+
+  /// Start an asynchronous read.
+  /**
+   * This function copies buffered data into the given buffers, waiting for
+   * data if none is buffered. The function call always returns immediately.
+   *
+   * @param buffers One or more buffers into which the data will be read.
+   * Ownership of the underlying memory is retained by the caller, which must
+   * guarantee that it remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the read completes. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes read.
+   * ); @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_read_some(const MutableBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_read_some(), handler, state_, buffers);
+  }
+
+  /// Start an asynchronous wait for buffered data.
+  /**
+   * This function waits until data is buffered. The function call always
+   * returns immediately.
+   *
+   * @param handler The handler to be called when data is available. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_available             // Size of data().
+   * ); @endcode
+   */
+  template <typename FillHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(FillHandler,
+      void (boost::system::error_code, std::size_t))
+  async_fill(BOOST_ASIO_MOVE_ARG(FillHandler) handler)
+  {
+    return asio::async_initiate<FillHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_fill(), handler, state_);
+  }
+
+  /// Get a view of the buffered data.
+  /**
+   * The view covers the buffered data of the oldest received transfer and
+   * remains valid until consume() is called.
+   */
+  asio::const_buffer data() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->view();
+  }
+
+  /// Remove data from the front of the buffer.
+  /**
+   * @param n The number of bytes to remove. At most the size of data() is
+   * removed.
+   */
+  void consume(std::size_t n)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    state_->consume(n);
+  }
+
+  /// Get the number of bytes that can be read without waiting.
+  std::size_t in_avail() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->available();
+  }
+
+private:
+  typedef detail::erased_handler<boost::system::error_code, std::size_t>
+    handler_type;
+
+  struct chunk
+  {
+    std::vector<unsigned char> data_;
+    std::size_t size_;
+    bool filled_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(Device& device, std::size_t chunk_size, std::size_t depth)
+      : device_(device)
+      , chunks_(depth ? depth : 1,
+          chunk{ std::vector<unsigned char>(chunk_size), 0, false })
+      , head_(0)
+      , offset_(0)
+      , started_(false)
+      , aborted_(false)
+      , fill_only_(false)
+    {
+    }
+
+    // Start read-ahead on all chunks. Called with the mutex held.
+    void start()
+    {
+      if (started_)
+        return;
+
+      started_ = true;
+      for (std::size_t i = 0; i < chunks_.size(); ++i)
+        read(i);
+    }
+
+    void read(std::size_t index)
+    {
+      auto self(this->shared_from_this());
+      device_.async_receive(asio::buffer(chunks_[index].data_),
+          [self, index](const boost::system::error_code& ec, std::size_t n)
+          {
+            self->on_read(index, ec, n);
+          });
+    }
+
+    void on_read(std::size_t index, const boost::system::error_code& ec,
+        std::size_t n)
+    {
+      handler_type handler;
+      boost::system::error_code result;
+      std::size_t bytes = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        chunks_[index].size_ = n;
+        chunks_[index].filled_ = true;
+        if (ec && !error_)
+          error_ = ec;
+        skip_empty();
+
+        if (!handler_ || (!available() && !error_))
+          return;
+
+        handler = std::move(handler_);
+        complete(result, bytes);
+      }
+
+      handler(result, bytes);
+    }
+
+    // Release empty received chunks at the head. Called with the mutex held.
+    void skip_empty()
+    {
+      while (chunks_[head_].filled_ && offset_ == chunks_[head_].size_)
+        release();
+    }
+
+    // Give the head chunk back to read-ahead. Called with the mutex held.
+    void release()
+    {
+      chunks_[head_].filled_ = false;
+      chunks_[head_].size_ = 0;
+      offset_ = 0;
+      if (!aborted_ && !error_)
+        read(head_);
+      head_ = (head_ + 1) % chunks_.size();
+    }
+
+    // Result of the waiting read or fill. Called with the mutex held.
+    void complete(boost::system::error_code& ec, std::size_t& bytes)
+    {
+      if (fill_only_)
+      {
+        bytes = available();
+      }
+      else
+      {
+        bytes = asio::buffer_copy(buffers_, view());
+        consume(bytes);
+      }
+      if (bytes == 0)
+        ec = error_;
+    }
+
+    asio::const_buffer view() const
+    {
+      const chunk& c = chunks_[head_];
+      if (!c.filled_)
+        return asio::const_buffer();
+      return asio::const_buffer(c.data_.data() + offset_, c.size_ - offset_);
+    }
+
+    std::size_t available() const
+    {
+      return view().size();
+    }
+
+    void consume(std::size_t n)
+    {
+      chunk& c = chunks_[head_];
+      if (!c.filled_)
+        return;
+      offset_ += std::min(n, c.size_ - offset_);
+      skip_empty();
+    }
+
+    void abort()
+    {
+      handler_type handler;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        handler = std::move(handler_);
+      }
+
+      if (handler)
+        handler(asio::error::operation_aborted, 0);
+    }
+
+    // Start or complete a read or fill. Called with the mutex held.
+    void wait(handler_type& handler, bool fill_only,
+        std::unique_lock<std::mutex>& lock)
+    {
+      if (handler_)
+      {
+        lock.unlock();
+        handler(asio::error::in_progress, 0);
+        return;
+      }
+
+      start();
+      fill_only_ = fill_only;
+      if (!available() && !error_)
+      {
+        handler_ = std::move(handler);
+        return;
+      }
+
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      complete(ec, bytes);
+      lock.unlock();
+      handler(ec, bytes);
+    }
+
+    Device& device_;
+    std::vector<chunk> chunks_;
+    std::size_t head_;
+    std::size_t offset_;
+    bool started_;
+    bool aborted_;
+    boost::system::error_code error_;
+    mutable std::mutex mutex_;
+    handler_type handler_;
+    std::vector<asio::mutable_buffer> buffers_;
+    bool fill_only_;
+  };
+
+  // Disallow copying and assignment.
+  buffered_usb_stream(const buffered_usb_stream&) BOOST_ASIO_DELETED;
+  buffered_usb_stream& operator=(const buffered_usb_stream&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_read_some
+  {
+    template <typename ReadHandler, typename MutableBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(ReadHandler) handler,
+        const std::shared_ptr<state>& s,
+        const MutableBufferSequence& buffers) const
+    {
+      handler_type h(BOOST_ASIO_MOVE_CAST(ReadHandler)(handler),
+          s->device_.get_executor());
+
+      if (asio::buffer_size(buffers) == 0)
+      {
+        h(boost::system::error_code(), 0);
+        return;
+      }
+
+      std::unique_lock<std::mutex> lock(s->mutex_);
+      if (!s->handler_)
+      {
+        s->buffers_.assign(asio::buffer_sequence_begin(buffers),
+            asio::buffer_sequence_end(buffers));
+      }
+      s->wait(h, false, lock);
+    }
+  };
+
+  struct initiate_async_fill
+  {
+    template <typename FillHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(FillHandler) handler,
+        const std::shared_ptr<state>& s) const
+    {
+      handler_type h(BOOST_ASIO_MOVE_CAST(FillHandler)(handler),
+          s->device_.get_executor());
+
+      std::unique_lock<std::mutex> lock(s->mutex_);
+      s->wait(h, true, lock);
+    }
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
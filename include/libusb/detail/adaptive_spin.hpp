@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+
+namespace libusb {
+namespace detail {
+
+// How long a busy_poll thread spins without events before it blocks, adapted
+// to the traffic within the configured maximum. While events keep arriving
+// during the spin the threshold follows twice their smoothed gap, so a steady
+// stream is spun for without burning the core long past its next event. Each
+// time the thread has to block the threshold decays, down to a sixteenth of
+// the maximum. A maximum of std::chrono::microseconds::max() never blocks and
+// is not adapted.
+class adaptive_spin
+{
+public:
+  typedef std::chrono::microseconds duration;
+
+  explicit adaptive_spin(duration max)
+    : max_(max)
+    , min_(max / 16)
+    , threshold_(max)
+  {
+  }
+
+  duration threshold() const
+  {
+    return threshold_;
+  }
+
+  // An event arrived while spinning, the given time after the previous one.
+  void caught(duration gap)
+  {
+    if (max_ == duration::max())
+      return;
+    if (gap > max_)
+      gap = max_;
+    threshold_ += (2 * gap - threshold_) / 8;
+    clamp();
+  }
+
+  // The thread spun for the whole threshold and blocked.
+  void blocked()
+  {
+    if (max_ == duration::max())
+      return;
+    threshold_ -= threshold_ / 8;
+    clamp();
+  }
+
+private:
+  void clamp()
+  {
+    if (threshold_ > max_)
+      threshold_ = max_;
+    if (threshold_ < min_)
+      threshold_ = min_;
+  }
+
+  duration max_;
+  duration min_;
+  duration threshold_;
+};
+
+} // namespace detail
+} // namespace libusb
@@ -2,6 +2,7 @@
 
 #include <libusb.h>
 #include "usb_device_ops.hpp"
+#include "libusb/detail/op_arena.hpp"
 
 namespace asio = boost::asio;
 
@@ -12,7 +13,7 @@ template <typename Device, typename Handler, typename IoExecutor>
 class async_accept_op : public asio::detail::resolve_op
 {
 public:
-  BOOST_ASIO_DEFINE_HANDLER_PTR(async_accept_op);
+  typedef arena_handler_ptr<async_accept_op, Handler> ptr;
 
 #if defined(BOOST_ASIO_HAS_IOCP)
   typedef class asio::detail::win_iocp_io_context scheduler_impl;
@@ -21,10 +22,11 @@ public:
 #endif
 
   async_accept_op(struct libusb_context* ctx, Device& peer, 
-      std::uint16_t vendor_id, std::uint16_t product_id, scheduler_impl& sched, 
-      Handler& handler, const IoExecutor& io_ex)
+      std::uint16_t vendor_id, std::uint16_t product_id, op_arena* arena,
+      scheduler_impl& sched, Handler& handler, const IoExecutor& io_ex)
     : asio::detail::resolve_op(&async_accept_op::do_complete)
     , ctx_(ctx)
+    , arena_(arena)
     , peer_(peer)
     , vendor_id_(vendor_id)
     , product_id_(product_id)
@@ -45,7 +47,7 @@ public:
       std::size_t /*bytes_transferred*/)
   { 
     auto o(static_cast<async_accept_op*>(base));
-    ptr p = { asio::detail::addressof(o->handler_), o, o };
+    ptr p = { asio::detail::addressof(o->handler_), o, o, o->arena_ };
     asio::detail::handler_work<Handler, IoExecutor> w(o->handler_, o->io_executor_);
 
     if (owner && owner != &o->scheduler_)
@@ -96,6 +98,7 @@ public:
 
 private:
   struct libusb_context* ctx_;
+  op_arena* arena_;
   Device& peer_;
   std::uint16_t vendor_id_;
   std::uint16_t product_id_;
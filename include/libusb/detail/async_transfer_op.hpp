@@ -1,18 +1,31 @@
 #pragma once
 
+#include <atomic>
 #include <boost/asio.hpp>
+#include <type_traits>
 #include <libusb.h>
+#include "libusb/usb_capture.hpp"
+#include "libusb/usb_transfer_timing.hpp"
+#include "libusb/detail/usb_device_ops.hpp"
+#include "libusb/detail/completion_queue.hpp"
+#include "libusb/detail/endpoint_traits.hpp"
+#include "libusb/detail/op_arena.hpp"
+#include "libusb/detail/transfer_lanes.hpp"
+#include "libusb/detail/transfer_tracker.hpp"
 
 namespace asio = boost::asio;
 
 namespace libusb {
 namespace detail {
 
-template <typename BufferSequence, typename Handler, typename IoExecutor>
+// Transfers are timestamped on submission and in the libusb callback. A timed
+// operation passes the timestamps to its handler as a third argument.
+template <typename BufferSequence, typename Handler, typename IoExecutor,
+    typename Endpoint = runtime_endpoint, bool Timed = false>
 class async_transfer_op : public asio::detail::resolve_op
 {
 public:
-  BOOST_ASIO_DEFINE_HANDLER_PTR(async_transfer_op);
+  typedef arena_handler_ptr<async_transfer_op, Handler> ptr;
 
 #if defined(BOOST_ASIO_HAS_IOCP)
   typedef class asio::detail::win_iocp_io_context scheduler_impl;
@@ -22,47 +35,152 @@ public:
 
   async_transfer_op(struct libusb_context* ctx, 
       struct libusb_device_handle* dev_handle,
-      std::uint8_t address, const BufferSequence& buffers, 
-      scheduler_impl& sched, Handler& handler, const IoExecutor& io_ex)
+      std::uint8_t address, std::uint32_t stream_id,
+      const BufferSequence& buffers, usb_capture* capture, op_arena* arena,
+      transfer_tracker* tracker, scheduler_impl& sched, Handler& handler,
+      const IoExecutor& io_ex)
     : asio::detail::resolve_op(&async_transfer_op::do_complete)
     , ctx_(ctx)
+    , arena_(arena)
+    , capture_(capture)
+    , tracker_(tracker)
+    , generation_(tracker ? tracker->enter() : 0)
+    , tracked_(tracker != 0)
+    , window_(0)
+    , window_bytes_(0)
+    , queue_(0)
+    , queue_entry_(this)
+    , lanes_(0)
+    , lane_entry_(&async_transfer_op::run_on_worker, this)
     , buffers_(buffers)
     , scheduler_(sched)
     , handler_(BOOST_ASIO_MOVE_CAST(Handler)(handler))
     , io_executor_(io_ex) 
-    , transfer_(libusb_alloc_transfer(0))
+    , transfer_(arena ? arena->alloc_transfer() : libusb_alloc_transfer(0))
     , transfer_complete_(0)
+    , worker_pending_(2)
     , bytes_transferred_(0)
   { 
-    libusb_fill_interrupt_transfer(
-      transfer_, 
-      dev_handle, 
-      address, 
-      static_cast<unsigned char*>(buffers.data()),
-      buffers.size(),
-      &callback,
-      this,
-      0); // 0ms timeout
+    Endpoint::fill(
+        transfer_,
+        dev_handle,
+        address,
+        stream_id,
+        static_cast<unsigned char*>(
+          const_cast<void*>(static_cast<const void*>(buffers.data()))),
+        buffers.size(),
+        &callback,
+        this);
     asio::detail::handler_work<Handler, IoExecutor>::start(handler_, io_executor_); 
   }
 
   ~async_transfer_op()
   {
-    libusb_free_transfer(transfer_);
+    // An operation destroyed without having run, e.g. by a scheduler
+    // shutdown, no longer holds up its device.
+    if (window_)
+    {
+      send_window::ready_queue ready;
+      release_window(ready);
+    }
+    if (lanes_)
+      lanes_->remove(&lane_entry_);
+    if (tracked_)
+      tracker_->leave(0);
+
+    if (arena_)
+      arena_->free_transfer(transfer_);
+    else
+      libusb_free_transfer(transfer_);
   } 
 
+  struct libusb_transfer* native_transfer() const
+  {
+    return transfer_;
+  }
+
+  void set_error(const boost::system::error_code& ec)
+  {
+    ec_ = ec;
+  }
+
+  // Record that the transfer holds room of one of its device's windows, to
+  // be returned when it completes.
+  void hold_window(send_window& window, std::size_t bytes)
+  {
+    window_ = &window;
+    window_bytes_ = bytes;
+  }
+
+  // Queue the transfer for the resolver thread in a priority lane. Must be
+  // followed by posting the operation to the resolver thread. The slot the
+  // operation posts is then a third party to its completion, as it may run
+  // after the transfer itself has been performed by another slot.
+  void enqueue(transfer_lanes* lanes, int lane)
+  {
+    lanes_ = lanes;
+    worker_pending_.store(3, std::memory_order_relaxed);
+    lanes->push(&lane_entry_, lane);
+  }
+
+  // Submit the transfer from the calling thread. On completion the operation
+  // is pushed onto the queue instead of being waited for by the worker.
+  bool submit(completion_queue* queue)
+  {
+    queue_ = queue;
+    return start();
+  }
+
   static void LIBUSB_CALL callback(struct libusb_transfer* transfer)
   {
     auto o(static_cast<async_transfer_op*>(transfer->user_data));
+    o->timing_.completed = raw_monotonic_clock::now();
 
     /* std::cout << "Transfer status: " << transfer->status << std::endl; */
     if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
     {
-      o->ec_ = libusb_error(transfer->status);
-	  }
+      o->ec_ = usb_device_ops::transfer_error(transfer->status);
+    }
+    else if (o->tracked_)
+    {
+      o->tracker_->statistics().record(transfer->endpoint, o->timing_);
+    }
+
+    if (o->capture_)
+      o->capture_->record_complete(transfer);
 
     o->bytes_transferred_ = transfer->actual_length;
-    o->transfer_complete_ = 1; 
+
+    // The room of an abandoned device's windows is not returned, as their
+    // waiters have been cancelled and the scheduler may be shut down.
+    bool alive = !o->tracked_ || !o->tracker_->abandoned();
+    if (alive)
+      o->post_release_window();
+    else
+      o->window_ = 0;
+
+    // The device may be released once the operation has left its tracker.
+    if (o->tracked_)
+    {
+      o->tracked_ = false;
+      alive = o->tracker_->leave(transfer);
+    }
+
+    // The operation may be completed and freed as soon as it is queued. An
+    // abandoned operation is posted directly, as the event thread draining
+    // the queue may be stopped.
+    if (o->queue_)
+    {
+      if (alive)
+        o->queue_->push(&o->queue_entry_);
+      else
+        o->scheduler_.post_deferred_completion(o);
+    }
+    else
+    {
+      o->transfer_complete_ = 1;
+      o->finish_on_worker(1);
+    }
   }
 
   static void do_complete(void* owner, asio::detail::operation* base, 
@@ -71,60 +189,180 @@ public:
   { 
     // Take ownership of the operation object.
     auto o(static_cast<async_transfer_op*>(base));
-    ptr p = { asio::detail::addressof(o->handler_), o, o };
-    asio::detail::handler_work<Handler, IoExecutor> w(o->handler_, o->io_executor_);
 
     if (owner && owner != &o->scheduler_)
     {
-      // The operation is being run on the worker io_context. Time to perform
-      // the resolver operation.
-
-      // Perform the blocking transfer operation.
-      usb_device_ops::process_transfer(o->ctx_, o->transfer_, 
-          &o->transfer_complete_, o->ec_);
-
-      // Pass operation back to main io_context for completion.
-      o->scheduler_.post_deferred_completion(o);
-      p.v = p.p = 0;
+      // The operation is being run on the worker io_context. It is a slot for
+      // the most urgent queued transfer, which need not be this one, so it is
+      // passed back only once both the slot and the transfer are done with.
+      if (o->lanes_)
+      {
+        if (transfer_lanes::entry* e = o->lanes_->pop())
+          e->run();
+        o->finish_on_worker(1);
+      }
+      else
+        run_on_worker(o);
     }
     else
     {
+      ptr p = { asio::detail::addressof(o->handler_), o, o, o->arena_ };
+      asio::detail::handler_work<Handler, IoExecutor> w(o->handler_,
+          o->io_executor_);
+
       // The operation has been returned to the main io_context. The completion
       // handler is ready to be delivered. 
 
       BOOST_ASIO_HANDLER_COMPLETION((*o)); 
 
-      // Make a copy of the handler so that the memory can be deallocated before
-      // the upcall is made. Even if we're not about to make an upcall, a
-      // sub-object of the handler may be the true owner of the memory associated
-      // with the handler. Consequently, a local copy of the handler is required
-      // to ensure that any owning sub-object remains valid until after we have
-      // deallocated the memory here.
-      asio::detail::binder2<Handler, boost::system::error_code, std::size_t>
-        handler(o->handler_, o->ec_, o->bytes_transferred_);
-      p.h = asio::detail::addressof(handler.handler_);
-      p.reset();
-
-      // Make the upcall if required.
-      if (owner)
-      {
-        asio::detail::fenced_block b(asio::detail::fenced_block::half);
-        BOOST_ASIO_HANDLER_INVOCATION_BEGIN((handler.arg1_, handler.arg2_));
-        w.complete(handler, handler.handler_);
-        BOOST_ASIO_HANDLER_INVOCATION_END;
-      }
+      upcall(owner, o, p, w, std::integral_constant<bool, Timed>());
     }
   } 
 
 private:
+  static void upcall(void* owner, async_transfer_op* o, ptr& p,
+      asio::detail::handler_work<Handler, IoExecutor>& w, std::false_type)
+  {
+    // Make a copy of the handler so that the memory can be deallocated before
+    // the upcall is made. Even if we're not about to make an upcall, a
+    // sub-object of the handler may be the true owner of the memory associated
+    // with the handler. Consequently, a local copy of the handler is required
+    // to ensure that any owning sub-object remains valid until after we have
+    // deallocated the memory here.
+    asio::detail::binder2<Handler, boost::system::error_code, std::size_t>
+      handler(o->handler_, o->ec_, o->bytes_transferred_);
+    p.h = asio::detail::addressof(handler.handler_);
+    p.reset();
+
+    // Make the upcall if required.
+    if (owner)
+    {
+      asio::detail::fenced_block b(asio::detail::fenced_block::half);
+      BOOST_ASIO_HANDLER_INVOCATION_BEGIN((handler.arg1_, handler.arg2_));
+      w.complete(handler, handler.handler_);
+      BOOST_ASIO_HANDLER_INVOCATION_END;
+    }
+  }
+
+  static void upcall(void* owner, async_transfer_op* o, ptr& p,
+      asio::detail::handler_work<Handler, IoExecutor>& w, std::true_type)
+  {
+    asio::detail::binder3<Handler, boost::system::error_code, std::size_t,
+      transfer_timing> handler(o->handler_, o->ec_, o->bytes_transferred_,
+          o->timing_);
+    p.h = asio::detail::addressof(handler.handler_);
+    p.reset();
+
+    if (owner)
+    {
+      asio::detail::fenced_block b(asio::detail::fenced_block::half);
+      BOOST_ASIO_HANDLER_INVOCATION_BEGIN((handler.arg1_, handler.arg2_));
+      w.complete(handler, handler.handler_);
+      BOOST_ASIO_HANDLER_INVOCATION_END;
+    }
+  }
+
+  // Perform the blocking transfer on the resolver thread and pass the
+  // operation back to the main io_context for completion.
+  static void run_on_worker(void* op)
+  {
+    auto o(static_cast<async_transfer_op*>(op));
+
+    if (!o->start())
+    {
+      o->finish_on_worker(2);
+      return;
+    }
+
+    // If the event loop fails the transfer is left to its callback, run by
+    // another event handler or when the device is closed.
+    usb_device_ops::wait_transfer(o->ctx_, &o->transfer_complete_);
+    o->finish_on_worker(1);
+  }
+
+  // Called by the worker when it stops waiting, by the callback and, for a
+  // queued transfer, by the slot it posted. The last of them passes the
+  // operation back to the main io_context.
+  void finish_on_worker(int count)
+  {
+    if (worker_pending_.fetch_sub(count, std::memory_order_acq_rel) == count)
+      scheduler_.post_deferred_completion(this);
+  }
+
+  // Submit the transfer, unless its device was cancelled since the operation
+  // was initiated.
+  bool start()
+  {
+    if (tracked_ && !tracker_->submit(transfer_, generation_))
+    {
+      post_release_window();
+      ec_ = asio::error::operation_aborted;
+      tracked_ = false;
+      tracker_->leave(0);
+      return false;
+    }
+
+    if (capture_)
+      capture_->record_submit(transfer_);
+
+    timing_.submitted = raw_monotonic_clock::now();
+    int err = libusb_submit_transfer(transfer_);
+    if (err != LIBUSB_SUCCESS)
+    {
+      ec_ = libusb_error(err);
+      timing_.submitted = raw_monotonic_clock::time_point();
+      post_release_window();
+      if (tracked_)
+      {
+        tracked_ = false;
+        tracker_->leave(transfer_);
+      }
+      return false;
+    }
+
+    return true;
+  }
+
+  void release_window(send_window::ready_queue& ready)
+  {
+    send_window* window = window_;
+    window_ = 0;
+    window->release(window_bytes_, ready);
+  }
+
+  // Return the window's room and post the operations waiting for it.
+  void post_release_window()
+  {
+    if (window_)
+    {
+      send_window::ready_queue ready;
+      release_window(ready);
+      if (!ready.empty())
+        scheduler_.post_deferred_completions(ready);
+    }
+  }
+
   struct libusb_context* ctx_;
+  op_arena* arena_;
+  usb_capture* capture_;
+  transfer_tracker* tracker_;
+  std::uint64_t generation_;
+  bool tracked_;
+  send_window* window_;
+  std::size_t window_bytes_;
+  completion_queue* queue_;
+  completion_queue::entry queue_entry_;
+  transfer_lanes* lanes_;
+  transfer_lanes::entry lane_entry_;
   BufferSequence buffers_;
   scheduler_impl& scheduler_;
   Handler handler_;
   IoExecutor io_executor_;  
   struct libusb_transfer* transfer_;
   int transfer_complete_;
+  std::atomic<int> worker_pending_;
   std::size_t bytes_transferred_;
+  transfer_timing timing_;
   boost::system::error_code ec_; 
 };
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include "libusb/detail/op_arena.hpp"
+#include "libusb/detail/send_window.hpp"
+
+namespace asio = boost::asio;
+
+namespace libusb {
+namespace detail {
+
+// Operation completing when a device's send window has room. It waits in the
+// window, which hands it back to be posted to the scheduler.
+template <typename Handler, typename IoExecutor>
+class async_wait_writable_op : public send_wait_op
+{
+public:
+  typedef arena_handler_ptr<async_wait_writable_op, Handler> ptr;
+
+  async_wait_writable_op(op_arena* arena, Handler& handler,
+      const IoExecutor& io_ex)
+    : send_wait_op(&async_wait_writable_op::do_complete)
+    , arena_(arena)
+    , handler_(BOOST_ASIO_MOVE_CAST(Handler)(handler))
+    , io_executor_(io_ex)
+  {
+    asio::detail::handler_work<Handler, IoExecutor>::start(handler_, io_executor_);
+  }
+
+  static void do_complete(void* owner, asio::detail::operation* base,
+      const boost::system::error_code& /*result_ec*/,
+      std::size_t /*bytes_transferred*/)
+  {
+    // Take ownership of the operation object.
+    auto o(static_cast<async_wait_writable_op*>(base));
+    ptr p = { asio::detail::addressof(o->handler_), o, o, o->arena_ };
+    asio::detail::handler_work<Handler, IoExecutor> w(o->handler_, o->io_executor_);
+
+    BOOST_ASIO_HANDLER_COMPLETION((*o));
+
+    // Make a copy of the handler so that the memory can be deallocated before
+    // the upcall is made. Even if we're not about to make an upcall, a
+    // sub-object of the handler may be the true owner of the memory associated
+    // with the handler. Consequently, a local copy of the handler is required
+    // to ensure that any owning sub-object remains valid until after we have
+    // deallocated the memory here.
+    asio::detail::binder1<Handler, boost::system::error_code>
+      handler(o->handler_, o->ec_);
+    p.h = asio::detail::addressof(handler.handler_);
+    p.reset();
+
+    // Make the upcall if required.
+    if (owner)
+    {
+      asio::detail::fenced_block b(asio::detail::fenced_block::half);
+      BOOST_ASIO_HANDLER_INVOCATION_BEGIN((handler.arg1_));
+      w.complete(handler, handler.handler_);
+      BOOST_ASIO_HANDLER_INVOCATION_END;
+    }
+  }
+
+private:
+  op_arena* arena_;
+  Handler handler_;
+  IoExecutor io_executor_;
+};
+
+} // namespace detail
+} // namespace libusb
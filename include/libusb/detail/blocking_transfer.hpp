@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <boost/asio.hpp>
+#include <libusb.h>
+#include "libusb/usb_capture.hpp"
+#include "libusb/detail/transfer_tracker.hpp"
+#include "libusb/detail/usb_device_ops.hpp"
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// A synchronous transfer, submitted and waited for as libusb's synchronous
+// transfers are, but registered with the device's tracker so that closing the
+// device cancels it and waits for it. The state is shared by the waiting
+// thread and the callback and freed by whichever finishes last, so that a
+// waiter whose event loop fails can return while the transfer is in flight.
+class blocking_transfer
+{
+public:
+  // Perform a transfer on a device handle. The operation must have been
+  // registered with the tracker while the device was locked, yielding the
+  // generation.
+  static std::size_t run(struct libusb_context* ctx,
+      struct libusb_device_handle* dev_handle, unsigned char endpoint,
+      unsigned char type, void* data, std::size_t size, usb_capture* capture,
+      const std::shared_ptr<transfer_tracker>& tracker,
+      std::uint64_t generation, boost::system::error_code& ec)
+  {
+    blocking_transfer* b = new blocking_transfer(tracker);
+    libusb_fill_bulk_transfer(b->transfer_, dev_handle, endpoint,
+        static_cast<unsigned char*>(data), static_cast<int>(size),
+        &blocking_transfer::callback, b, 0); // 0ms timeout
+    b->transfer_->type = type;
+
+    if (!tracker->submit(b->transfer_, generation))
+    {
+      tracker->leave(0);
+      delete b;
+      ec = asio::error::operation_aborted;
+      return 0;
+    }
+
+    if (capture)
+      capture->record_submit(b->transfer_);
+
+    int err = libusb_submit_transfer(b->transfer_);
+    if (err != LIBUSB_SUCCESS)
+    {
+      if (capture)
+        capture->record('E', reinterpret_cast<std::uintptr_t>(b->transfer_),
+            dev_handle, endpoint, type, usb_capture::error_status(err), 0,
+            0, 0);
+      tracker->leave(b->transfer_);
+      delete b;
+      ec = libusb_error(err);
+      return 0;
+    }
+
+    std::size_t bytes_transferred = 0;
+    if (usb_device_ops::wait_transfer(ctx, &b->complete_))
+    {
+      if (capture)
+        capture->record_complete(b->transfer_);
+      ec = usb_device_ops::transfer_error(b->transfer_->status);
+      bytes_transferred = b->transfer_->actual_length;
+    }
+    else
+    {
+      // Leave the transfer to its callback, run by another event handler or
+      // when the device is closed.
+      libusb_cancel_transfer(b->transfer_);
+      ec = libusb_error(LIBUSB_ERROR_IO);
+    }
+
+    b->finish();
+    return bytes_transferred;
+  }
+
+private:
+  explicit blocking_transfer(const std::shared_ptr<transfer_tracker>& tracker)
+    : tracker_(tracker)
+    , transfer_(libusb_alloc_transfer(0))
+    , complete_(0)
+    , pending_(2)
+  {
+  }
+
+  ~blocking_transfer()
+  {
+    libusb_free_transfer(transfer_);
+  }
+
+  static void LIBUSB_CALL callback(struct libusb_transfer* transfer)
+  {
+    auto b(static_cast<blocking_transfer*>(transfer->user_data));
+    b->tracker_->leave(transfer);
+    b->complete_ = 1;
+    b->finish();
+  }
+
+  void finish()
+  {
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete this;
+  }
+
+  std::shared_ptr<transfer_tracker> tracker_;
+  struct libusb_transfer* transfer_;
+  int complete_;
+  std::atomic<int> pending_;
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include "libusb/detail/pcapng_writer.hpp"
+
+namespace libusb {
+namespace detail {
+
+// Bounded multi-producer, single-consumer ring of capture records. Each slot
+// holds a usbmon header followed by at most snaplen payload bytes, so the
+// memory footprint is fixed at construction. Producers never block: when the
+// ring is full the record is dropped and counted.
+class capture_ring
+{
+public:
+  capture_ring(std::size_t capacity, std::size_t snaplen)
+    : capacity_(round_up_pow2(capacity))
+    , snaplen_(snaplen)
+    , stride_((sizeof(slot) + snaplen + alignof(slot) - 1)
+        / alignof(slot) * alignof(slot))
+    , storage_(new unsigned char[capacity_ * stride_])
+    , enqueue_pos_(0)
+    , dequeue_pos_(0)
+    , dropped_(0)
+  {
+    for (std::size_t i = 0; i < capacity_; ++i)
+      new (storage_.get() + i * stride_) slot(i);
+  }
+
+  ~capture_ring()
+  {
+    for (std::size_t i = 0; i < capacity_; ++i)
+      at(i).~slot();
+  }
+
+  // Append a record. The payload is truncated to snaplen. Returns false if
+  // the ring was full.
+  bool push(const usbmon_packet& header, const void* data, std::size_t size)
+  {
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    slot* s;
+    for (;;)
+    {
+      s = &at(pos);
+      std::size_t seq = s->sequence_.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq)
+        - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0)
+      {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+              std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+      {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else
+      {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    std::size_t captured = size < snaplen_ ? size : snaplen_;
+    s->header_ = header;
+    s->header_.len_cap = static_cast<std::uint32_t>(captured);
+    s->size_ = size;
+    if (captured)
+      std::memcpy(payload(*s), data, captured);
+    s->sequence_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Hand every ready record to f(header, payload, size) in order, where size
+  // is the payload length before truncation. Must only be called from one
+  // thread at a time. Returns the number of records consumed.
+  template <typename Function>
+  std::size_t consume(Function f)
+  {
+    std::size_t n = 0;
+    for (;;)
+    {
+      slot& s = at(dequeue_pos_);
+      std::size_t seq = s.sequence_.load(std::memory_order_acquire);
+      if (seq != dequeue_pos_ + 1)
+        return n;
+
+      f(s.header_, static_cast<const unsigned char*>(payload(s)), s.size_);
+      s.sequence_.store(dequeue_pos_ + capacity_, std::memory_order_release);
+      ++dequeue_pos_;
+      ++n;
+    }
+  }
+
+  std::size_t capacity() const
+  {
+    return capacity_;
+  }
+
+  std::size_t snaplen() const
+  {
+    return snaplen_;
+  }
+
+  std::size_t dropped() const
+  {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct slot
+  {
+    explicit slot(std::size_t sequence)
+      : sequence_(sequence)
+    {
+    }
+
+    std::atomic<std::size_t> sequence_;
+    usbmon_packet header_;
+    std::size_t size_;
+  };
+
+  static std::size_t round_up_pow2(std::size_t n)
+  {
+    std::size_t p = 1;
+    while (p < n)
+      p <<= 1;
+    return p;
+  }
+
+  slot& at(std::size_t pos)
+  {
+    return *reinterpret_cast<slot*>(
+        storage_.get() + (pos & (capacity_ - 1)) * stride_);
+  }
+
+  static unsigned char* payload(slot& s)
+  {
+    return reinterpret_cast<unsigned char*>(&s) + sizeof(slot);
+  }
+
+  const std::size_t capacity_;
+  const std::size_t snaplen_;
+  const std::size_t stride_;
+  std::unique_ptr<unsigned char[]> storage_;
+  alignas(64) std::atomic<std::size_t> enqueue_pos_;
+  alignas(64) std::size_t dequeue_pos_;
+  std::atomic<std::size_t> dropped_;
+};
+
+} // namespace detail
+} // namespace libusb
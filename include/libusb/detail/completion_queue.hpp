@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// Lock-free multi-producer, single-consumer queue of completed operations.
+// Producers are libusb transfer callbacks, which may run on any thread that
+// handles libusb events. The consumer takes the whole queue at once so that a
+// burst of completions can be handed to the scheduler with a single wakeup.
+class completion_queue
+{
+public:
+  // Intrusive queue link, embedded in each operation.
+  class entry
+  {
+  public:
+    explicit entry(asio::detail::operation* op)
+      : next_(0)
+      , op_(op)
+    {
+    }
+
+  private:
+    friend class completion_queue;
+
+    entry* next_;
+    asio::detail::operation* op_;
+  };
+
+  completion_queue()
+    : head_(0)
+  {
+  }
+
+  // Add an operation to the queue. Returns true if the queue was empty.
+  bool push(entry* e)
+  {
+    entry* head = head_.load(std::memory_order_relaxed);
+    do
+    {
+      e->next_ = head;
+    } while (!head_.compare_exchange_weak(head, e,
+          std::memory_order_release, std::memory_order_relaxed));
+    return head == 0;
+  }
+
+  // Move all queued operations onto ops, in the order they were pushed.
+  void pop_all(asio::detail::op_queue<asio::detail::operation>& ops)
+  {
+    entry* e = head_.exchange(0, std::memory_order_acquire);
+
+    entry* fifo = 0;
+    while (e)
+    {
+      entry* next = e->next_;
+      e->next_ = fifo;
+      fifo = e;
+      e = next;
+    }
+
+    while (fifo)
+    {
+      entry* next = fifo->next_;
+      ops.push(fifo->op_);
+      fifo = next;
+    }
+  }
+
+  bool empty() const
+  {
+    return head_.load(std::memory_order_relaxed) == 0;
+  }
+
+private:
+  std::atomic<entry*> head_;
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <libusb.h>
+#include "libusb/detail/completion_queue.hpp"
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// A libusb context with its own event handling: the devices opened in it,
+// the queue their completed transfers are collected in, and the thread
+// handling its events in the event_thread and busy_poll modes. Shards share
+// nothing, so the events of different shards are handled without contending
+// for libusb's event lock. The shard of the default context has a null
+// context and is not owned.
+class context_shard
+{
+public:
+  explicit context_shard(struct libusb_context* ctx, bool owned)
+    : ctx_(ctx)
+    , owned_(owned)
+    , stop_(false)
+  {
+  }
+
+  ~context_shard()
+  {
+    if (owned_)
+      libusb_exit(ctx_);
+  }
+
+  struct libusb_context* context() const
+  {
+    return ctx_;
+  }
+
+  completion_queue& completions()
+  {
+    return completions_;
+  }
+
+  // Whether the event thread is to exit. The thread is interrupted when the
+  // flag is set, and a pending interruption makes its next wait for events
+  // return at once.
+  bool stopping() const
+  {
+    return stop_.load(std::memory_order_acquire);
+  }
+
+  template <typename Function>
+  void start(Function f)
+  {
+    stop_.store(false, std::memory_order_release);
+    thread_.reset(new asio::detail::thread(f));
+  }
+
+  // Stop and join the event thread. Must not be called with a lock held that
+  // handlers run by the thread may take.
+  void stop()
+  {
+    if (thread_.get())
+    {
+      stop_.store(true, std::memory_order_release);
+      libusb_interrupt_event_handler(ctx_);
+      thread_->join();
+      thread_.reset();
+    }
+
+    // Abandon completions that were never handed to the scheduler.
+    asio::detail::op_queue<asio::detail::operation> ops;
+    completions_.pop_all(ops);
+  }
+
+private:
+  // Disallow copying and assignment.
+  context_shard(const context_shard&) BOOST_ASIO_DELETED;
+  context_shard& operator=(const context_shard&) BOOST_ASIO_DELETED;
+
+  struct libusb_context* ctx_;
+  bool owned_;
+  completion_queue completions_;
+  asio::detail::scoped_ptr<asio::detail::thread> thread_;
+  std::atomic<bool> stop_;
+};
+
+} // namespace detail
+} // namespace libusb
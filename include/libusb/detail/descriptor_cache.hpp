@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <libusb.h>
+
+namespace libusb {
+namespace detail {
+
+// Descriptors of one usb device. Device and configuration descriptors are
+// read from the operating system's copy when a device is assigned; the BOS
+// descriptor and the standard strings need control transfers and are read
+// when the device is opened. Other strings are added as they are fetched.
+// Not thread-safe; the owning implementation's mutex guards it.
+class descriptor_cache
+{
+public:
+  typedef std::shared_ptr<const struct libusb_config_descriptor>
+    config_descriptor_ptr;
+  typedef std::shared_ptr<const struct libusb_bos_descriptor>
+    bos_descriptor_ptr;
+
+  descriptor_cache()
+    : has_device_(false)
+    , device_()
+  {
+  }
+
+  // Read the descriptors available without opening the device.
+  void load(libusb_device* device)
+  {
+    clear();
+    if (!device
+        || libusb_get_device_descriptor(device, &device_) != LIBUSB_SUCCESS)
+      return;
+
+    has_device_ = true;
+    configs_.resize(device_.bNumConfigurations);
+    for (std::uint8_t i = 0; i < device_.bNumConfigurations; ++i)
+    {
+      struct libusb_config_descriptor* config = 0;
+      if (libusb_get_config_descriptor(device, i, &config) == LIBUSB_SUCCESS)
+        configs_[i].reset(config, &libusb_free_config_descriptor);
+    }
+  }
+
+  // Read the descriptors that need control transfers. Failures leave the
+  // affected entries uncached.
+  void load_open(struct libusb_device_handle* dev_handle)
+  {
+    if (!bos_)
+    {
+      struct libusb_bos_descriptor* bos = 0;
+      if (libusb_get_bos_descriptor(dev_handle, &bos) == LIBUSB_SUCCESS)
+        bos_.reset(bos, &libusb_free_bos_descriptor);
+    }
+
+    if (!has_device_)
+      return;
+
+    std::uint8_t indices[3] = { device_.iManufacturer, device_.iProduct,
+      device_.iSerialNumber };
+    for (std::uint8_t index : indices)
+    {
+      std::string value;
+      if (index && !find_string(index, value)
+          && fetch_string(dev_handle, index, value) >= 0)
+        strings_[index] = value;
+    }
+  }
+
+  void clear()
+  {
+    has_device_ = false;
+    device_ = libusb_device_descriptor();
+    configs_.clear();
+    bos_.reset();
+    strings_.clear();
+  }
+
+  bool device_descriptor(struct libusb_device_descriptor& descriptor) const
+  {
+    if (has_device_)
+      descriptor = device_;
+    return has_device_;
+  }
+
+  config_descriptor_ptr config_descriptor(std::uint8_t index) const
+  {
+    return index < configs_.size() ? configs_[index] : config_descriptor_ptr();
+  }
+
+  bos_descriptor_ptr bos_descriptor() const
+  {
+    return bos_;
+  }
+
+  bool find_string(std::uint8_t index, std::string& value) const
+  {
+    auto it = strings_.find(index);
+    if (it == strings_.end())
+      return false;
+    value = it->second;
+    return true;
+  }
+
+  void add_string(std::uint8_t index, const std::string& value)
+  {
+    strings_[index] = value;
+  }
+
+  // Read a string descriptor with a control transfer. Returns a libusb error
+  // code on failure.
+  static int fetch_string(struct libusb_device_handle* dev_handle,
+      std::uint8_t index, std::string& value)
+  {
+    unsigned char data[256];
+    int rc = libusb_get_string_descriptor_ascii(dev_handle, index, data,
+        sizeof(data));
+    if (rc >= 0)
+      value.assign(reinterpret_cast<const char*>(data), rc);
+    return rc;
+  }
+
+private:
+  bool has_device_;
+  struct libusb_device_descriptor device_;
+  std::vector<config_descriptor_ptr> configs_;
+  bos_descriptor_ptr bos_;
+  std::map<std::uint8_t, std::string> strings_;
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "libusb/usb_transfer_timing.hpp"
+
+namespace libusb {
+namespace detail {
+
+// Rolling statistics of the endpoints of one device, updated from the libusb
+// callbacks. Endpoints are indexed by number and direction, so an update is
+// an array access and a few additions under a lock that is only contended by
+// readers.
+class endpoint_stats
+{
+public:
+  void record(std::uint8_t address, const transfer_timing& timing)
+  {
+    typedef raw_monotonic_clock::duration duration;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    endpoint_statistics& s = endpoints_[index(address)];
+    duration latency = timing.latency();
+
+    if (s.transfers == 0)
+    {
+      s.min_latency = s.max_latency = s.mean_latency = latency;
+    }
+    else
+    {
+      duration interval = timing.completed - s.last_completed;
+      if (s.transfers == 1)
+        s.mean_interval = interval;
+      else
+      {
+        duration d = interval - s.last_interval;
+        if (d < duration::zero())
+          d = -d;
+        s.jitter += (d - s.jitter) / 16;
+        s.mean_interval += (interval - s.mean_interval) / 16;
+      }
+      s.last_interval = interval;
+
+      if (latency < s.min_latency)
+        s.min_latency = latency;
+      if (latency > s.max_latency)
+        s.max_latency = latency;
+      s.mean_latency += (latency - s.mean_latency) / 16;
+    }
+
+    s.last_completed = timing.completed;
+    ++s.transfers;
+  }
+
+  endpoint_statistics get(std::uint8_t address) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return endpoints_[index(address)];
+  }
+
+  void reset(std::uint8_t address)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    endpoints_[index(address)] = endpoint_statistics();
+  }
+
+private:
+  static std::size_t index(std::uint8_t address)
+  {
+    return (address & 0x0f) | ((address & 0x80) >> 3);
+  }
+
+  mutable std::mutex mutex_;
+  endpoint_statistics endpoints_[32];
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <libusb.h>
+
+namespace libusb {
+namespace detail {
+
+// Fills a transfer for an endpoint chosen at runtime, as configured with the
+// usb_device_base::endpoint_address option.
+struct runtime_endpoint
+{
+  static void fill(struct libusb_transfer* transfer,
+      struct libusb_device_handle* dev_handle, std::uint8_t address,
+      std::uint32_t stream_id, unsigned char* data, std::size_t size,
+      libusb_transfer_cb_fn callback, void* user_data)
+  {
+    if (stream_id)
+    {
+      libusb_fill_bulk_stream_transfer(transfer, dev_handle, address,
+          stream_id, data, static_cast<int>(size), callback, user_data,
+          0); // 0ms timeout
+    }
+    else
+    {
+      libusb_fill_interrupt_transfer(transfer, dev_handle, address,
+          data, static_cast<int>(size), callback, user_data,
+          0); // 0ms timeout
+    }
+  }
+};
+
+// Fills a transfer for an endpoint fixed at compile time. Address and type are
+// constants, so filling is a handful of unconditional stores, plus the stream
+// id of a transfer on a bulk stream.
+template <std::uint8_t Address, enum libusb_transfer_type Type>
+struct static_endpoint
+{
+  static void fill(struct libusb_transfer* transfer,
+      struct libusb_device_handle* dev_handle, std::uint8_t /*address*/,
+      std::uint32_t stream_id, unsigned char* data, std::size_t size,
+      libusb_transfer_cb_fn callback, void* user_data)
+  {
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint = Address;
+    transfer->type = Type;
+    if (stream_id)
+    {
+      transfer->type = LIBUSB_TRANSFER_TYPE_BULK_STREAM;
+      libusb_transfer_set_stream_id(transfer, stream_id);
+    }
+    transfer->timeout = 0;
+    transfer->buffer = data;
+    transfer->length = static_cast<int>(size);
+    transfer->user_data = user_data;
+    transfer->callback = callback;
+  }
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <boost/asio.hpp>
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// Type-erased, move-only completion handler used by the composed objects that
+// keep several user operations queued at once. Invoking it posts the handler
+// to its associated executor and releases the outstanding work it holds.
+template <typename... Args>
+class erased_handler
+{
+public:
+  erased_handler()
+  {
+  }
+
+  template <typename Handler, typename Executor>
+  erased_handler(Handler&& handler, const Executor& ex)
+    : impl_(new impl<typename std::decay<Handler>::type, Executor>(
+          std::forward<Handler>(handler), ex))
+  {
+  }
+
+  explicit operator bool() const
+  {
+    return impl_ != nullptr;
+  }
+
+  void operator()(Args... args)
+  {
+    std::unique_ptr<base> i(std::move(impl_));
+    i->invoke(args...);
+  }
+
+private:
+  struct base
+  {
+    virtual ~base()
+    {
+    }
+
+    virtual void invoke(Args... args) = 0;
+  };
+
+  template <typename Handler, typename Executor>
+  struct impl : base
+  {
+    typedef typename asio::associated_executor<
+      Handler, Executor>::type handler_executor_type;
+
+    impl(Handler&& handler, const Executor& ex)
+      : handler_(std::move(handler))
+      , work_(asio::get_associated_executor(handler_, ex))
+    {
+    }
+
+    void invoke(Args... args)
+    {
+      handler_executor_type ex(work_.get_executor());
+      asio::post(ex, asio::detail::bind_handler(std::move(handler_), args...));
+      work_.reset();
+    }
+
+    Handler handler_;
+    asio::executor_work_guard<handler_executor_type> work_;
+  };
+
+  std::unique_ptr<base> impl_;
+};
+
+} // namespace detail
+} // namespace libusb
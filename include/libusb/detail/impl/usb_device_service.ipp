@@ -1,76 +1,872 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
 #include <boost/asio.hpp>
+#if defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+#endif
 
 #include "libusb/detail/usb_device_service.hpp"
 
 namespace libusb {
 namespace detail { 
 
+class usb_device_service::event_thread_function
+{
+public:
+  event_thread_function(usb_device_service* service, context_shard* shard,
+      int mode, int cpu, std::chrono::microseconds spin_threshold)
+    : service_(service)
+    , shard_(shard)
+    , mode_(mode)
+    , cpu_(cpu)
+    , spin_threshold_(spin_threshold)
+  {
+  }
+
+  void operator()()
+  {
+    on_event_thread() = shard_;
+    pin_thread(cpu_);
+
+    if (mode_ == usb_service_options::busy_poll)
+      service_->run_busy_poll(*shard_, spin_threshold_);
+    else
+      service_->run_event_thread(*shard_);
+  }
+
+private:
+  usb_device_service* service_;
+  context_shard* shard_;
+  int mode_;
+  int cpu_;
+  std::chrono::microseconds spin_threshold_;
+};
+
+void usb_device_service::set_options(const usb_service_options& options,
+    boost::system::error_code& ec)
+{
+  asio::detail::mutex::scoped_lock lock(mutex_);
+
+  if (event_threads_started_ && options.mode() != mode_.load())
+  {
+    ec = asio::error::already_started;
+    return;
+  }
+
+  // The shards are fixed once created by the first open or transfer.
+  if (!shards_.empty() && (options.context_shards() != shard_count_
+        || options.policy() != shard_policy_))
+  {
+    ec = asio::error::already_started;
+    return;
+  }
+
+  // Discovery is fixed when the first implementation initialises libusb, and
+  // cannot be enabled again once it was disabled.
+  if ((!trackers_.empty() || discovery_disabled_)
+      && options.device_discovery() != device_discovery_)
+  {
+    ec = asio::error::already_started;
+    return;
+  }
+
+  mode_.store(options.mode(), std::memory_order_release);
+  open_threads_ = options.open_threads();
+  cpu_affinity_ = options.cpu_affinity();
+  spin_threshold_ = options.spin_threshold();
+  shutdown_timeout_ = options.shutdown_timeout();
+  device_discovery_ = options.device_discovery();
+  shard_count_ = options.context_shards();
+  shard_policy_ = options.policy();
+  ec = boost::system::error_code();
+}
+
+void usb_device_service::create_shards(boost::system::error_code& ec)
+{
+  ec = boost::system::error_code();
+  if (!shards_.empty())
+    return;
+
+  if (shard_count_ == 0)
+  {
+    shards_.emplace_back(new context_shard(NULL, false));
+    return;
+  }
+
+  for (std::size_t i = 0; i < shard_count_; ++i)
+  {
+    struct libusb_context* ctx = NULL;
+    int err = libusb_init(&ctx);
+    if (err != LIBUSB_SUCCESS)
+    {
+      ec = libusb_error(err);
+      shards_.clear();
+      return;
+    }
+    shards_.emplace_back(new context_shard(ctx, true));
+  }
+}
+
+context_shard& usb_device_service::shard_of(const implementation_type& impl)
+{
+  if (impl.shard_)
+    return *impl.shard_;
+
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  boost::system::error_code ec;
+  create_shards(ec);
+  asio::detail::throw_error(ec, "create_shards");
+  return *shards_.front();
+}
+
+context_shard* usb_device_service::select_shard(
+    const implementation_type& impl, libusb_device* device,
+    boost::system::error_code& ec)
+{
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  create_shards(ec);
+  if (ec)
+    return 0;
+
+  std::size_t n = shards_.size();
+  std::size_t index;
+  if (impl.shard_option_.value() >= 0)
+    index = static_cast<std::size_t>(impl.shard_option_.value()) % n;
+  else if (shard_policy_ == usb_service_options::by_bus && device)
+    index = libusb_get_bus_number(device) % n;
+  else
+    index = next_shard_.fetch_add(1, std::memory_order_relaxed) % n;
+
+  return shards_[index].get();
+}
+
+void usb_device_service::disable_discovery(boost::system::error_code& ec)
+{
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  if (device_discovery_ || discovery_disabled_)
+    return;
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000108)
+  // The option applies to the default context and to every context
+  // initialised after it, by any service of the process.
+  static std::atomic<bool> disabled(false);
+  if (!disabled.load(std::memory_order_acquire))
+  {
+    int err = libusb_set_option(NULL, LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
+    ec = libusb_error(err);
+    if (ec)
+      return;
+    disabled.store(true, std::memory_order_release);
+  }
+  discovery_disabled_ = true;
+#else
+  ec = asio::error::operation_not_supported;
+#endif
+}
+
+void usb_device_service::shutdown()
+{
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  std::vector<std::shared_ptr<transfer_tracker> > trackers;
+  for (transfer_tracker* tracker : trackers_)
+    trackers.push_back(tracker->shared_from_this());
+  transfer_tracker::clock_type::time_point deadline =
+    transfer_tracker::clock_type::now() + shutdown_timeout_;
+  lock.unlock();
+
+  // Cancel everything first, so that all devices drain concurrently within
+  // one deadline, while the event and worker threads are still running.
+  // Transfers still in flight are completed when their device is destroyed
+  // and its handle closed.
+  for (auto& tracker : trackers)
+    tracker->cancel();
+  for (auto& tracker : trackers)
+    if (!drain(*tracker, deadline))
+      tracker->abandon();
+
+  stop_event_thread();
+  stop_open_pool();
+
+  // Destroy the operations still queued for the resolver thread while the
+  // priority lanes they are linked into exist.
+  base_shutdown();
+}
+
+void usb_device_service::destroy(implementation_type& impl)
+{
+  bool drained = true;
+  if (impl.tracker_)
+  {
+    asio::detail::mutex::scoped_lock lock(mutex_);
+    transfer_tracker::clock_type::time_point deadline =
+      transfer_tracker::clock_type::now() + shutdown_timeout_;
+    trackers_.erase(impl.tracker_.get());
+    lock.unlock();
+
+    drained = drain(*impl.tracker_, deadline);
+    if (!drained)
+      impl.tracker_->abandon();
+  }
+
+  boost::system::error_code ignored_ec;
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  if (impl.tracker_)
+    lock_idle(impl, lock);
+  struct libusb_context* ctx = impl.ctx_;
+  do_close(impl, ignored_ec);
+  lock.unlock();
+
+  // No transfer is left with libusb once the abandoned ones are completed.
+  if (!drained)
+    complete_abandoned(*impl.tracker_, ctx);
+
+  // The implementation was initialised with the default context; shards are
+  // released with the service.
+  libusb_exit(NULL);
+}
+
+std::shared_ptr<transfer_tracker> usb_device_service::new_tracker(
+    implementation_type& impl)
+{
+  std::shared_ptr<transfer_tracker> tracker =
+    std::make_shared<transfer_tracker>(&impl);
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  trackers_.insert(tracker.get());
+  return tracker;
+}
+
+bool usb_device_service::drain(transfer_tracker& tracker,
+    transfer_tracker::clock_type::time_point deadline)
+{
+  cancel_ops(tracker);
+
+  if (!on_event_thread())
+    return tracker.wait(deadline);
+
+  // Called from a handler run by a busy_poll thread, which would otherwise
+  // have to deliver the callbacks being waited for.
+  struct libusb_context* ctx = on_event_thread()->context();
+  while (tracker.outstanding() != 0
+      && transfer_tracker::clock_type::now() < deadline)
+  {
+    struct timeval tv = { 0, 10000 };
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+  return tracker.outstanding() == 0;
+}
+
+void usb_device_service::start_event_thread()
+{
+  asio::detail::mutex::scoped_lock lock(mutex_);
+
+  if (!event_threads_started_)
+  {
+    boost::system::error_code ec;
+    create_shards(ec);
+    asio::detail::throw_error(ec, "create_shards");
+
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      int cpu = cpu_affinity_ < 0 ? -1 : cpu_affinity_ + static_cast<int>(i);
+      shards_[i]->start(event_thread_function(this, shards_[i].get(),
+            mode_.load(), cpu, spin_threshold_));
+    }
+    event_threads_started_ = true;
+  }
+}
+
+void usb_device_service::stop_event_thread()
+{
+  // The threads are joined without the service locked, as a handler run by a
+  // busy_poll thread may start a transfer and lock it. The shards themselves
+  // live as long as the service.
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  std::vector<context_shard*> shards;
+  for (auto& shard : shards_)
+    shards.push_back(shard.get());
+  lock.unlock();
+
+  for (context_shard* shard : shards)
+    shard->stop();
+
+  lock.lock();
+  event_threads_started_ = false;
+}
+
+void usb_device_service::run_event_thread(context_shard& shard)
+{
+  while (!shard.stopping())
+  {
+    libusb_handle_events_completed(shard.context(), NULL);
+    post_completions(shard);
+  }
+}
+
+void usb_device_service::run_busy_poll(context_shard& shard,
+    std::chrono::microseconds spin_threshold)
+{
+  typedef std::chrono::steady_clock clock;
+
+  struct libusb_context* ctx = shard.context();
+  completion_queue& completions = shard.completions();
+  adaptive_spin spin(spin_threshold);
+
+  clock::time_point last_event = clock::now();
+  while (!shard.stopping())
+  {
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed(ctx, &zero, NULL);
+
+    adaptive_spin::duration idle =
+      std::chrono::duration_cast<adaptive_spin::duration>(
+          clock::now() - last_event);
+    if (completions.empty())
+    {
+      if (idle < spin.threshold())
+        continue;
+
+      // Idle for too long: block until the next event, and spin for less
+      // the next time.
+      spin.blocked();
+      libusb_handle_events_completed(ctx, NULL);
+      if (completions.empty())
+        continue;
+    }
+    else
+      spin.caught(idle);
+
+    // Hand the completions to the scheduler and run them on this thread. The
+    // completions keep the scheduler's work count above zero, so polling
+    // does not stop an io_context that still has work.
+    post_completions(shard);
+    boost::system::error_code ec;
+    scheduler_.poll(ec);
+    last_event = clock::now();
+  }
+}
+
+void usb_device_service::pin_thread(int cpu)
+{
+#if defined(__linux__)
+  if (cpu >= 0 && cpu < CPU_SETSIZE)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#else
+  (void)cpu;
+#endif
+}
+
+void usb_device_service::post_completions(context_shard& shard)
+{
+  asio::detail::op_queue<asio::detail::operation> ops;
+  shard.completions().pop_all(ops);
+  if (!ops.empty())
+    scheduler_.post_deferred_completions(ops);
+}
+
+asio::thread_pool& usb_device_service::open_pool()
+{
+  asio::detail::mutex::scoped_lock lock(mutex_);
+
+  if (!open_pool_.get())
+  {
+    std::size_t threads = open_threads_;
+    if (threads == 0)
+      threads = asio::detail::thread::hardware_concurrency();
+    open_pool_.reset(new asio::thread_pool(threads ? threads : 1));
+  }
+
+  return *open_pool_;
+}
+
+void usb_device_service::stop_open_pool()
+{
+  // Joined without the service locked, like the event threads.
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  std::unique_ptr<asio::thread_pool> pool(open_pool_.release());
+  lock.unlock();
+
+  if (pool.get())
+  {
+    pool->stop();
+    pool->join();
+  }
+}
+
 void usb_device_service::assign(usb_device_service::implementation_type& impl, 
     native_handle_type native_usb_device, boost::system::error_code& ec)
 {
-  if (is_open(impl))
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+
+  if (do_is_open(impl))
   {
     ec = asio::error::already_open;
     return;
   }
 
   impl.device_ = native_usb_device;
+  impl.descriptors_.load(native_usb_device);
 }
 
-bool usb_device_service::is_open(const implementation_type& impl) const
-{ 
-  if (impl.dev_handle_)
+void usb_device_service::assign_fd(implementation_type& impl, int fd,
+    boost::system::error_code& ec)
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+
+  if (do_is_open(impl))
   {
-    int err = libusb_claim_interface(impl.dev_handle_, 
-        impl.interface_number_.value());
-    return err == LIBUSB_SUCCESS;
+    ec = asio::error::already_open;
+    return;
+  }
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000108)
+  context_shard* shard = select_shard(impl, NULL, ec);
+  if (!shard)
+    return;
+
+  int err = libusb_wrap_sys_device(shard->context(),
+      static_cast<intptr_t>(fd), &impl.dev_handle_);
+  if (err != LIBUSB_SUCCESS)
+  {
+    impl.dev_handle_ = NULL;
+    ec = libusb_error(err);
+    return;
   }
-  
-  return false;
+  impl.ctx_ = shard->context();
+  impl.shard_ = shard;
+
+  // The wrapped device exists only as long as the handle; keep it for the
+  // descriptors until the device is closed.
+  impl.device_ = libusb_ref_device(libusb_get_device(impl.dev_handle_));
+  impl.owns_device_ = true;
+  impl.descriptors_.load(impl.device_);
+
+  ec = boost::system::error_code();
+  do_claim(impl, ec);
+#else
+  (void)fd;
+  ec = asio::error::operation_not_supported;
+#endif
+}
+
+bool usb_device_service::is_open(const implementation_type& impl) const
+{ 
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  return do_is_open(impl);
+}
+
+bool usb_device_service::do_is_open(const implementation_type& impl) const
+{ 
+  return impl.dev_handle_ != NULL;
 }
 
 void usb_device_service::open(implementation_type& impl, 
     boost::system::error_code& ec)
 {
-  if (is_open(impl))
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+
+  if (do_is_open(impl))
   {
     ec = boost::asio::error::already_open;
     return;
   } 
 
-  int err = libusb_open(impl.device_, &impl.dev_handle_);
-  if (err != LIBUSB_SUCCESS)
+  do_open(impl, ec);
+}
+
+void usb_device_service::do_open(implementation_type& impl, 
+    boost::system::error_code& ec)
+{
+  if (!impl.device_)
+  {
+    ec = asio::error::no_such_device;
+    return;
+  }
+
+  context_shard* shard = select_shard(impl, impl.device_, ec);
+  if (!shard)
+    return;
+
+  // A shard with a context of its own opens the same physical device in that
+  // context.
+  if (shard->context())
+  {
+    if (!usb_device_ops::open_same_device(shard->context(), impl.device_,
+          &impl.dev_handle_, &impl.node_, ec))
+    {
+      impl.dev_handle_ = NULL;
+      if (!ec)
+        ec = asio::error::no_such_device;
+      return;
+    }
+  }
+  else
   {
+    int err = libusb_open(impl.device_, &impl.dev_handle_);
+    if (err != LIBUSB_SUCCESS)
+    {
+      impl.dev_handle_ = NULL;
+      ec = libusb_error(err);
+      return;
+    }
+  }
+  impl.ctx_ = shard->context();
+  impl.shard_ = shard;
+
+  do_claim(impl, ec);
+}
+
+void usb_device_service::do_claim(implementation_type& impl,
+    boost::system::error_code& ec)
+{
+  int err;
+  if (impl.detach_kernel_driver_.value())
+  {
+    err = libusb_set_auto_detach_kernel_driver(impl.dev_handle_, 1);
+    if (err != LIBUSB_SUCCESS and err != LIBUSB_ERROR_NOT_SUPPORTED)
+      ec = libusb_error(err);
+  }
+
+  if (!ec && impl.configuration_.value() >= 0)
+  {
+    err = libusb_set_configuration(impl.dev_handle_,
+        impl.configuration_.value());
     ec = libusb_error(err);
+  }
+
+  if (!ec)
+  {
+    err = libusb_claim_interface(impl.dev_handle_,  
+        impl.interface_number_.value());
+    ec = libusb_error(err);
+  }
+
+  if (!ec)
+    alloc_streams(impl, ec);
+
+  if (ec)
+  {
+    libusb_close(impl.dev_handle_);
+    impl.dev_handle_ = NULL;
     return;
   }
 
-  err = libusb_claim_interface(impl.dev_handle_,  
-      impl.interface_number_.value());
-  ec = libusb_error(err);
+  impl.descriptors_.load_open(impl.dev_handle_);
 }
 
 void usb_device_service::close(implementation_type& impl, 
     boost::system::error_code& ec)
 {
-  if (is_open(impl))
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  transfer_tracker::clock_type::time_point deadline =
+    transfer_tracker::clock_type::now() + shutdown_timeout_;
+  lock.unlock();
+
+  asio::detail::mutex::scoped_lock impl_lock(impl.mutex_);
+  std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+  impl_lock.unlock();
+
+  // Outstanding transfers must not outlive the device handle. Those that do
+  // not finish in time are abandoned, as a bounded close is preferred, and
+  // completed once the handle is closed.
+  bool drained = drain(*tracker, deadline);
+  if (!drained)
+    tracker->abandon();
+
+  impl_lock.lock();
+  lock_idle(impl, impl_lock);
+  struct libusb_context* ctx = impl.ctx_;
+  do_close(impl, ec);
+  if (!drained && impl.tracker_ == tracker)
+    renew_tracker(impl);
+  impl_lock.unlock();
+
+  if (!drained)
+    complete_abandoned(*tracker, ctx);
+}
+
+void usb_device_service::lock_idle(implementation_type& impl,
+    asio::detail::mutex::scoped_lock& lock)
+{
+  // Jobs register before they take the handle, which they do with the
+  // implementation locked, so none can use the handle while it is locked
+  // with none left.
+  while (impl.tracker_->jobs() != 0)
+  {
+    std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+    lock.unlock();
+    tracker->wait_jobs();
+    lock.lock();
+  }
+}
+
+void usb_device_service::complete_abandoned(transfer_tracker& tracker,
+    struct libusb_context* ctx)
+{
+  std::vector<struct libusb_transfer*> transfers;
+  tracker.submitted(transfers);
+  if (transfers.empty())
+    return;
+
+  for (struct libusb_transfer* transfer : transfers)
   {
+    transfer->status = LIBUSB_TRANSFER_CANCELLED;
+    transfer->actual_length = 0;
+    transfer->callback(transfer);
+  }
+
+  libusb_interrupt_event_handler(ctx);
+}
+
+void usb_device_service::renew_tracker(implementation_type& impl)
+{
+  send_window& sends = impl.tracker_->sends();
+  std::size_t max_send_ops = sends.max_ops();
+  std::size_t max_send_bytes = sends.max_bytes();
+  send_window& receives = impl.tracker_->receives();
+  std::size_t max_receive_ops = receives.max_ops();
+  std::size_t max_receive_bytes = receives.max_bytes();
+
+  asio::detail::mutex::scoped_lock lock(mutex_);
+  trackers_.erase(impl.tracker_.get());
+  lock.unlock();
+
+  impl.tracker_ = new_tracker(impl);
+  send_window::ready_queue ready;
+  impl.tracker_->sends().limit(max_send_ops, max_send_bytes, ready);
+  impl.tracker_->receives().limit(max_receive_ops, max_receive_bytes, ready);
+}
+
+void usb_device_service::cancel(implementation_type& impl,
+    boost::system::error_code& ec)
+{
+  // Close and move construction replace the tracker under the lock.
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+  lock.unlock();
+
+  cancel_ops(*tracker);
+  ec = boost::system::error_code();
+}
+
+void usb_device_service::cancel_ops(transfer_tracker& tracker)
+{
+  tracker.cancel();
+
+  send_window::ready_queue ready;
+  tracker.sends().cancel(ready);
+  if (!ready.empty())
+    scheduler_.post_deferred_completions(ready);
+}
+
+endpoint_statistics usb_device_service::transfer_statistics(
+    const implementation_type& impl, std::uint8_t address) const
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  return impl.tracker_->statistics().get(address);
+}
+
+void usb_device_service::reset_transfer_statistics(implementation_type& impl,
+    std::uint8_t address)
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  impl.tracker_->statistics().reset(address);
+}
+
+void usb_device_service::do_close(implementation_type& impl, 
+    boost::system::error_code& ec)
+{
+  if (do_is_open(impl))
+  {
+    free_streams(impl);
     int err = libusb_release_interface(impl.dev_handle_, 
         impl.interface_number_.value());
     ec = libusb_error(err);
     libusb_close(impl.dev_handle_);
+    impl.dev_handle_ = NULL;
+    usb_device_ops::close_node(impl.node_);
+    impl.node_ = -1;
+  }
+
+  if (impl.owns_device_)
+  {
+    libusb_unref_device(impl.device_);
+    impl.device_ = NULL;
+    impl.owns_device_ = false;
+  }
+}
+
+void usb_device_service::alloc_streams(implementation_type& impl,
+    boost::system::error_code& ec)
+{
+  if (impl.stream_count_.value() == 0)
+    return;
+
+  unsigned char endpoints[2] = {
+    static_cast<unsigned char>(impl.endpoint_address_.value()),
+    static_cast<unsigned char>(impl.endpoint_address_.value() + 128)
+  };
+  int rc = libusb_alloc_streams(impl.dev_handle_, impl.stream_count_.value(),
+      endpoints, 2);
+  if (rc < 0)
+  {
+    ec = libusb_error(rc);
+    return;
+  }
+
+  impl.streams_ = rc;
+}
+
+void usb_device_service::free_streams(implementation_type& impl)
+{
+  if (impl.streams_ == 0)
+    return;
+
+  unsigned char endpoints[2] = {
+    static_cast<unsigned char>(impl.endpoint_address_.value()),
+    static_cast<unsigned char>(impl.endpoint_address_.value() + 128)
+  };
+  libusb_free_streams(impl.dev_handle_, endpoints, 2);
+  impl.streams_ = 0;
+}
+
+void usb_device_service::device_descriptor(const implementation_type& impl,
+    struct libusb_device_descriptor& descriptor,
+    boost::system::error_code& ec) const
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+
+  if (!impl.descriptors_.device_descriptor(descriptor))
+  {
+    ec = asio::error::no_such_device;
+    return;
   }
+
+  ec = boost::system::error_code();
+}
+
+descriptor_cache::config_descriptor_ptr usb_device_service::config_descriptor(
+    const implementation_type& impl, std::uint8_t index,
+    boost::system::error_code& ec) const
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+
+  descriptor_cache::config_descriptor_ptr config(
+      impl.descriptors_.config_descriptor(index));
+  if (!config)
+  {
+    ec = impl.device_ ? asio::error::invalid_argument
+      : asio::error::no_such_device;
+    return config;
+  }
+
+  ec = boost::system::error_code();
+  return config;
+}
+
+descriptor_cache::bos_descriptor_ptr usb_device_service::bos_descriptor(
+    implementation_type& impl, boost::system::error_code& ec)
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+
+  descriptor_cache::bos_descriptor_ptr bos(impl.descriptors_.bos_descriptor());
+  if (bos)
+  {
+    ec = boost::system::error_code();
+    return bos;
+  }
+
+  if (!impl.dev_handle_)
+  {
+    ec = asio::error::bad_descriptor;
+    return bos;
+  }
+
+  // Devices before USB 2.1 have no BOS descriptor; it is fetched again on
+  // every call.
+  struct libusb_bos_descriptor* native = 0;
+  int rc = libusb_get_bos_descriptor(impl.dev_handle_, &native);
+  ec = libusb_error(rc);
+  if (rc == LIBUSB_SUCCESS)
+    bos.reset(native, &libusb_free_bos_descriptor);
+  return bos;
+}
+
+std::string usb_device_service::string_descriptor(implementation_type& impl,
+    std::uint8_t index, boost::system::error_code& ec)
+{
+  std::string value;
+  if (index == 0)
+  {
+    ec = asio::error::invalid_argument;
+    return value;
+  }
+
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  if (impl.descriptors_.find_string(index, value))
+  {
+    ec = boost::system::error_code();
+    return value;
+  }
+
+  struct libusb_device_handle* dev_handle = impl.dev_handle_;
+  if (!dev_handle)
+  {
+    ec = asio::error::bad_descriptor;
+    return value;
+  }
+
+  // The control transfer is made without holding the lock, as a job that
+  // keeps the handle from being closed and the implementation from being
+  // moved until it ends.
+  std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+  if (!tracker->begin_job(tracker->generation()))
+  {
+    ec = asio::error::operation_aborted;
+    return value;
+  }
+  lock.unlock();
+  int rc = descriptor_cache::fetch_string(dev_handle, index, value);
+
+  lock.lock();
+  if (rc >= 0)
+    impl.descriptors_.add_string(index, value);
+  lock.unlock();
+  tracker->end_job();
+
+  if (rc < 0)
+  {
+    ec = libusb_error(rc);
+    return std::string();
+  }
+
+  ec = boost::system::error_code();
+  return value;
 }
 
 usb_device_service::native_handle_type usb_device_service::native_handle(
     implementation_type& impl)
 {
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
   return impl.device_;
 }
 
+struct libusb_context* usb_device_service::native_context(
+    implementation_type& impl)
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  return impl.ctx_;
+}
+
 void usb_device_service::do_set_option(implementation_type& impl, 
       const usb_device_base::interface_number& option, 
       boost::system::error_code& ec)
@@ -96,6 +892,68 @@ void usb_device_service::do_set_option(implementation_type& impl,
   impl.endpoint_address_ = option;
 }
 
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::capture& option, 
+      boost::system::error_code& /*ec*/)
+{
+  impl.capture_ = option.value();
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::stream_count& option, 
+      boost::system::error_code& /*ec*/)
+{
+  impl.stream_count_ = option;
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::configuration& option, 
+      boost::system::error_code& /*ec*/)
+{
+  impl.configuration_ = option;
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::detach_kernel_driver& option, 
+      boost::system::error_code& /*ec*/)
+{
+  impl.detach_kernel_driver_ = option;
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::send_queue_limit& option, 
+      boost::system::error_code& /*ec*/)
+{
+  send_window::ready_queue ready;
+  impl.tracker_->sends().limit(option.operations(), option.bytes(), ready);
+  if (!ready.empty())
+    scheduler_.post_deferred_completions(ready);
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::receive_queue_limit& option, 
+      boost::system::error_code& /*ec*/)
+{
+  send_window::ready_queue ready;
+  impl.tracker_->receives().limit(option.operations(), option.bytes(), ready);
+  if (!ready.empty())
+    scheduler_.post_deferred_completions(ready);
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::transfer_type& option, 
+      boost::system::error_code& /*ec*/)
+{
+  impl.transfer_type_ = option;
+}
+
+void usb_device_service::do_set_option(implementation_type& impl, 
+      const usb_device_base::shard& option, 
+      boost::system::error_code& /*ec*/)
+{
+  impl.shard_option_ = option;
+}
+
 void usb_device_service::do_get_option(const implementation_type& impl, 
       usb_device_base::endpoint_address& option, 
       boost::system::error_code& /*ec*/) const
@@ -110,48 +968,139 @@ void usb_device_service::do_get_option(const implementation_type& impl,
   option = impl.interface_number_;
 }
 
-template <typename ConstBufferSequence>
-std::size_t usb_device_service::send(implementation_type& impl, 
-    const ConstBufferSequence& buffers, boost::system::error_code& ec)
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::capture& option, 
+      boost::system::error_code& /*ec*/) const
 {
-  asio::detail::buffer_sequence_adapter<asio::const_buffer, 
-  ConstBufferSequence> bufs(buffers);
+  option = usb_device_base::capture(impl.capture_);
+}
 
-  std::size_t bytes_transferred;
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::max_packet_size& option, 
+      boost::system::error_code& ec) const
+{
+  if (!impl.dev_handle_)
+  {
+    ec = asio::error::bad_descriptor;
+    return;
+  }
+
+  int rc = libusb_get_max_packet_size(libusb_get_device(impl.dev_handle_),
+      impl.endpoint_address_.value());
+  if (rc < 0)
+  {
+    ec = libusb_error(rc);
+    return;
+  }
 
-  int rc = libusb_interrupt_transfer(
-      impl.dev_handle_,
-	    impl.endpoint_address_.value(),
-	    bufs.buffers(),
-	    bufs.count(),
-	    &bytes_transferred,
-      0);
+  option.value_ = rc;
+}
 
-  ec = libusb_error(rc);
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::stream_count& option, 
+      boost::system::error_code& /*ec*/) const
+{
+  if (impl.dev_handle_ && impl.stream_count_.value())
+    option = usb_device_base::stream_count(impl.streams_);
+  else
+    option = impl.stream_count_;
+}
 
-  return bytes_transferred;
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::configuration& option, 
+      boost::system::error_code& /*ec*/) const
+{
+  option = impl.configuration_;
 }
 
-template <typename MutableBufferSequence>
-size_t usb_device_service::receive(implementation_type& impl,
-    const MutableBufferSequence& buffers, boost::system::error_code& ec)
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::detach_kernel_driver& option, 
+      boost::system::error_code& /*ec*/) const
+{
+  option = impl.detach_kernel_driver_;
+}
+
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::send_queue_limit& option, 
+      boost::system::error_code& /*ec*/) const
 {
-  asio::detail::buffer_sequence_adapter<asio::mutable_buffer, 
-  MutableBufferSequence> bufs(buffers);
+  send_window& sends = impl.tracker_->sends();
+  option = usb_device_base::send_queue_limit(sends.max_ops(),
+      sends.max_bytes());
+}
 
-  std::size_t bytes_transferred;
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::receive_queue_limit& option, 
+      boost::system::error_code& /*ec*/) const
+{
+  send_window& receives = impl.tracker_->receives();
+  option = usb_device_base::receive_queue_limit(receives.max_ops(),
+      receives.max_bytes());
+}
 
-  int rc = libusb_interrupt_transfer(
-      impl.dev_handle_,
-	    impl.endpoint_address_.value() + 128,
-	    bufs.buffers(),
-	    bufs.count(),
-	    &bytes_transferred,
-      0);
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::transfer_type& option, 
+      boost::system::error_code& /*ec*/) const
+{
+  option = impl.transfer_type_;
+}
 
-  ec = libusb_error(rc);
+void usb_device_service::do_get_option(const implementation_type& impl, 
+      usb_device_base::shard& option, 
+      boost::system::error_code& /*ec*/) const
+{
+  option = impl.shard_option_;
+}
+
+std::size_t usb_device_service::do_transfer(implementation_type& impl,
+    unsigned char direction, void* data, std::size_t size,
+    boost::system::error_code& ec)
+{
+  asio::detail::mutex::scoped_lock lock(impl.mutex_);
+  if (!impl.dev_handle_)
+  {
+    ec = asio::error::bad_descriptor;
+    return 0;
+  }
+
+  struct libusb_context* ctx = impl.ctx_;
+  struct libusb_device_handle* dev_handle = impl.dev_handle_;
+  unsigned char endpoint = impl.endpoint_address_.value() + direction;
+  usb_capture* capture = impl.capture_;
+  unsigned char type = impl.transfer_type_.value()
+    == usb_device_base::transfer_type::bulk
+    ? LIBUSB_TRANSFER_TYPE_BULK : LIBUSB_TRANSFER_TYPE_INTERRUPT;
+
+  // Registered while locked, so that a concurrent close either waits for the
+  // transfer or aborts it before it is submitted.
+  std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+  std::uint64_t generation = tracker->enter();
+  lock.unlock();
+
+  return blocking_transfer::run(ctx, dev_handle, endpoint, type, data, size,
+      capture, tracker, generation, ec);
+}
+
+template <typename ConstBufferSequence>
+std::size_t usb_device_service::send(implementation_type& impl, 
+    const ConstBufferSequence& buffers, boost::system::error_code& ec)
+{
+  asio::const_buffer buf = asio::detail::buffer_sequence_adapter<
+    asio::const_buffer, ConstBufferSequence>::first(buffers);
+
+  return do_transfer(impl, LIBUSB_ENDPOINT_OUT,
+      const_cast<void*>(buf.data()), buf.size(), ec);
+}
+
+template <typename MutableBufferSequence>
+size_t usb_device_service::receive(implementation_type& impl,
+    const MutableBufferSequence& buffers, boost::system::error_code& ec)
+{
+  asio::mutable_buffer buf = asio::detail::buffer_sequence_adapter<
+    asio::mutable_buffer, MutableBufferSequence>::first(buffers);
 
-  return bytes_transferred;
+  return do_transfer(impl, LIBUSB_ENDPOINT_IN,
+      buf.data(), buf.size(), ec);
 }
 
 } // namespace detail
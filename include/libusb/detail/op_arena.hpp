@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <boost/asio.hpp>
+#include <libusb.h>
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// Per-device recycling allocator for operation objects and libusb transfers.
+// Freed blocks are kept on a free list per size class and handed out again,
+// so once a device has seen its peak number of outstanding operations no
+// further heap allocations are made. Blocks larger than the biggest size class
+// are passed through to the global heap.
+//
+// An arena owned through op_arena::pointer outlives its owner until the last
+// of its blocks and transfers is returned, so operations still queued for
+// completion when their device is destroyed can free their memory.
+class op_arena
+{
+public:
+  enum
+  {
+    min_block_size = 128,
+    size_classes = 4
+  };
+
+  // Releases the owner's reference to an arena.
+  struct releaser
+  {
+    void operator()(op_arena* arena) const
+    {
+      arena->release();
+    }
+  };
+
+  typedef std::unique_ptr<op_arena, releaser> pointer;
+
+  op_arena()
+    : transfers_(0)
+    , refs_(1)
+  {
+    for (int i = 0; i < size_classes; ++i)
+      free_[i] = 0;
+  }
+
+  ~op_arena()
+  {
+    for (int i = 0; i < size_classes; ++i)
+    {
+      while (block* b = free_[i])
+      {
+        free_[i] = b->next_;
+        ::operator delete(b);
+      }
+    }
+
+    while (struct libusb_transfer* t = transfers_)
+    {
+      transfers_ = static_cast<struct libusb_transfer*>(t->user_data);
+      libusb_free_transfer(t);
+    }
+  }
+
+  void* allocate(std::size_t size)
+  {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+    int c = size_class(size);
+    if (c < size_classes)
+    {
+      asio::detail::mutex::scoped_lock lock(mutex_);
+      if (block* b = free_[c])
+      {
+        free_[c] = b->next_;
+        return b;
+      }
+      lock.unlock();
+      return ::operator new(block_size(c));
+    }
+    return ::operator new(size);
+  }
+
+  void deallocate(void* p, std::size_t size)
+  {
+    int c = size_class(size);
+    if (c < size_classes)
+    {
+      block* b = static_cast<block*>(p);
+      asio::detail::mutex::scoped_lock lock(mutex_);
+      b->next_ = free_[c];
+      free_[c] = b;
+      lock.unlock();
+      release();
+      return;
+    }
+    ::operator delete(p);
+    release();
+  }
+
+  struct libusb_transfer* alloc_transfer()
+  {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+    asio::detail::mutex::scoped_lock lock(mutex_);
+    if (struct libusb_transfer* t = transfers_)
+    {
+      transfers_ = static_cast<struct libusb_transfer*>(t->user_data);
+      return t;
+    }
+    lock.unlock();
+    struct libusb_transfer* t = libusb_alloc_transfer(0);
+    if (!t)
+      release();
+    return t;
+  }
+
+  void free_transfer(struct libusb_transfer* t)
+  {
+    if (!t)
+      return;
+
+    asio::detail::mutex::scoped_lock lock(mutex_);
+    t->user_data = transfers_;
+    transfers_ = t;
+    lock.unlock();
+    release();
+  }
+
+private:
+  // Drop one reference: the owner's, or that of an outstanding block.
+  void release()
+  {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete this;
+  }
+
+  // Disallow copying and assignment.
+  op_arena(const op_arena&) BOOST_ASIO_DELETED;
+  op_arena& operator=(const op_arena&) BOOST_ASIO_DELETED;
+
+  struct block
+  {
+    block* next_;
+  };
+
+  static std::size_t block_size(int c)
+  {
+    return static_cast<std::size_t>(min_block_size) << c;
+  }
+
+  static int size_class(std::size_t size)
+  {
+    int c = 0;
+    while (c < size_classes && block_size(c) < size)
+      ++c;
+    return c;
+  }
+
+  asio::detail::mutex mutex_;
+  block* free_[size_classes];
+  struct libusb_transfer* transfers_;
+  std::atomic<std::size_t> refs_;
+};
+
+// Handlers without an associated allocator of their own get their operations
+// from the device's arena. A user-supplied associated allocator takes
+// precedence.
+template <typename Handler>
+struct uses_op_arena
+  : std::is_same<typename asio::associated_allocator<Handler>::type,
+      std::allocator<void> >
+{
+};
+
+// Replacement for the ptr helper generated by BOOST_ASIO_DEFINE_HANDLER_PTR
+// that allocates from an op_arena where possible.
+template <typename Op, typename Handler>
+struct arena_handler_ptr
+{
+  Handler* h;
+  Op* v;
+  Op* p;
+  op_arena* a;
+
+  ~arena_handler_ptr()
+  {
+    reset();
+  }
+
+  static Op* allocate(Handler& handler, op_arena* arena)
+  {
+    if (arena && uses_op_arena<Handler>::value)
+      return static_cast<Op*>(arena->allocate(sizeof(Op)));
+
+    typedef typename asio::associated_allocator<
+      Handler>::type associated_allocator_type;
+    typedef typename asio::detail::get_hook_allocator<
+      Handler, associated_allocator_type>::type hook_allocator_type;
+    BOOST_ASIO_REBIND_ALLOC(hook_allocator_type, Op) alloc(
+        asio::detail::get_hook_allocator<
+          Handler, associated_allocator_type>::get(
+            handler, asio::get_associated_allocator(handler)));
+    return alloc.allocate(1);
+  }
+
+  void reset()
+  {
+    if (p)
+    {
+      p->~Op();
+      p = 0;
+    }
+    if (v)
+    {
+      if (a && uses_op_arena<Handler>::value)
+      {
+        a->deallocate(v, sizeof(Op));
+      }
+      else
+      {
+        typedef typename asio::associated_allocator<
+          Handler>::type associated_allocator_type;
+        typedef typename asio::detail::get_hook_allocator<
+          Handler, associated_allocator_type>::type hook_allocator_type;
+        BOOST_ASIO_REBIND_ALLOC(hook_allocator_type, Op) alloc(
+            asio::detail::get_hook_allocator<
+              Handler, associated_allocator_type>::get(
+                *h, asio::get_associated_allocator(*h)));
+        alloc.deallocate(static_cast<Op*>(v), 1);
+      }
+      v = 0;
+    }
+  }
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+namespace libusb {
+namespace detail {
+
+// Per-packet header of the Linux usbmon binary (mmapped) interface. This is
+// the pseudo-header Wireshark expects for LINKTYPE_USB_LINUX_MMAPPED. Fields
+// are in host byte order; the pcapng section header records which one.
+struct usbmon_packet
+{
+  std::uint64_t id;
+  unsigned char type;
+  unsigned char xfer_type;
+  unsigned char epnum;
+  unsigned char devnum;
+  std::uint16_t busnum;
+  char flag_setup;
+  char flag_data;
+  std::int64_t ts_sec;
+  std::int32_t ts_usec;
+  std::int32_t status;
+  std::uint32_t length;
+  std::uint32_t len_cap;
+  unsigned char setup[8];
+  std::int32_t interval;
+  std::int32_t start_frame;
+  std::uint32_t xfer_flags;
+  std::uint32_t ndesc;
+};
+
+static_assert(sizeof(usbmon_packet) == 64, "usbmon header must be 64 bytes");
+
+// Minimal pcapng serializer: one section, one interface, enhanced packet
+// blocks with microsecond timestamps.
+class pcapng_writer
+{
+public:
+  enum
+  {
+    linktype_usb_linux_mmapped = 220
+  };
+
+  explicit pcapng_writer(std::ostream& os)
+    : os_(os)
+  {
+  }
+
+  void write_section_header()
+  {
+    put32(0x0A0D0D0A);
+    put32(28);
+    put32(0x1A2B3C4D);
+    put16(1);
+    put16(0);
+    put64(0xFFFFFFFFFFFFFFFFull);
+    put32(28);
+  }
+
+  void write_interface_description(std::uint16_t linktype,
+      std::uint32_t snaplen)
+  {
+    put32(0x00000001);
+    put32(20);
+    put16(linktype);
+    put16(0);
+    put32(snaplen);
+    put32(20);
+  }
+
+  void write_enhanced_packet(std::uint64_t timestamp_us,
+      const void* header, std::uint32_t header_size,
+      const void* data, std::uint32_t data_size,
+      std::uint32_t original_length)
+  {
+    std::uint32_t captured = header_size + data_size;
+    std::uint32_t padded = (captured + 3) & ~3u;
+    std::uint32_t total = 32 + padded;
+
+    put32(0x00000006);
+    put32(total);
+    put32(0);
+    put32(static_cast<std::uint32_t>(timestamp_us >> 32));
+    put32(static_cast<std::uint32_t>(timestamp_us));
+    put32(captured);
+    put32(original_length);
+    os_.write(static_cast<const char*>(header), header_size);
+    os_.write(static_cast<const char*>(data), data_size);
+    static const char zeros[4] = {};
+    os_.write(zeros, padded - captured);
+    put32(total);
+  }
+
+private:
+  void put16(std::uint16_t v)
+  {
+    os_.write(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+
+  void put32(std::uint32_t v)
+  {
+    os_.write(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+
+  void put64(std::uint64_t v)
+  {
+    os_.write(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+
+  std::ostream& os_;
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <boost/asio.hpp>
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// Operation waiting for room in a send window.
+class send_wait_op : public asio::detail::operation
+{
+public:
+  void set_error(const boost::system::error_code& ec)
+  {
+    ec_ = ec;
+  }
+
+protected:
+  explicit send_wait_op(func_type complete_func)
+    : asio::detail::operation(complete_func)
+  {
+  }
+
+  boost::system::error_code ec_;
+};
+
+// Bounds the sends a device has outstanding, by number and by bytes. A limit
+// of zero is no limit. The window has room while both counts are below their
+// limits, so a single send larger than the byte limit still goes through.
+// Operations waiting for room are handed back in a queue for the caller to
+// post to the scheduler.
+class send_window
+{
+public:
+  typedef asio::detail::op_queue<asio::detail::operation> ready_queue;
+
+  send_window()
+    : max_ops_(0)
+    , max_bytes_(0)
+    , ops_(0)
+    , bytes_(0)
+  {
+  }
+
+  void limit(std::size_t max_ops, std::size_t max_bytes, ready_queue& ready)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_ops_ = max_ops;
+    max_bytes_ = max_bytes;
+    wake(ready);
+  }
+
+  std::size_t max_ops() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_ops_;
+  }
+
+  std::size_t max_bytes() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_bytes_;
+  }
+
+  // Account for a send of the given size. Returns false, accounting nothing,
+  // if the window is full.
+  bool acquire(std::size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writable())
+      return false;
+    ++ops_;
+    bytes_ += bytes;
+    return true;
+  }
+
+  // Return a finished send to the window.
+  void release(std::size_t bytes, ready_queue& ready)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --ops_;
+    bytes_ -= bytes;
+    wake(ready);
+  }
+
+  // Queue an operation until the window has room, or make it ready at once.
+  void wait(send_wait_op* op, ready_queue& ready)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (writable())
+      ready.push(op);
+    else
+      waiters_.push(op);
+  }
+
+  // Make all waiting operations ready with operation_aborted.
+  void cancel(ready_queue& ready)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (send_wait_op* op = waiters_.front())
+    {
+      waiters_.pop();
+      op->set_error(asio::error::operation_aborted);
+      ready.push(op);
+    }
+  }
+
+private:
+  bool writable() const
+  {
+    return (max_ops_ == 0 || ops_ < max_ops_)
+      && (max_bytes_ == 0 || bytes_ < max_bytes_);
+  }
+
+  // Hand the waiters to the caller if there is room. They all see the same
+  // room; a waiter losing the race gets would_block from its send.
+  void wake(ready_queue& ready)
+  {
+    if (writable())
+      ready.push(waiters_);
+  }
+
+  mutable std::mutex mutex_;
+  std::size_t max_ops_;
+  std::size_t max_bytes_;
+  std::size_t ops_;
+  std::size_t bytes_;
+  asio::detail::op_queue<send_wait_op> waiters_;
+};
+
+} // namespace detail
+} // namespace libusb
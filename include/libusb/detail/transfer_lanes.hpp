@@ -0,0 +1,126 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+namespace libusb {
+namespace detail {
+
+namespace asio = boost::asio;
+
+// Priority queues of the transfers waiting for the resolver thread. Every
+// queued transfer is also posted to the resolver thread as usual, but
+// whichever transfer the thread picks up runs the first entry of the most
+// urgent non-empty lane in its place. Since each transfer posts exactly one
+// slot, every queued transfer runs exactly once, urgent ones ahead of normal
+// ones queued earlier. An operation destroyed with its entry still queued,
+// e.g. by a shutdown of the resolver thread, removes the entry.
+class transfer_lanes
+{
+public:
+  enum
+  {
+    normal = 0,
+    urgent = 1,
+    lane_count = 2
+  };
+
+  class entry
+  {
+  public:
+    typedef void (*run_func_type)(void* op);
+
+    entry(run_func_type run, void* op)
+      : next_(0)
+      , lane_(0)
+      , queued_(false)
+      , run_(run)
+      , op_(op)
+    {
+    }
+
+    // Perform the transfer on the resolver thread.
+    void run()
+    {
+      run_(op_);
+    }
+
+  private:
+    friend class transfer_lanes;
+
+    entry* next_;
+    int lane_;
+    bool queued_;
+    run_func_type run_;
+    void* op_;
+  };
+
+  transfer_lanes()
+  {
+    for (int i = 0; i < lane_count; ++i)
+      front_[i] = back_[i] = 0;
+  }
+
+  void push(entry* e, int lane)
+  {
+    asio::detail::mutex::scoped_lock lock(mutex_);
+    e->next_ = 0;
+    e->lane_ = lane;
+    e->queued_ = true;
+    if (back_[lane])
+      back_[lane]->next_ = e;
+    else
+      front_[lane] = e;
+    back_[lane] = e;
+  }
+
+  // Take the first entry of the most urgent lane. Never empty when called
+  // from a posted slot.
+  entry* pop()
+  {
+    asio::detail::mutex::scoped_lock lock(mutex_);
+    for (int lane = lane_count - 1; lane >= 0; --lane)
+    {
+      if (entry* e = front_[lane])
+      {
+        front_[lane] = e->next_;
+        if (!front_[lane])
+          back_[lane] = 0;
+        e->next_ = 0;
+        e->queued_ = false;
+        return e;
+      }
+    }
+    return 0;
+  }
+
+  // Unlink an entry if it is still queued.
+  void remove(entry* e)
+  {
+    asio::detail::mutex::scoped_lock lock(mutex_);
+    if (!e->queued_)
+      return;
+    entry* prev = 0;
+    entry* cur = front_[e->lane_];
+    while (cur != e)
+    {
+      prev = cur;
+      cur = cur->next_;
+    }
+    if (prev)
+      prev->next_ = e->next_;
+    else
+      front_[e->lane_] = e->next_;
+    if (back_[e->lane_] == e)
+      back_[e->lane_] = prev;
+    e->next_ = 0;
+    e->queued_ = false;
+  }
+
+private:
+  asio::detail::mutex mutex_;
+  entry* front_[lane_count];
+  entry* back_[lane_count];
+};
+
+} // namespace detail
+} // namespace libusb
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <libusb.h>
+#include "libusb/detail/endpoint_stats.hpp"
+#include "libusb/detail/send_window.hpp"
+
+namespace libusb {
+namespace detail {
+
+// The work of one usb device that may still touch the device or its memory:
+// transfer operations from their initiation until their libusb callback has
+// run, and jobs running on the open pool. Cancelling aborts operations that
+// have not been submitted yet and cancels the submitted transfers, after which
+// the owner waits for the callbacks before releasing the device.
+//
+// When a wait times out the owner abandons the tracker and closes the device
+// handle anyway, which detaches the transfers still in flight from libusb.
+// Their callbacks never run, so the owner then completes them itself. An
+// abandoned tracker keeps itself alive until its last operation leaves, and
+// tells callbacks that still run to hand their operations to the scheduler
+// directly, as the event thread that would deliver them may be stopped.
+//
+// The tracker also holds the device's send and receive windows and endpoint
+// statistics, so that they live as long as the operations updating them.
+//
+// A tracker follows its device implementation when the implementation is
+// moved. Jobs find the implementation they act on through the tracker rather
+// than capturing it, and an implementation is only handed over while no job
+// runs, so a job always acts on the current owner, which outlives it.
+class transfer_tracker
+  : public std::enable_shared_from_this<transfer_tracker>
+{
+public:
+  typedef std::chrono::steady_clock clock_type;
+
+  explicit transfer_tracker(void* owner = 0)
+    : owner_(owner)
+    , generation_(0)
+    , ops_(0)
+    , jobs_(0)
+    , abandoned_(false)
+  {
+  }
+
+  // Register an operation. Returns the generation to pass to submit().
+  std::uint64_t enter()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++ops_;
+    return generation_;
+  }
+
+  // Record a transfer about to be submitted. Returns false if the device was
+  // cancelled since the operation was registered; the operation must then
+  // complete with operation_aborted and leave.
+  bool submit(struct libusb_transfer* transfer, std::uint64_t generation)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != generation_ || abandoned_)
+      return false;
+    transfers_.push_back(transfer);
+    return true;
+  }
+
+  // Unregister an operation whose callback has run, or whose transfer was
+  // never submitted (transfer is then null). Returns false if the tracker was
+  // abandoned. The tracker may be destroyed once the call returns.
+  bool leave(struct libusb_transfer* transfer)
+  {
+    std::shared_ptr<transfer_tracker> self;
+    bool alive;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (transfer)
+      {
+        auto it = std::find(transfers_.begin(), transfers_.end(), transfer);
+        if (it != transfers_.end())
+        {
+          *it = transfers_.back();
+          transfers_.pop_back();
+        }
+      }
+      alive = !abandoned_;
+      if (--ops_ == 0)
+      {
+        cond_.notify_all();
+        self.swap(self_);
+      }
+    }
+    return alive;
+  }
+
+  // Register a job started at the given generation and get the owner it
+  // acts on until end_job(). Returns null if the device was cancelled since.
+  void* begin_job(std::uint64_t generation)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != generation_ || abandoned_)
+      return 0;
+    ++jobs_;
+    return owner_;
+  }
+
+  void end_job()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--jobs_ == 0)
+      cond_.notify_all();
+  }
+
+  std::uint64_t generation() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+  }
+
+  // Number of registered operations.
+  std::size_t outstanding() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ops_;
+  }
+
+  // Number of running jobs.
+  std::size_t jobs() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_;
+  }
+
+  bool abandoned() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return abandoned_;
+  }
+
+  // Get the submitted transfers whose callbacks have not run yet. Once the
+  // device handle of an abandoned tracker has been closed these callbacks
+  // never run.
+  void submitted(std::vector<struct libusb_transfer*>& transfers) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    transfers = transfers_;
+  }
+
+  send_window& sends()
+  {
+    return sends_;
+  }
+
+  send_window& receives()
+  {
+    return receives_;
+  }
+
+  endpoint_stats& statistics()
+  {
+    return stats_;
+  }
+
+  // Abort the operations not yet submitted and cancel the submitted
+  // transfers. Their callbacks follow asynchronously.
+  void cancel()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+    for (struct libusb_transfer* transfer : transfers_)
+      libusb_cancel_transfer(transfer);
+  }
+
+  // Wait until all operations have left. Returns false if the deadline passed
+  // first, or at once if the tracker has been abandoned.
+  bool wait(clock_type::time_point deadline)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_until(lock, deadline,
+        [this]{ return ops_ == 0 || abandoned_; });
+    return ops_ == 0;
+  }
+
+  // Wait until the running jobs have finished. Jobs are not abandoned, since
+  // they act on the device implementation; they are bounded by libusb's own
+  // control transfer timeouts.
+  void wait_jobs()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]{ return jobs_ == 0; });
+  }
+
+  // Hand the tracker to the implementation it is moved to. Returns false,
+  // changing nothing, while jobs run; the caller waits for them and retries.
+  bool move_owner(void* owner)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_ != 0)
+      return false;
+    owner_ = owner;
+    return true;
+  }
+
+  // Give up on the remaining operations.
+  void abandon()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abandoned_ = true;
+    ++generation_;
+    if (ops_ != 0)
+      self_ = shared_from_this();
+    cond_.notify_all();
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<struct libusb_transfer*> transfers_;
+  void* owner_;
+  std::uint64_t generation_;
+  std::size_t ops_;
+  std::size_t jobs_;
+  bool abandoned_;
+  send_window sends_;
+  send_window receives_;
+  endpoint_stats stats_;
+  std::shared_ptr<transfer_tracker> self_;
+};
+
+} // namespace detail
+} // namespace libusb
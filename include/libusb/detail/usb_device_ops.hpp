@@ -1,6 +1,13 @@
 #pragma once
+#include <cstdio>
 #include <libusb.h>
 #include <boost/asio.hpp>
+#include "libusb/error.hpp"
+
+#if defined(__linux__)
+# include <fcntl.h>
+# include <unistd.h>
+#endif
 
 namespace asio = boost::asio;
 
@@ -8,23 +15,44 @@ namespace libusb {
 namespace detail {
 namespace usb_device_ops {
 
-bool process_transfer(struct libusb_context* ctx, 
-    struct libusb_transfer* transfer, int* transfer_complete, 
-    boost::system::error_code& ec)
+// Handle events until a submitted transfer has completed. The transfer's
+// callback records its result, so an interruption of the event loop only
+// causes another round. Returns false if the event loop failed before the
+// transfer completed.
+inline bool wait_transfer(struct libusb_context* ctx, int* transfer_complete)
 {
-  int err = libusb_submit_transfer(transfer);
-  if (err != LIBUSB_SUCCESS)
+  while (!*transfer_complete)
   {
-    ec = libusb_error(err);
-    return false;
+    int rc = libusb_handle_events_completed(ctx, transfer_complete);
+    if (rc < 0 && rc != LIBUSB_ERROR_INTERRUPTED)
+      return false;
   }
-  
-  err = libusb_handle_events_completed(ctx, transfer_complete);
-  ec = libusb_error(err);
-  return err == LIBUSB_SUCCESS and transfer_complete;
+  return true;
 }
 
-bool find_device(struct libusb_context* ctx, 
+// Map the status of a finished transfer to an error code.
+inline boost::system::error_code transfer_error(int status)
+{
+  switch (status)
+  {
+  case LIBUSB_TRANSFER_COMPLETED:
+    return boost::system::error_code();
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    return libusb_error(LIBUSB_ERROR_TIMEOUT);
+  case LIBUSB_TRANSFER_CANCELLED:
+    return asio::error::operation_aborted;
+  case LIBUSB_TRANSFER_STALL:
+    return libusb_error(LIBUSB_ERROR_PIPE);
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    return libusb_error(LIBUSB_ERROR_NO_DEVICE);
+  case LIBUSB_TRANSFER_OVERFLOW:
+    return libusb_error(LIBUSB_ERROR_OVERFLOW);
+  default:
+    return libusb_error(LIBUSB_ERROR_IO);
+  }
+}
+
+inline bool find_device(struct libusb_context* ctx, 
     struct libusb_device** peer, std::uint16_t vendor_id, 
     std::uint16_t product_id, boost::system::error_code& ec)
 {
@@ -62,6 +90,92 @@ bool find_device(struct libusb_context* ctx,
   return success;
 }
 
+// Find a device as enumerated in another context, by its bus number and
+// address.
+inline bool find_same_device(struct libusb_context* ctx,
+    struct libusb_device* device, struct libusb_device** peer,
+    boost::system::error_code& ec)
+{
+  libusb_device** devs;
+
+  int cnt = libusb_get_device_list(ctx, &devs);
+  if (cnt < 0)
+  {
+    ec = libusb_error(cnt);
+    return false;
+  }
+
+  std::uint8_t bus = libusb_get_bus_number(device);
+  std::uint8_t address = libusb_get_device_address(device);
+  bool success = false;
+  for (int index = 0; index < cnt && !success; index++)
+  {
+    if (libusb_get_bus_number(devs[index]) == bus
+        && libusb_get_device_address(devs[index]) == address)
+    {
+      *peer = libusb_ref_device(devs[index]);
+      success = true;
+    }
+  }
+  libusb_free_device_list(devs, 1);
+  return success;
+}
+
+// Open a device as enumerated in another context in the given one. On Linux
+// its device node is opened and wrapped, which enumerates nothing and works
+// with device discovery disabled; *node is set to the node's descriptor, to
+// be closed with close_node() after the handle. Elsewhere, or if the node
+// cannot be wrapped, the device is looked up in the context's device list.
+inline bool open_same_device(struct libusb_context* ctx,
+    struct libusb_device* device, struct libusb_device_handle** dev_handle,
+    int* node, boost::system::error_code& ec)
+{
+  *node = -1;
+
+#if defined(__linux__) && defined(LIBUSB_API_VERSION) \
+  && (LIBUSB_API_VERSION >= 0x01000108)
+  char path[32];
+  std::snprintf(path, sizeof(path), "/dev/bus/usb/%03u/%03u",
+      static_cast<unsigned>(libusb_get_bus_number(device)),
+      static_cast<unsigned>(libusb_get_device_address(device)));
+  int fd = ::open(path, O_RDWR | O_CLOEXEC);
+  if (fd >= 0)
+  {
+    if (libusb_wrap_sys_device(ctx, static_cast<intptr_t>(fd),
+          dev_handle) == LIBUSB_SUCCESS)
+    {
+      *node = fd;
+      return true;
+    }
+    ::close(fd);
+  }
+#endif
+
+  libusb_device* found = NULL;
+  if (!find_same_device(ctx, device, &found, ec))
+    return false;
+
+  int err = libusb_open(found, dev_handle);
+  libusb_unref_device(found);
+  if (err != LIBUSB_SUCCESS)
+  {
+    ec = libusb_error(err);
+    return false;
+  }
+  return true;
+}
+
+// Close a device node opened by open_same_device().
+inline void close_node(int node)
+{
+#if defined(__linux__)
+  if (node >= 0)
+    ::close(node);
+#else
+  (void)node;
+#endif
+}
+
 } // namespace usb_device_ops
 } // namespace detail
 } // namespace libusb
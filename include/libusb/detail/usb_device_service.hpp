@@ -1,17 +1,63 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include <libusb.h>
 #include "libusb/usb_device_base.hpp"
+#include "libusb/usb_capture.hpp"
+#include "libusb/usb_service_options.hpp"
+#include "libusb/usb_transfer_timing.hpp"
 #include "libusb/error.hpp"
+#include "libusb/detail/adaptive_spin.hpp"
 #include "libusb/detail/async_accept_op.hpp"
+#include "libusb/detail/async_open_op.hpp"
+#include "libusb/detail/async_string_op.hpp"
 #include "libusb/detail/async_transfer_op.hpp"
+#include "libusb/detail/async_wait_writable_op.hpp"
+#include "libusb/detail/blocking_transfer.hpp"
+#include "libusb/detail/completion_queue.hpp"
+#include "libusb/detail/context_shard.hpp"
+#include "libusb/detail/descriptor_cache.hpp"
+#include "libusb/detail/op_arena.hpp"
+#include "libusb/detail/transfer_lanes.hpp"
+#include "libusb/detail/transfer_tracker.hpp"
 
 namespace libusb {
 namespace detail {
 
 namespace asio = boost::asio;
 
+// Service implementing usb_device and usb_device_acceptor.
+//
+// Thread safety: every operation on an implementation (open, assign, close,
+// is_open, set_option, get_option, cancel, send, receive and the initiation
+// of asynchronous operations) locks the implementation's mutex, so a single
+// usb_device may be used from several threads running the io_context.
+// Blocking transfers only hold the lock while reading the device state, not
+// for the duration of the transfer; like asynchronous ones, they are
+// registered with the device's tracker, so closing the device cancels them.
+// Transfers are performed on the private worker thread, or submitted directly
+// and completed by the event thread in usb_service_options::event_thread
+// mode. Either way their completions are posted back to the io_context, so
+// completions of different devices run in parallel on any thread calling
+// run(). Handlers of one device are not serialised by the service; use a
+// strand as the device's executor when they must not run concurrently.
+//
+// Devices are opened in libusb's default context, or distributed over
+// usb_service_options::context_shards contexts of their own, each with its
+// own event thread and completion queue.
+//
+// Closing or destroying a device, and shutting the service down, cancel the
+// device's outstanding transfers and wait for their callbacks for at most
+// usb_service_options::shutdown_timeout. Transfers still in flight after that
+// are abandoned. Closing the device handle detaches them from libusb, after
+// which they complete with operation_aborted; a shutdown leaves them to the
+// destruction of their device, which closes the handle.
 class usb_device_service
  : public asio::detail::execution_context_service_base<usb_device_service>
  , public asio::detail::resolver_service_base
@@ -24,10 +70,19 @@ public:
   
     implementation_type()
       : device_(NULL)
+      , owns_device_(false)
       , dev_handle_(NULL)
+      , node_(-1)
       , ctx_(NULL)
       , interface_number_(0)
       , endpoint_address_(0)
+      , configuration_(-1)
+      , detach_kernel_driver_(false)
+      , transfer_type_(usb_device_base::transfer_type::interrupt)
+      , stream_count_(0)
+      , streams_(0)
+      , capture_(NULL)
+      , shard_(NULL)
     {
     }
   
@@ -35,10 +90,24 @@ public:
     friend class usb_device_service;
   
     native_handle_type device_;
+    bool owns_device_;
     struct libusb_device_handle* dev_handle_;
+    int node_;
     struct libusb_context* ctx_;
     usb_device_base::interface_number interface_number_;
     usb_device_base::endpoint_address endpoint_address_;
+    usb_device_base::configuration configuration_;
+    usb_device_base::detach_kernel_driver detach_kernel_driver_;
+    usb_device_base::transfer_type transfer_type_;
+    usb_device_base::shard shard_option_;
+    usb_device_base::stream_count stream_count_;
+    std::uint32_t streams_;
+    usb_capture* capture_;
+    descriptor_cache descriptors_;
+    op_arena::pointer arena_;
+    std::shared_ptr<transfer_tracker> tracker_;
+    context_shard* shard_;
+    mutable asio::detail::mutex mutex_;
   };
 
   typedef implementation_type::native_handle_type native_handle_type;
@@ -46,6 +115,17 @@ public:
   explicit usb_device_service(asio::execution_context& context)
     : asio::detail::execution_context_service_base<usb_device_service>(context)
     , resolver_service_base(context)
+    , mode_(usb_service_options::resolver_thread)
+    , event_threads_started_(false)
+    , open_threads_(0)
+    , cpu_affinity_(-1)
+    , spin_threshold_(1000)
+    , shutdown_timeout_(1000)
+    , device_discovery_(true)
+    , discovery_disabled_(false)
+    , shard_count_(0)
+    , shard_policy_(usb_service_options::round_robin)
+    , next_shard_(0)
   {
   }
 
@@ -54,58 +134,155 @@ public:
     if (!impl.ctx_)
     {
       boost::system::error_code ec;
+      disable_discovery(ec);
+      asio::detail::throw_error(ec, "construct");
+
       // use default context for now (instead of &impl.ctx_)
       auto err = libusb_init(NULL);
       ec = libusb_error(err);
       asio::detail::throw_error(ec, "construct");
     }
+
+    impl.arena_.reset(new op_arena);
+    impl.tracker_ = new_tracker(impl);
   }
 
   void move_construct(implementation_type& impl, 
       implementation_type& other_impl)
   {
+    asio::detail::mutex::scoped_lock lock(other_impl.mutex_);
+
+    // Jobs running on the pool act on the implementation they started on, so
+    // the tracker is only handed over between them.
+    while (!other_impl.tracker_->move_owner(&impl))
+    {
+      std::shared_ptr<transfer_tracker> tracker = other_impl.tracker_;
+      lock.unlock();
+      tracker->wait_jobs();
+      lock.lock();
+    }
+
     impl.device_ = other_impl.device_;
     other_impl.device_ = NULL;
 
+    impl.owns_device_ = other_impl.owns_device_;
+    other_impl.owns_device_ = false;
+
     impl.dev_handle_ = other_impl.dev_handle_;
     other_impl.dev_handle_ = NULL;
 
+    impl.node_ = other_impl.node_;
+    other_impl.node_ = -1;
+
     impl.ctx_ = other_impl.ctx_;
     other_impl.ctx_ = NULL;
 
     impl.interface_number_ = other_impl.interface_number_;
 
     impl.endpoint_address_ = other_impl.endpoint_address_;
-  }
 
-  void shutdown()
-  {
-  }
+    impl.configuration_ = other_impl.configuration_;
 
-  void destroy(implementation_type& impl)
-  {
-    boost::system::error_code ignored_ec;
-    close(impl, ignored_ec);
-    libusb_exit(impl.ctx_);
+    impl.detach_kernel_driver_ = other_impl.detach_kernel_driver_;
+
+    impl.transfer_type_ = other_impl.transfer_type_;
+
+    impl.shard_option_ = other_impl.shard_option_;
+
+    impl.shard_ = other_impl.shard_;
+    other_impl.shard_ = NULL;
+
+    impl.stream_count_ = other_impl.stream_count_;
+
+    impl.streams_ = other_impl.streams_;
+    other_impl.streams_ = 0;
+
+    impl.capture_ = other_impl.capture_;
+
+    impl.descriptors_ = other_impl.descriptors_;
+    other_impl.descriptors_.clear();
+
+    impl.arena_ = std::move(other_impl.arena_);
+
+    // Outstanding operations stay with the moved tracker.
+    impl.tracker_ = std::move(other_impl.tracker_);
+    other_impl.tracker_ = new_tracker(other_impl);
   }
 
+  BOOST_ASIO_DECL void shutdown();
+
+  BOOST_ASIO_DECL void set_options(const usb_service_options& options,
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void destroy(implementation_type& impl);
+
   BOOST_ASIO_DECL void open(implementation_type& impl,
       boost::system::error_code& ec);
 
+  template <typename Handler, typename IoExecutor>
+  void async_open(implementation_type& impl, Handler& handler,
+      const IoExecutor& io_ex)
+  {
+    typedef async_open_op<Handler, IoExecutor> op;
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
+    typename op::ptr p = { asio::detail::addressof(handler),
+      op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) op(impl.arena_.get(), handler, io_ex);
+
+    BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
+          0, "async_open"));
+    std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+    std::uint64_t generation = tracker->generation();
+    lock.unlock();
+
+    op* o = p.p;
+    p.v = p.p = 0;
+
+    // Open on the pool and hand the operation back to the scheduler. The
+    // open is aborted if the device is cancelled before it starts, and
+    // applies to the implementation the device has been moved to, if any.
+    scheduler_.work_started();
+    asio::post(open_pool(), [this, tracker, generation, o]
+        {
+          boost::system::error_code ec = asio::error::operation_aborted;
+          if (void* owner = tracker->begin_job(generation))
+          {
+            ec = boost::system::error_code();
+            open(*static_cast<implementation_type*>(owner), ec);
+            tracker->end_job();
+          }
+          o->set_error(ec);
+          scheduler_.post_deferred_completion(o);
+        });
+  }
+
   BOOST_ASIO_DECL void assign(implementation_type& impl, 
       native_handle_type native_usb_device, boost::system::error_code& ec);
 
+  // Wrap a file descriptor of an opened usb device node and claim the
+  // interface, without enumerating the bus.
+  BOOST_ASIO_DECL void assign_fd(implementation_type& impl, int fd,
+      boost::system::error_code& ec);
+
   BOOST_ASIO_DECL bool is_open(const implementation_type& impl) const;
 
   BOOST_ASIO_DECL void close(implementation_type& impl, 
       boost::system::error_code& ec);
 
+  // Cancel the outstanding asynchronous operations of the device.
+  BOOST_ASIO_DECL void cancel(implementation_type& impl,
+      boost::system::error_code& ec);
+
   BOOST_ASIO_DECL native_handle_type native_handle(implementation_type& impl);
 
+  BOOST_ASIO_DECL struct libusb_context* native_context(
+      implementation_type& impl);
+
   template <typename SettableUsbDeviceOption>
   void set_option(implementation_type& impl, 
       const SettableUsbDeviceOption& option, boost::system::error_code& ec)
   {
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
     do_set_option(impl, option, ec);
   }
 
@@ -113,22 +290,99 @@ public:
   void get_option(const implementation_type& impl, 
       GettableUsbDeviceOption& option, boost::system::error_code& ec) const
   {
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
     do_get_option(impl, option, ec);
   }
 
+  BOOST_ASIO_DECL void device_descriptor(const implementation_type& impl,
+      struct libusb_device_descriptor& descriptor,
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL descriptor_cache::config_descriptor_ptr config_descriptor(
+      const implementation_type& impl, std::uint8_t index,
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL descriptor_cache::bos_descriptor_ptr bos_descriptor(
+      implementation_type& impl, boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL std::string string_descriptor(implementation_type& impl,
+      std::uint8_t index, boost::system::error_code& ec);
+
+  template <typename Handler, typename IoExecutor>
+  void async_string_descriptor(implementation_type& impl, std::uint8_t index,
+      Handler& handler, const IoExecutor& io_ex)
+  {
+    typedef async_string_op<Handler, IoExecutor> op;
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
+    typename op::ptr p = { asio::detail::addressof(handler),
+      op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) op(impl.arena_.get(), handler, io_ex);
+
+    BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
+          0, "async_string_descriptor"));
+
+    // Answer from the cache, or fail without a control transfer, if possible.
+    boost::system::error_code ec;
+    std::string value;
+    bool done = true;
+    if (index == 0)
+      ec = asio::error::invalid_argument;
+    else if (!impl.descriptors_.find_string(index, value))
+    {
+      if (impl.dev_handle_)
+        done = false;
+      else
+        ec = asio::error::bad_descriptor;
+    }
+    std::shared_ptr<transfer_tracker> tracker = impl.tracker_;
+    std::uint64_t generation = tracker->generation();
+    lock.unlock();
+
+    op* o = p.p;
+    p.v = p.p = 0;
+    scheduler_.work_started();
+
+    if (done)
+    {
+      o->set_result(ec, value);
+      scheduler_.post_deferred_completion(o);
+      return;
+    }
+
+    // Read the string on the pool and hand the operation back to the
+    // scheduler. The implementation may have been moved by the time the job
+    // runs; the tracker leads to the current one.
+    asio::post(open_pool(), [this, tracker, generation, index, o]
+        {
+          boost::system::error_code ec = asio::error::operation_aborted;
+          std::string value;
+          if (void* owner = tracker->begin_job(generation))
+          {
+            ec = boost::system::error_code();
+            value = string_descriptor(
+                *static_cast<implementation_type*>(owner), index, ec);
+            tracker->end_job();
+          }
+          o->set_result(ec, value);
+          scheduler_.post_deferred_completion(o);
+        });
+  }
+
   template <typename Device, typename Handler, typename IoExecutor>
   void async_accept(implementation_type& impl, Device& peer, 
       std::uint16_t vendor_id, std::uint16_t product_id, Handler& handler, 
       const IoExecutor& io_ex)
   {
     typedef async_accept_op<Device, Handler, IoExecutor> op;
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
     typename op::ptr p = { asio::detail::addressof(handler),
-      op::ptr::allocate(handler), 0 };
-    p.p = new (p.v) op(impl.ctx_, peer, vendor_id, product_id, scheduler_, 
-        handler, io_ex);
+      op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) op(impl.ctx_, peer, vendor_id, product_id,
+        impl.arena_.get(), scheduler_, handler, io_ex);
 
     BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
           0, "async_accept"));
+    lock.unlock();
 
     start_resolve_op(p.p);
 
@@ -142,22 +396,63 @@ public:
   template <typename WriteHandler, typename ConstBufferSequence, 
            typename IoExecutor>
   void async_send(implementation_type& impl, 
+      const ConstBufferSequence& buffers,
+      WriteHandler& handler, const IoExecutor& io_ex,
+      usb_device_base::transfer_priority priority = usb_device_base::normal)
+  {
+    do_async_send<async_transfer_op<
+      ConstBufferSequence, WriteHandler, IoExecutor> >(
+        impl, buffers, handler, io_ex, false, 0, priority);
+  }
+
+  // Send on a bulk stream. A stream id that was not granted at open fails
+  // with invalid_argument.
+  template <typename WriteHandler, typename ConstBufferSequence, 
+           typename IoExecutor>
+  void async_send_stream(implementation_type& impl, std::uint32_t stream_id,
+      const ConstBufferSequence& buffers,
+      WriteHandler& handler, const IoExecutor& io_ex)
+  {
+    do_async_send<async_transfer_op<
+      ConstBufferSequence, WriteHandler, IoExecutor> >(
+        impl, buffers, handler, io_ex, true, stream_id,
+        usb_device_base::normal);
+  }
+
+  // Send, passing the transfer's timestamps to the handler.
+  template <typename WriteHandler, typename ConstBufferSequence, 
+           typename IoExecutor>
+  void async_send_timed(implementation_type& impl, 
       const ConstBufferSequence& buffers,
       WriteHandler& handler, const IoExecutor& io_ex)
   {
-    typedef async_transfer_op<
-      ConstBufferSequence, WriteHandler, IoExecutor> op;
+    do_async_send<async_transfer_op<ConstBufferSequence, WriteHandler,
+      IoExecutor, runtime_endpoint, true> >(
+        impl, buffers, handler, io_ex, false, 0, usb_device_base::normal);
+  }
+
+  // Wait until the device's send window has room.
+  template <typename Handler, typename IoExecutor>
+  void async_wait_writable(implementation_type& impl, Handler& handler,
+      const IoExecutor& io_ex)
+  {
+    typedef async_wait_writable_op<Handler, IoExecutor> op;
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
     typename op::ptr p = { asio::detail::addressof(handler),
-      op::ptr::allocate(handler), 0 };
-    p.p = new (p.v) op(impl.ctx_, impl.dev_handle_, 
-        impl.endpoint_address_.value(), buffers, scheduler_, handler, io_ex);
+      op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) op(impl.arena_.get(), handler, io_ex);
 
     BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
-          0, "async_send"));
+          0, "async_wait_writable"));
 
-    start_resolve_op(p.p);
+    send_window::ready_queue ready;
+    scheduler_.work_started();
+    impl.tracker_->sends().wait(p.p, ready);
+    lock.unlock();
 
     p.v = p.p = 0;
+    if (!ready.empty())
+      scheduler_.post_deferred_completions(ready);
   }
 
   template <typename MutableBufferSequence>
@@ -168,24 +463,326 @@ public:
            typename IoExecutor>
   void async_receive(implementation_type& impl, 
       const MutableBufferSequence& buffers,
+      ReadHandler& handler, const IoExecutor& io_ex,
+      usb_device_base::transfer_priority priority = usb_device_base::normal)
+  {
+    do_async_receive<async_transfer_op<
+      MutableBufferSequence, ReadHandler, IoExecutor> >(
+        impl, buffers, handler, io_ex, false, 0, priority);
+  } 
+
+  // Receive on a bulk stream. A stream id that was not granted at open fails
+  // with invalid_argument.
+  template <typename ReadHandler, typename MutableBufferSequence, 
+           typename IoExecutor>
+  void async_receive_stream(implementation_type& impl,
+      std::uint32_t stream_id, const MutableBufferSequence& buffers,
       ReadHandler& handler, const IoExecutor& io_ex)
   {
-    typedef async_transfer_op<
-      MutableBufferSequence, ReadHandler, IoExecutor> op;
+    do_async_receive<async_transfer_op<
+      MutableBufferSequence, ReadHandler, IoExecutor> >(
+        impl, buffers, handler, io_ex, true, stream_id,
+        usb_device_base::normal);
+  }
+
+  // Receive, passing the transfer's timestamps to the handler.
+  template <typename ReadHandler, typename MutableBufferSequence, 
+           typename IoExecutor>
+  void async_receive_timed(implementation_type& impl, 
+      const MutableBufferSequence& buffers,
+      ReadHandler& handler, const IoExecutor& io_ex)
+  {
+    do_async_receive<async_transfer_op<MutableBufferSequence, ReadHandler,
+      IoExecutor, runtime_endpoint, true> >(
+        impl, buffers, handler, io_ex, false, 0, usb_device_base::normal);
+  }
+
+  // Get the rolling statistics of the transfers completed on an endpoint.
+  BOOST_ASIO_DECL endpoint_statistics transfer_statistics(
+      const implementation_type& impl, std::uint8_t address) const;
+
+  // Clear the statistics of an endpoint.
+  BOOST_ASIO_DECL void reset_transfer_statistics(implementation_type& impl,
+      std::uint8_t address);
+
+  // Start a transfer on an endpoint fixed at compile time, bypassing the
+  // endpoint_address option. A stream transfer on a stream id that was not
+  // granted at open fails with invalid_argument.
+  template <std::uint8_t Address, enum libusb_transfer_type Type,
+           typename Handler, typename BufferSequence, typename IoExecutor>
+  void async_endpoint_transfer(implementation_type& impl,
+      const BufferSequence& buffers, Handler& handler,
+      const IoExecutor& io_ex, bool stream = false,
+      std::uint32_t stream_id = 0)
+  {
+    typedef async_transfer_op<BufferSequence, Handler, IoExecutor,
+      static_endpoint<Address, Type> > op;
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
     typename op::ptr p = { asio::detail::addressof(handler),
-      op::ptr::allocate(handler), 0 };
-    p.p = new (p.v) op(impl.ctx_, impl.dev_handle_, 
-        impl.endpoint_address_.value() + 128, buffers, scheduler_, handler, io_ex);
+      op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) op(impl.ctx_, impl.dev_handle_, Address, stream_id,
+        buffers, impl.capture_, impl.arena_.get(), impl.tracker_.get(),
+        scheduler_, handler, io_ex);
 
     BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
-          0, "async_receive"));
+          0, "async_endpoint_transfer"));
 
-    start_resolve_op(p.p);
+    if (stream && !stream_granted(impl, stream_id))
+      fail_op(p.p, asio::error::invalid_argument, lock);
+    else
+    {
+      start_limited_op(impl, p.p, (Address & LIBUSB_ENDPOINT_IN)
+          ? impl.tracker_->receives() : impl.tracker_->sends(),
+          buffers.size(), usb_device_base::normal, lock);
+    }
 
     p.v = p.p = 0;
-  } 
+  }
 
 private:
+  // Helper class to run the libusb event loop in a thread.
+  class event_thread_function;
+
+  template <typename Op, typename Handler, typename ConstBufferSequence,
+           typename IoExecutor>
+  void do_async_send(implementation_type& impl,
+      const ConstBufferSequence& buffers, Handler& handler,
+      const IoExecutor& io_ex, bool stream, std::uint32_t stream_id,
+      usb_device_base::transfer_priority priority)
+  {
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
+    typename Op::ptr p = { asio::detail::addressof(handler),
+      Op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) Op(impl.ctx_, impl.dev_handle_, 
+        impl.endpoint_address_.value(), stream_id, buffers, impl.capture_,
+        impl.arena_.get(), impl.tracker_.get(), scheduler_, handler,
+        io_ex);
+    set_transfer_type(impl, p.p->native_transfer(), stream_id);
+
+    BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
+          0, "async_send"));
+
+    if (stream && !stream_granted(impl, stream_id))
+      fail_op(p.p, asio::error::invalid_argument, lock);
+    else
+    {
+      start_limited_op(impl, p.p, impl.tracker_->sends(), buffers.size(),
+          priority, lock);
+    }
+
+    p.v = p.p = 0;
+  }
+
+  template <typename Op, typename Handler, typename MutableBufferSequence,
+           typename IoExecutor>
+  void do_async_receive(implementation_type& impl,
+      const MutableBufferSequence& buffers, Handler& handler,
+      const IoExecutor& io_ex, bool stream, std::uint32_t stream_id,
+      usb_device_base::transfer_priority priority)
+  {
+    asio::detail::mutex::scoped_lock lock(impl.mutex_);
+    typename Op::ptr p = { asio::detail::addressof(handler),
+      Op::ptr::allocate(handler, impl.arena_.get()), 0, impl.arena_.get() };
+    p.p = new (p.v) Op(impl.ctx_, impl.dev_handle_, 
+        impl.endpoint_address_.value() + 128, stream_id, buffers,
+        impl.capture_, impl.arena_.get(), impl.tracker_.get(), scheduler_,
+        handler, io_ex);
+    set_transfer_type(impl, p.p->native_transfer(), stream_id);
+
+    BOOST_ASIO_HANDLER_CREATION((scheduler_.context(), *p.p, "device", &impl,
+          0, "async_receive"));
+
+    if (stream && !stream_granted(impl, stream_id))
+      fail_op(p.p, asio::error::invalid_argument, lock);
+    else
+    {
+      start_limited_op(impl, p.p, impl.tracker_->receives(), buffers.size(),
+          priority, lock);
+    }
+
+    p.v = p.p = 0;
+  }
+
+  // Start a transfer according to the configured event mode. Transfers are
+  // submitted directly in the event modes and completed through their shard,
+  // or queued in their priority lane for the resolver thread.
+  template <typename Op>
+  void start_transfer_op(Op* op, context_shard& shard,
+      usb_device_base::transfer_priority priority)
+  {
+    if (mode_.load(std::memory_order_acquire)
+        != usb_service_options::resolver_thread)
+    {
+      start_event_thread();
+      scheduler_.work_started();
+      if (!op->submit(&shard.completions()))
+        scheduler_.post_deferred_completion(op);
+    }
+    else
+    {
+      // Without locking the resolver thread is not started and the transfer
+      // fails with operation_not_supported, so there is nothing to order.
+      if (BOOST_ASIO_CONCURRENCY_HINT_IS_LOCKING(SCHEDULER,
+            scheduler_.concurrency_hint()))
+      {
+        op->enqueue(&lanes_, priority == usb_device_base::urgent
+            ? transfer_lanes::urgent : transfer_lanes::normal);
+      }
+      start_resolve_op(op);
+    }
+  }
+
+  // Whether a stream id is one of the streams granted at open. Called with
+  // the implementation locked.
+  static bool stream_granted(const implementation_type& impl,
+      std::uint32_t stream_id)
+  {
+    return stream_id != 0 && stream_id <= impl.streams_;
+  }
+
+  // Complete an operation with an error instead of starting it. Called with
+  // the implementation locked, which is released.
+  template <typename Op>
+  void fail_op(Op* op, const boost::system::error_code& ec,
+      asio::detail::mutex::scoped_lock& lock)
+  {
+    lock.unlock();
+    op->set_error(ec);
+    scheduler_.work_started();
+    scheduler_.post_deferred_completion(op);
+  }
+
+  // Apply the transfer_type option to a transfer filled for the runtime
+  // endpoint. Called with the implementation locked.
+  static void set_transfer_type(const implementation_type& impl,
+      struct libusb_transfer* transfer, std::uint32_t stream_id)
+  {
+    if (stream_id == 0
+        && impl.transfer_type_.value() == usb_device_base::transfer_type::bulk)
+      transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+  }
+
+  // Create a tracker for an implementation and register it for shutdown.
+  BOOST_ASIO_DECL std::shared_ptr<transfer_tracker> new_tracker(
+      implementation_type& impl);
+
+  // Cancel the operations of a tracker and wait for them until the deadline.
+  // Returns false if some are still outstanding.
+  BOOST_ASIO_DECL bool drain(transfer_tracker& tracker,
+      transfer_tracker::clock_type::time_point deadline);
+
+  // Release the device handle. Called with the implementation locked.
+  BOOST_ASIO_DECL void do_close(implementation_type& impl,
+      boost::system::error_code& ec);
+
+  // Wait for the jobs of a device and lock it with none running, so that its
+  // handle can be closed.
+  BOOST_ASIO_DECL void lock_idle(implementation_type& impl,
+      asio::detail::mutex::scoped_lock& lock);
+
+  // Complete the transfers of an abandoned tracker as cancelled, once the
+  // handle they were submitted on has been closed and their callbacks will
+  // never run, and wake the threads waiting for them in the event loop.
+  BOOST_ASIO_DECL void complete_abandoned(transfer_tracker& tracker,
+      struct libusb_context* ctx);
+
+  // Give an implementation a new tracker in place of an abandoned one,
+  // keeping the send and receive limits. Called with the implementation locked.
+  BOOST_ASIO_DECL void renew_tracker(implementation_type& impl);
+
+  // The shard whose event thread is the calling thread, if any.
+  static context_shard*& on_event_thread()
+  {
+    static thread_local context_shard* value = 0;
+    return value;
+  }
+
+  // Create the context shards if they do not exist yet. Called with the
+  // service locked.
+  BOOST_ASIO_DECL void create_shards(boost::system::error_code& ec);
+
+  // The shard a device's transfers are completed through: the one it was
+  // opened in, or the first one. Called with the implementation locked.
+  BOOST_ASIO_DECL context_shard& shard_of(const implementation_type& impl);
+
+  // Choose the shard to open a device in, by its shard option or the
+  // policy. The device may be null if its bus is not known. Called with the
+  // implementation locked.
+  BOOST_ASIO_DECL context_shard* select_shard(const implementation_type& impl,
+      libusb_device* device, boost::system::error_code& ec);
+
+  // Start a transfer if the device's send or receive window has room, or
+  // fail it with would_block. Urgent transfers bypass the window. Called with
+  // the implementation locked; unlocks it.
+  template <typename Op>
+  void start_limited_op(implementation_type& impl, Op* op,
+      send_window& window, std::size_t size,
+      usb_device_base::transfer_priority priority,
+      asio::detail::mutex::scoped_lock& lock)
+  {
+    bool urgent = priority == usb_device_base::urgent;
+    bool room = urgent || window.acquire(size);
+    context_shard& shard = shard_of(impl);
+    lock.unlock();
+
+    if (room)
+    {
+      if (!urgent)
+        op->hold_window(window, size);
+      start_transfer_op(op, shard, priority);
+    }
+    else
+    {
+      op->set_error(asio::error::would_block);
+      scheduler_.work_started();
+      scheduler_.post_deferred_completion(op);
+    }
+  }
+
+  // Cancel the operations of a tracker, including those waiting for room to
+  // send.
+  BOOST_ASIO_DECL void cancel_ops(transfer_tracker& tracker);
+
+  // Start the libusb event threads of the shards if they are not already
+  // running.
+  BOOST_ASIO_DECL void start_event_thread();
+
+  // Stop and join the libusb event threads.
+  BOOST_ASIO_DECL void stop_event_thread();
+
+  // Handle a shard's libusb events until stopped.
+  BOOST_ASIO_DECL void run_event_thread(context_shard& shard);
+
+  // Poll a shard's libusb events and run completions until stopped.
+  BOOST_ASIO_DECL void run_busy_poll(context_shard& shard,
+      std::chrono::microseconds spin_threshold);
+
+  // Pin the calling thread to a cpu, unless cpu is negative.
+  BOOST_ASIO_DECL static void pin_thread(int cpu);
+
+  // Hand all completed transfers of a shard to the scheduler.
+  BOOST_ASIO_DECL void post_completions(context_shard& shard);
+
+  // Get the pool performing asynchronous opens, creating it if needed.
+  BOOST_ASIO_DECL asio::thread_pool& open_pool();
+
+  // Stop and join the pool performing asynchronous opens.
+  BOOST_ASIO_DECL void stop_open_pool();
+
+  // Open and claim the device. Called with the implementation locked.
+  BOOST_ASIO_DECL void do_open(implementation_type& impl,
+      boost::system::error_code& ec);
+
+  // Configure and claim the interface of a freshly opened device handle,
+  // closing the handle on failure. Called with the implementation locked.
+  BOOST_ASIO_DECL void do_claim(implementation_type& impl,
+      boost::system::error_code& ec);
+
+  // Ask libusb not to enumerate the bus if device discovery is disabled. Must
+  // precede libusb_init. libusb keeps the option for the whole process, so it
+  // is set once.
+  BOOST_ASIO_DECL void disable_discovery(boost::system::error_code& ec);
+
   BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
       const usb_device_base::endpoint_address& option, 
       boost::system::error_code& ec);
@@ -194,6 +791,38 @@ private:
       const usb_device_base::interface_number& option, 
       boost::system::error_code& ec);
 
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::capture& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::stream_count& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::configuration& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::detach_kernel_driver& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::send_queue_limit& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::receive_queue_limit& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::transfer_type& option, 
+      boost::system::error_code& ec);
+
+  BOOST_ASIO_DECL void do_set_option(implementation_type& impl, 
+      const usb_device_base::shard& option, 
+      boost::system::error_code& ec);
+
   BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
       usb_device_base::endpoint_address& option, 
       boost::system::error_code& ec) const;
@@ -201,6 +830,106 @@ private:
   BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
       usb_device_base::interface_number& option, 
       boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::capture& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::max_packet_size& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::stream_count& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::configuration& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::detach_kernel_driver& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::send_queue_limit& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::receive_queue_limit& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::transfer_type& option, 
+      boost::system::error_code& ec) const;
+
+  BOOST_ASIO_DECL void do_get_option(const implementation_type& impl, 
+      usb_device_base::shard& option, 
+      boost::system::error_code& ec) const;
+
+  // Allocate the requested bulk streams on the device's endpoints.
+  BOOST_ASIO_DECL void alloc_streams(implementation_type& impl,
+      boost::system::error_code& ec);
+
+  // Free the bulk streams allocated at open.
+  BOOST_ASIO_DECL void free_streams(implementation_type& impl);
+
+  BOOST_ASIO_DECL bool do_is_open(const implementation_type& impl) const;
+
+  BOOST_ASIO_DECL std::size_t do_transfer(implementation_type& impl,
+      unsigned char direction, void* data, std::size_t size,
+      boost::system::error_code& ec);
+
+  // Mutex to protect the options and the event thread.
+  asio::detail::mutex mutex_;
+
+  // The configured usb_service_options::event_mode.
+  std::atomic<int> mode_;
+
+  // Transfers queued for the resolver thread, by priority.
+  transfer_lanes lanes_;
+
+  // The libusb contexts devices are opened in, each with its completion
+  // queue and event thread. A single shard of the default context unless
+  // usb_service_options::context_shards is set.
+  std::vector<std::unique_ptr<context_shard> > shards_;
+
+  // Whether the event threads have been started.
+  bool event_threads_started_;
+
+  // Number of threads of the open pool, zero for one per hardware thread.
+  std::size_t open_threads_;
+
+  // The cpu the event thread is pinned to, or -1.
+  int cpu_affinity_;
+
+  // How long the busy_poll thread spins without events before blocking.
+  std::chrono::microseconds spin_threshold_;
+
+  // How long closing, destroying and shutting down wait for cancelled
+  // transfers.
+  std::chrono::milliseconds shutdown_timeout_;
+
+  // Whether libusb enumerates the bus.
+  bool device_discovery_;
+
+  // Whether this service disabled device discovery, which cannot be undone.
+  bool discovery_disabled_;
+
+  // Number of contexts of their own devices are distributed over.
+  std::size_t shard_count_;
+
+  // How devices are distributed over the shards.
+  usb_service_options::shard_policy shard_policy_;
+
+  // Next shard of the round robin policy.
+  std::atomic<std::size_t> next_shard_;
+
+  // Trackers of all implementations, for shutdown.
+  std::set<transfer_tracker*> trackers_;
+
+  // Pool performing asynchronous opens.
+  asio::detail::scoped_ptr<asio::thread_pool> open_pool_;
 };
 
 } // namespace detail
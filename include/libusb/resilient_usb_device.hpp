@@ -0,0 +1,614 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <boost/asio.hpp>
+#include <libusb.h>
+#include "libusb/error.hpp"
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Finds a physical usb device again after it re-enumerated.
+/**
+ * The device is identified by its bus number, its port path and its vendor
+ * and product id, which stay the same when a device resets or re-enumerates
+ * on the same port while its device address changes.
+ *
+ * The device is looked for among the devices enumerated in the libusb context
+ * it was open in, so that it is found again on the same context shard. Finding
+ * it requires device discovery (usb_service_options::device_discovery); a
+ * device wrapped from a file descriptor is not found again.
+ */
+class usb_port_locator
+{
+public:
+  /// The native representation of a usb device.
+  typedef libusb_device* native_handle_type;
+
+  usb_port_locator()
+    : ctx_(NULL)
+    , found_(NULL)
+    , bus_(0)
+    , depth_(0)
+    , vendor_id_(0)
+    , product_id_(0)
+  {
+  }
+
+  /// Destroys the locator, releasing the device it found last.
+  ~usb_port_locator()
+  {
+    if (found_)
+      libusb_unref_device(found_);
+  }
+
+  /// Remember the identity of a usb device and the context it is open in.
+  template <typename Device>
+  void remember(Device& device)
+  {
+    remember(device.native_handle(), device.native_context());
+  }
+
+  /// Remember the identity of a usb device.
+  /**
+   * @param device The usb device.
+   *
+   * @param ctx The libusb context to look for the device in, or null for the
+   * default context.
+   */
+  void remember(native_handle_type device, struct libusb_context* ctx = NULL)
+  {
+    if (!device)
+      return;
+
+    ctx_ = ctx;
+    bus_ = libusb_get_bus_number(device);
+    int depth = libusb_get_port_numbers(device, ports_, max_depth);
+    depth_ = depth < 0 ? 0 : depth;
+
+    struct libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(device, &desc) == LIBUSB_SUCCESS)
+    {
+      vendor_id_ = desc.idVendor;
+      product_id_ = desc.idProduct;
+    }
+  }
+
+  /// Look for the remembered usb device.
+  /**
+   * @returns The device, or null if it is not present. The locator holds a
+   * reference to the device until the next call to find or until it is
+   * destroyed, while an open device handle holds one of its own.
+   */
+  native_handle_type find(boost::system::error_code& ec)
+  {
+    libusb_device** devs;
+    int cnt = libusb_get_device_list(ctx_, &devs);
+    if (cnt < 0)
+    {
+      ec = libusb_error(cnt);
+      return NULL;
+    }
+
+    native_handle_type found = NULL;
+    for (int i = 0; i < cnt && !found; ++i)
+    {
+      if (matches(devs[i]))
+        found = libusb_ref_device(devs[i]);
+    }
+    libusb_free_device_list(devs, 1);
+
+    if (found_)
+      libusb_unref_device(found_);
+    found_ = found;
+    return found;
+  }
+
+private:
+  // Disallow copying and assignment.
+  usb_port_locator(const usb_port_locator&) BOOST_ASIO_DELETED;
+  usb_port_locator& operator=(const usb_port_locator&) BOOST_ASIO_DELETED;
+
+  enum { max_depth = 7 };
+
+  bool matches(libusb_device* device) const
+  {
+    if (libusb_get_bus_number(device) != bus_)
+      return false;
+
+    std::uint8_t ports[max_depth];
+    int depth = libusb_get_port_numbers(device, ports, max_depth);
+    if (depth != depth_)
+      return false;
+    for (int i = 0; i < depth; ++i)
+      if (ports[i] != ports_[i])
+        return false;
+
+    struct libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(device, &desc) != LIBUSB_SUCCESS)
+      return false;
+    return desc.idVendor == vendor_id_ && desc.idProduct == product_id_;
+  }
+
+  struct libusb_context* ctx_;
+  native_handle_type found_;
+  std::uint8_t bus_;
+  std::uint8_t ports_[max_depth];
+  int depth_;
+  std::uint16_t vendor_id_;
+  std::uint16_t product_id_;
+};
+
+/// Reconnects a usb device after it disappeared and replays its transfers.
+/**
+ * A resilient_usb_device forwards transfers to a usb device. When a transfer
+ * fails because the device is gone, it cancels the device's other transfers
+ * and, once they returned, closes the device and polls for the same physical
+ * device to come back, identified by the Locator. Once found, the device is
+ * assigned, opened (which claims the interface again) and the failed and
+ * cancelled transfers are resubmitted in their original order, as far as the
+ * replay policy allows. Transfers started while reconnecting are held back
+ * until the device is back.
+ *
+ * Transfers that are not replayed, and all held back transfers when the
+ * device does not return within the reconnect timeout, complete with the
+ * original error.
+ *
+ * Each transfer takes a single buffer; a buffer sequence of more than one
+ * buffer is rejected at compile time.
+ *
+ * The device must outlive the resilient_usb_device.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+template <typename Device, typename Locator = usb_port_locator>
+class resilient_usb_device
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// The clock used for the reconnect timeout.
+  typedef std::chrono::steady_clock clock_type;
+
+  /// Which failed transfers are resubmitted after a reconnect.
+  enum replay_policy
+  {
+    /// No transfer is replayed.
+    replay_none,
+
+    /// Receives and sends marked as idempotent are replayed.
+    replay_idempotent,
+
+    /// All transfers are replayed.
+    replay_all
+  };
+
+  /// Whether a send may safely be repeated.
+  enum operation_kind
+  {
+    idempotent,
+    non_idempotent
+  };
+
+  /// Construct a resilient_usb_device on a usb device.
+  /**
+   * @param device The usb device to forward transfers to.
+   *
+   * @param policy The replay policy.
+   *
+   * @param reconnect_timeout The time to wait for the device to come back.
+   *
+   * @param poll_interval The interval at which the device is looked for.
+   */
+  explicit resilient_usb_device(Device& device,
+      replay_policy policy = replay_idempotent,
+      clock_type::duration reconnect_timeout = std::chrono::seconds(2),
+      clock_type::duration poll_interval = std::chrono::milliseconds(1))
+    : state_(std::make_shared<state>(device, policy, reconnect_timeout,
+          poll_interval))
+  {
+  }
+
+  /// Destroys the object.
+  /**
+   * Transfers held back for a reconnect complete with
+   * boost::asio::error::operation_aborted.
+   */
+  ~resilient_usb_device()
+  {
+    state_->abort();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->device_.get_executor();
+  }
+
+  /// Get a reference to the locator identifying the device.
+  Locator& locator()
+  {
+    return state_->locator_;
+  }
+
+  /// Determine whether the device is connected.
+  bool connected() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return !state_->reconnecting_;
+  }
+
+  /// Get the number of successful reconnects.
+  std::size_t reconnects() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->reconnects_;
+  }
+
+  /// Start an asynchronous send that is not replayed under replay_idempotent.
+  /**
+   * @param buffers The data to be written to the usb device, as a single
+   * buffer. Ownership of the underlying memory is retained by the caller,
+   * which must guarantee that it remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the send completes. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send(const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return async_send(buffers, non_idempotent,
+        BOOST_ASIO_MOVE_CAST(WriteHandler)(handler));
+  }
+
+  /// Start an asynchronous send.
+  /**
+   * @param buffers The data to be written to the usb device, as a single
+   * buffer. Ownership of the underlying memory is retained by the caller,
+   * which must guarantee that it remains valid until the handler is called.
+   *
+   * @param kind Whether the send may be replayed under replay_idempotent.
+   *
+   * @param handler The handler to be called when the send completes. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send(const ConstBufferSequence& buffers, operation_kind kind,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    static_assert(
+        std::is_convertible<ConstBufferSequence, asio::const_buffer>::value,
+        "ConstBufferSequence must be a single buffer");
+    asio::const_buffer b(buffers);
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transfer(), handler, state_, false, kind,
+        asio::mutable_buffer(const_cast<void*>(b.data()), b.size()));
+  }
+
+  /// Start an asynchronous receive.
+  /**
+   * Receives are idempotent and replayed unless the policy is replay_none.
+   *
+   * @param buffers The single buffer into which the data will be received.
+   * Ownership of the underlying memory is retained by the caller, which must
+   * guarantee that it remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the receive completes. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes received.
+   * ); @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive(const MutableBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    static_assert(
+        std::is_convertible<MutableBufferSequence, asio::mutable_buffer>::value,
+        "MutableBufferSequence must be a single buffer");
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transfer(), handler, state_, true, idempotent,
+        asio::mutable_buffer(buffers));
+  }
+
+private:
+  typedef detail::erased_handler<boost::system::error_code, std::size_t>
+    handler_type;
+
+  typedef asio::basic_waitable_timer<clock_type,
+    asio::wait_traits<clock_type>, executor_type> timer_type;
+
+  struct transfer
+  {
+    bool receive_;
+    operation_kind kind_;
+    asio::mutable_buffer buffer_;
+    handler_type handler_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(Device& device, replay_policy policy,
+        clock_type::duration reconnect_timeout,
+        clock_type::duration poll_interval)
+      : device_(device)
+      , policy_(policy)
+      , reconnect_timeout_(reconnect_timeout)
+      , poll_interval_(poll_interval)
+      , timer_(device.get_executor())
+      , reconnecting_(false)
+      , aborted_(false)
+      , next_id_(0)
+      , reconnects_(0)
+    {
+    }
+
+    bool replayable(const transfer& t) const
+    {
+      switch (policy_)
+      {
+      case replay_all:
+        return true;
+      case replay_idempotent:
+        return t.kind_ == idempotent;
+      default:
+        return false;
+      }
+    }
+
+    static bool disconnected(const boost::system::error_code& ec)
+    {
+      return ec == boost::system::errc::no_such_device;
+    }
+
+    // Queue a transfer and submit it unless reconnecting. Called with the
+    // mutex held.
+    void start(transfer t)
+    {
+      std::uint64_t id = next_id_++;
+      if (reconnecting_)
+      {
+        held_.emplace(id, std::move(t));
+        return;
+      }
+
+      submit(id, t);
+      in_flight_.emplace(id, std::move(t));
+    }
+
+    void submit(std::uint64_t id, const transfer& t)
+    {
+      auto self(this->shared_from_this());
+      auto handler = [self, id](const boost::system::error_code& ec,
+          std::size_t n)
+      {
+        self->on_complete(id, ec, n);
+      };
+
+      if (t.receive_)
+        device_.async_receive(t.buffer_, handler);
+      else
+        device_.async_send(t.buffer_, handler);
+    }
+
+    void on_complete(std::uint64_t id, boost::system::error_code ec,
+        std::size_t n)
+    {
+      transfer t;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = in_flight_.find(id);
+        if (it == in_flight_.end())
+          return;
+        t = std::move(it->second);
+        in_flight_.erase(it);
+
+        // Transfers cancelled for the reconnect failed with the device.
+        bool cancelled = reconnecting_
+          && ec == asio::error::operation_aborted;
+        if ((disconnected(ec) || cancelled) && !aborted_)
+        {
+          if (!cancelled)
+          {
+            error_ = ec;
+            start_reconnect();
+          }
+          if (replayable(t))
+          {
+            held_.emplace(id, std::move(t));
+            return;
+          }
+          ec = error_;
+        }
+      }
+
+      t.handler_(ec, n);
+    }
+
+    // Start reconnecting. The device is closed by poll once the cancelled
+    // transfers returned, so that closing it does not wait for them. Called
+    // with the mutex held.
+    void start_reconnect()
+    {
+      if (reconnecting_)
+        return;
+
+      reconnecting_ = true;
+      deadline_ = clock_type::now() + reconnect_timeout_;
+      locator_.remember(device_);
+
+      auto self(this->shared_from_this());
+      asio::post(timer_.get_executor(), [self]
+          {
+            boost::system::error_code ignored_ec;
+            self->device_.cancel(ignored_ec);
+            self->poll();
+          });
+    }
+
+    void poll()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (aborted_ || !reconnecting_)
+          return;
+
+        if (!in_flight_.empty() && clock_type::now() < deadline_)
+        {
+          wait();
+          return;
+        }
+      }
+
+      // The device is only used by this poll while reconnecting.
+      boost::system::error_code ec;
+      device_.close(ec);
+      ec = boost::system::error_code();
+      typename Locator::native_handle_type native = locator_.find(ec);
+      if (native)
+      {
+        device_.assign(native, ec);
+        if (!ec)
+          device_.open(ec);
+        if (ec)
+        {
+          boost::system::error_code ignored_ec;
+          device_.close(ignored_ec);
+        }
+      }
+
+      std::map<std::uint64_t, transfer> failed;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (aborted_ || !reconnecting_)
+          return;
+
+        if (native && !ec)
+        {
+          reconnecting_ = false;
+          ++reconnects_;
+          for (auto& h : held_)
+          {
+            submit(h.first, h.second);
+            in_flight_.emplace(h.first, std::move(h.second));
+          }
+          held_.clear();
+          return;
+        }
+
+        if (clock_type::now() < deadline_)
+        {
+          wait();
+          return;
+        }
+
+        // The device did not come back in time.
+        reconnecting_ = false;
+        failed.swap(held_);
+      }
+
+      for (auto& f : failed)
+        f.second.handler_(error_, 0);
+    }
+
+    // Poll again after the poll interval. Called with the mutex held.
+    void wait()
+    {
+      auto self(this->shared_from_this());
+      timer_.expires_after(poll_interval_);
+      timer_.async_wait([self](const boost::system::error_code& e)
+          {
+            if (!e)
+              self->poll();
+          });
+    }
+
+    void abort()
+    {
+      std::map<std::uint64_t, transfer> aborted;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        reconnecting_ = false;
+        timer_.cancel();
+        aborted.swap(held_);
+      }
+
+      for (auto& a : aborted)
+        a.second.handler_(asio::error::operation_aborted, 0);
+    }
+
+    Device& device_;
+    Locator locator_;
+    replay_policy policy_;
+    clock_type::duration reconnect_timeout_;
+    clock_type::duration poll_interval_;
+    timer_type timer_;
+    mutable std::mutex mutex_;
+    std::map<std::uint64_t, transfer> in_flight_;
+    std::map<std::uint64_t, transfer> held_;
+    boost::system::error_code error_;
+    clock_type::time_point deadline_;
+    bool reconnecting_;
+    bool aborted_;
+    std::uint64_t next_id_;
+    std::size_t reconnects_;
+  };
+
+  // Disallow copying and assignment.
+  resilient_usb_device(const resilient_usb_device&) BOOST_ASIO_DELETED;
+  resilient_usb_device& operator=(
+      const resilient_usb_device&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_transfer
+  {
+    template <typename Handler>
+    void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler,
+        const std::shared_ptr<state>& s, bool receive, operation_kind kind,
+        const asio::mutable_buffer& buffer) const
+    {
+      transfer t;
+      t.receive_ = receive;
+      t.kind_ = kind;
+      t.buffer_ = buffer;
+      t.handler_ = handler_type(BOOST_ASIO_MOVE_CAST(Handler)(handler),
+          s->device_.get_executor());
+
+      std::lock_guard<std::mutex> lock(s->mutex_);
+      s->start(std::move(t));
+    }
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <libusb.h>
+#include <boost/asio.hpp>
+#include "libusb/detail/capture_ring.hpp"
+#include "libusb/detail/pcapng_writer.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Flight recorder for usb transfers.
+/**
+ * A usb_capture collects submit and complete events of the transfers of every
+ * usb device it is attached to (see usb_device_base::capture) and writes them
+ * to a pcapng file using the Linux usbmon link type, so the file can be opened
+ * in Wireshark.
+ *
+ * Recording is lock-free and never blocks the transfer path: events are
+ * placed into a fixed-size ring buffer and a background thread writes them to
+ * disk. Events arriving while the ring is full are dropped and counted.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+class usb_capture
+{
+public:
+  /// Start a capture.
+  /**
+   * @param path The pcapng file to write. An existing file is truncated.
+   *
+   * @param capacity The number of events the ring buffer can hold. It is
+   * rounded up to the next power of two.
+   *
+   * @param snaplen The maximum number of payload bytes recorded per event. A
+   * value of 0 records the usbmon headers only.
+   *
+   * @throws boost::system::system_error Thrown if the file cannot be opened.
+   */
+  explicit usb_capture(const std::string& path,
+      std::size_t capacity = 4096, std::size_t snaplen = 64)
+    : ring_(capacity, snaplen)
+    , file_(path, std::ios::binary | std::ios::trunc)
+    , writer_(file_)
+    , running_(true)
+  {
+    if (!file_)
+    {
+      asio::detail::throw_error(
+          boost::system::errc::make_error_code(
+            boost::system::errc::io_error), "usb_capture");
+    }
+
+    writer_.write_section_header();
+    writer_.write_interface_description(
+        detail::pcapng_writer::linktype_usb_linux_mmapped,
+        static_cast<std::uint32_t>(sizeof(detail::usbmon_packet) + snaplen));
+    thread_ = std::thread([this]{ run(); });
+  }
+
+  /// Stop the capture.
+  /**
+   * Writes all events still held in the ring buffer and closes the file. Usb
+   * devices must no longer refer to the capture when it is destroyed.
+   */
+  ~usb_capture()
+  {
+    running_.store(false, std::memory_order_release);
+    thread_.join();
+  }
+
+  /// Get the number of events dropped because the ring buffer was full.
+  std::size_t dropped() const
+  {
+    return ring_.dropped();
+  }
+
+  /// Record the submission of a transfer.
+  void record_submit(const struct libusb_transfer* transfer)
+  {
+    bool in = transfer->endpoint & LIBUSB_ENDPOINT_IN;
+    record('S', reinterpret_cast<std::uintptr_t>(transfer),
+        transfer->dev_handle, transfer->endpoint, transfer->type,
+        -115 /* -EINPROGRESS */, transfer->length,
+        in ? 0 : transfer->buffer, in ? 0 : transfer->length);
+  }
+
+  /// Record the completion of a transfer.
+  void record_complete(const struct libusb_transfer* transfer)
+  {
+    bool in = transfer->endpoint & LIBUSB_ENDPOINT_IN;
+    record('C', reinterpret_cast<std::uintptr_t>(transfer),
+        transfer->dev_handle, transfer->endpoint, transfer->type,
+        transfer_status(transfer->status), transfer->actual_length,
+        in ? transfer->buffer : 0, in ? transfer->actual_length : 0);
+  }
+
+  /// Record a single transfer event.
+  /**
+   * @param type The usbmon event type: 'S' (submit), 'C' (complete) or 'E'
+   * (submission error).
+   *
+   * @param id Identifier pairing submit and complete events.
+   *
+   * @param status A negative errno value as used by usbmon (0 on success).
+   */
+  void record(char type, std::uint64_t id,
+      struct libusb_device_handle* dev_handle, unsigned char endpoint,
+      unsigned char transfer_type, int status, std::size_t length,
+      const void* data, std::size_t data_length)
+  {
+    using namespace std::chrono;
+    auto now = duration_cast<microseconds>(
+        system_clock::now().time_since_epoch()).count();
+
+    detail::usbmon_packet h = {};
+    h.id = id;
+    h.type = static_cast<unsigned char>(type);
+    h.xfer_type = usbmon_transfer_type(transfer_type);
+    h.epnum = endpoint;
+    if (dev_handle)
+    {
+      libusb_device* dev = libusb_get_device(dev_handle);
+      h.devnum = libusb_get_device_address(dev);
+      h.busnum = libusb_get_bus_number(dev);
+    }
+    h.flag_setup = '-';
+    h.flag_data = data_length ? 0
+      : (endpoint & LIBUSB_ENDPOINT_IN ? '<' : '>');
+    h.ts_sec = now / 1000000;
+    h.ts_usec = static_cast<std::int32_t>(now % 1000000);
+    h.status = status;
+    h.length = static_cast<std::uint32_t>(length);
+
+    ring_.push(h, data, data_length);
+  }
+
+  /// Convert a libusb_error to the errno value usbmon reports.
+  static int error_status(int libusb_err)
+  {
+    switch (libusb_err)
+    {
+    case LIBUSB_SUCCESS:
+      return 0;
+    case LIBUSB_ERROR_TIMEOUT:
+      return -110;
+    case LIBUSB_ERROR_PIPE:
+      return -32;
+    case LIBUSB_ERROR_NO_DEVICE:
+      return -19;
+    case LIBUSB_ERROR_OVERFLOW:
+      return -75;
+    default:
+      return -71;
+    }
+  }
+
+private:
+  // Disallow copying and assignment.
+  usb_capture(const usb_capture&) BOOST_ASIO_DELETED;
+  usb_capture& operator=(const usb_capture&) BOOST_ASIO_DELETED;
+
+  static int transfer_status(enum libusb_transfer_status status)
+  {
+    switch (status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+      return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return -110;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return -2;
+    case LIBUSB_TRANSFER_STALL:
+      return -32;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return -19;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      return -75;
+    default:
+      return -71;
+    }
+  }
+
+  static unsigned char usbmon_transfer_type(unsigned char transfer_type)
+  {
+    switch (transfer_type)
+    {
+    case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+      return 0;
+    case LIBUSB_TRANSFER_TYPE_INTERRUPT:
+      return 1;
+    case LIBUSB_TRANSFER_TYPE_CONTROL:
+      return 2;
+    default:
+      return 3;
+    }
+  }
+
+  void run()
+  {
+    for (;;)
+    {
+      bool stopping = !running_.load(std::memory_order_acquire);
+
+      std::size_t n = ring_.consume(
+          [this](const detail::usbmon_packet& h, const unsigned char* data,
+            std::size_t size)
+          {
+            writer_.write_enhanced_packet(
+                static_cast<std::uint64_t>(h.ts_sec) * 1000000 + h.ts_usec,
+                &h, sizeof(h), data, h.len_cap,
+                static_cast<std::uint32_t>(sizeof(h) + size));
+          });
+
+      if (n == 0)
+      {
+        if (stopping)
+          break;
+        file_.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    }
+
+    file_.flush();
+  }
+
+  detail::capture_ring ring_;
+  std::ofstream file_;
+  detail::pcapng_writer writer_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+} // namespace libusb
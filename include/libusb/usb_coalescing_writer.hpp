@@ -0,0 +1,334 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "libusb/usb_device_base.hpp"
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Coalesces small sends to a usb device into larger transfers.
+/**
+ * A usb_coalescing_writer copies the data of each send into a batch and
+ * submits the batch as a single transfer on the usb device once it is full,
+ * once flush() is called, or once the flush deadline has passed since the
+ * first send of the batch. The batch is full when it reaches the size limit,
+ * which is the size cap rounded down to a multiple of the endpoint's maximum
+ * packet size.
+ *
+ * Only one batch is in flight at a time; batches closed meanwhile are queued
+ * and submitted in order. Every send completes with its own byte count once
+ * the transfer carrying it completes.
+ *
+ * The device must outlive the writer.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+template <typename Device>
+class usb_coalescing_writer
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// Construct a coalescing writer on a usb device.
+  /**
+   * @param device The usb device to send to.
+   *
+   * @param max_size The size cap of a coalesced transfer.
+   *
+   * @param deadline The time after the first send of a batch at which the
+   * batch is submitted even if it is not full.
+   */
+  explicit usb_coalescing_writer(Device& device, std::size_t max_size = 4096,
+      std::chrono::microseconds deadline = std::chrono::microseconds(100))
+    : state_(std::make_shared<state>(device, max_size, deadline))
+  {
+  }
+
+  /// Destroys the writer.
+  /**
+   * Sends that have not been submitted yet complete with
+   * boost::asio::error::operation_aborted.
+   */
+  ~usb_coalescing_writer()
+  {
+    state_->abort();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->device_.get_executor();
+  }
+
+  /// Start an asynchronous send.
+  /**
+   * This function copies the data into the current batch. The function call
+   * always returns immediately.
+   *
+   * @param buffers One or more data buffers to be written to the usb device.
+   * The data is copied, so the buffers need not remain valid.
+   *
+   * @param handler The handler to be called when the transfer carrying the
+   * data completes. The function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send(const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_send(), handler, state_, buffers);
+  }
+
+  /// Submit the current batch without waiting for the deadline.
+  void flush()
+  {
+    state_->flush();
+  }
+
+  /// Get the number of bytes in the batch that is still being filled.
+  std::size_t pending() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->batch_.data_.size();
+  }
+
+  /// Get the number of transfers submitted so far.
+  std::size_t transfers() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->transfers_;
+  }
+
+private:
+  typedef detail::erased_handler<boost::system::error_code, std::size_t>
+    handler_type;
+
+  typedef asio::basic_waitable_timer<std::chrono::steady_clock,
+    asio::wait_traits<std::chrono::steady_clock>, executor_type> timer_type;
+
+  struct send
+  {
+    std::size_t size_;
+    handler_type handler_;
+  };
+
+  struct batch
+  {
+    std::vector<unsigned char> data_;
+    std::vector<send> sends_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(Device& device, std::size_t max_size,
+        std::chrono::microseconds deadline)
+      : device_(device)
+      , max_size_(max_size ? max_size : 1)
+      , limit_(0)
+      , deadline_(deadline)
+      , timer_(device.get_executor())
+      , timer_armed_(false)
+      , timer_generation_(0)
+      , in_flight_(false)
+      , transfers_(0)
+    {
+    }
+
+    // Size limit of a batch, determined once the device is open.
+    std::size_t limit()
+    {
+      if (limit_ == 0)
+      {
+        usb_device_base::max_packet_size packet;
+        boost::system::error_code ec;
+        device_.get_option(packet, ec);
+        std::size_t p = ec ? 0 : packet.value();
+        if (p == 0)
+          return max_size_;
+        limit_ = max_size_ < p ? p : max_size_ - max_size_ % p;
+      }
+      return limit_;
+    }
+
+    // Add a send to the current batch. Called with the mutex held.
+    template <typename ConstBufferSequence>
+    void append(const ConstBufferSequence& buffers, handler_type& handler)
+    {
+      std::size_t n = asio::buffer_size(buffers);
+      if (!batch_.data_.empty() && batch_.data_.size() + n > limit())
+        close();
+
+      std::size_t offset = batch_.data_.size();
+      batch_.data_.resize(offset + n);
+      asio::buffer_copy(asio::buffer(batch_.data_.data() + offset, n),
+          buffers);
+      batch_.sends_.push_back(send{ n, std::move(handler) });
+
+      if (batch_.data_.size() >= limit())
+      {
+        close();
+      }
+      else if (!timer_armed_)
+      {
+        timer_armed_ = true;
+        auto self(this->shared_from_this());
+        std::uint64_t generation = ++timer_generation_;
+        timer_.expires_after(deadline_);
+        timer_.async_wait(
+            [self, generation](const boost::system::error_code& ec)
+            {
+              self->on_deadline(generation, ec);
+            });
+      }
+    }
+
+    // Move the current batch to the ready queue. Called with the mutex held.
+    void close()
+    {
+      if (batch_.sends_.empty())
+        return;
+
+      std::shared_ptr<batch> b(std::make_shared<batch>());
+      b->data_.swap(batch_.data_);
+      b->sends_.swap(batch_.sends_);
+      ready_.push_back(b);
+
+      if (timer_armed_)
+      {
+        timer_armed_ = false;
+        timer_.cancel();
+      }
+    }
+
+    void on_deadline(std::uint64_t generation,
+        const boost::system::error_code& ec)
+    {
+      if (ec == asio::error::operation_aborted)
+        return;
+
+      // The batch the timer was armed for may already have been closed.
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!timer_armed_ || generation != timer_generation_)
+        return;
+      timer_armed_ = false;
+      close();
+      start(lock);
+    }
+
+    void flush()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      close();
+      start(lock);
+    }
+
+    // Submit the next ready batch if no transfer is in flight, releasing the
+    // lock to do so.
+    void start(std::unique_lock<std::mutex>& lock)
+    {
+      if (in_flight_ || ready_.empty())
+        return;
+
+      std::shared_ptr<batch> b(ready_.front());
+      ready_.pop_front();
+      in_flight_ = true;
+      ++transfers_;
+      lock.unlock();
+
+      auto self(this->shared_from_this());
+      device_.async_send(asio::buffer(b->data_),
+          [self, b](const boost::system::error_code& ec, std::size_t n)
+          {
+            self->on_sent(*b, ec, n);
+          });
+    }
+
+    void on_sent(batch& b, const boost::system::error_code& ec,
+        std::size_t n)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        in_flight_ = false;
+        start(lock);
+      }
+
+      for (auto& s : b.sends_)
+      {
+        std::size_t written = n < s.size_ ? n : s.size_;
+        n -= written;
+        s.handler_(ec, written);
+      }
+    }
+
+    void abort()
+    {
+      std::deque<std::shared_ptr<batch> > aborted;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        close();
+        aborted.swap(ready_);
+      }
+
+      for (auto& b : aborted)
+        for (auto& s : b->sends_)
+          s.handler_(asio::error::operation_aborted, 0);
+    }
+
+    Device& device_;
+    std::size_t max_size_;
+    std::size_t limit_;
+    std::chrono::microseconds deadline_;
+    mutable std::mutex mutex_;
+    batch batch_;
+    std::deque<std::shared_ptr<batch> > ready_;
+    timer_type timer_;
+    bool timer_armed_;
+    std::uint64_t timer_generation_;
+    bool in_flight_;
+    std::size_t transfers_;
+  };
+
+  // Disallow copying and assignment.
+  usb_coalescing_writer(const usb_coalescing_writer&) BOOST_ASIO_DELETED;
+  usb_coalescing_writer& operator=(
+      const usb_coalescing_writer&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_send
+  {
+    template <typename WriteHandler, typename ConstBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(WriteHandler) handler,
+        const std::shared_ptr<state>& s,
+        const ConstBufferSequence& buffers) const
+    {
+      handler_type h(BOOST_ASIO_MOVE_CAST(WriteHandler)(handler),
+          s->device_.get_executor());
+
+      std::unique_lock<std::mutex> lock(s->mutex_);
+      s->append(buffers, h);
+      s->start(lock);
+    }
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
@@ -1,15 +1,40 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <boost/asio.hpp>
 #include "libusb/usb_device_base.hpp"
+#include "libusb/usb_transfer_timing.hpp"
+#include "libusb/detail/handler_type_requirements.hpp"
 #include "libusb/detail/usb_device_service.hpp"
 
 namespace libusb {
 
 namespace asio = boost::asio;
 
-template <typename Executor = asio::executor>
+template <std::uint8_t Address, enum libusb_transfer_type Type,
+         std::size_t MaxPacket, typename Executor>
+class usb_endpoint;
+
+/// Provides usb device functionality.
+/**
+ * The usb_device class template provides asynchronous and blocking transfer
+ * functionality for an endpoint of a usb device.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe. Opening, closing, setting and getting options
+ * and starting transfers are internally synchronised. Completion handlers are
+ * invoked through the executor; construct the usb_device with a strand to
+ * prevent handlers of the same device from running concurrently when the
+ * io_context is run from several threads.
+ *
+ * The default executor is the io_context's own executor type, which starts
+ * and completes operations without type erasure. Use a polymorphic executor
+ * such as boost::asio::executor only where the execution context is not an
+ * io_context.
+ */
+template <typename Executor = asio::io_context::executor_type>
 class usb_device
   : public usb_device_base
 {
@@ -124,7 +149,10 @@ public:
   /**
    * This function destroys the usb device, cancelling any outstanding
    * asynchronous wait operations associated with the usb device as if by
-   * calling @c cancel.
+   * calling @c cancel. It waits for libusb to return the cancelled transfers
+   * for at most usb_service_options::shutdown_timeout. Transfers still
+   * outstanding after that are taken back by closing the device, and complete
+   * with boost::asio::error::operation_aborted.
    */
   ~usb_device()
   {
@@ -189,6 +217,32 @@ public:
     BOOST_ASIO_SYNC_OP_VOID_RETURN(ec);
   }
 
+  /// Start an asynchronous open.
+  /**
+   * This function opens the usb device on a pool of threads shared by the
+   * execution context, so that many devices can be opened in parallel. Opening
+   * activates the configuration selected with usb_device_base::configuration,
+   * detaches kernel drivers if usb_device_base::detach_kernel_driver is set
+   * and claims the interface. The function call always returns immediately.
+   *
+   * @param handler The handler to be called when the open completes. Copies
+   * will be made of the handler as required. The function signature of the
+   * handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error // Result of operation.
+   * ); @endcode
+   *
+   * @sa usb_service_options::open_threads
+   */
+  template <typename OpenHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(OpenHandler,
+      void (boost::system::error_code))
+  async_open(BOOST_ASIO_MOVE_ARG(OpenHandler) handler)
+  {
+    return asio::async_initiate<OpenHandler, void (boost::system::error_code)>(
+        initiate_async_open(), handler, this);
+  }
+
   /// Assign an existing native usb device to the usb device.
   /*
    * This function opens the usb device to hold an existing native usb device.
@@ -221,6 +275,44 @@ public:
     BOOST_ASIO_SYNC_OP_VOID_RETURN(ec);
   }
 
+  /// Open the usb device from a file descriptor.
+  /**
+   * This function wraps the file descriptor of an opened usb device node,
+   * e.g. /dev/bus/usb/001/004 opened by a privileged process and passed on,
+   * and claims the interface as open() does. The bus is not enumerated, so
+   * with usb_service_options::device_discovery disabled the device is ready
+   * without scanning the bus. Options affecting open() must be set before.
+   *
+   * @param fd The file descriptor. It is not closed by close(); the caller
+   * closes it after the usb device has been closed. The wrapped device is
+   * released by close(), after which native_handle() returns null.
+   *
+   * @throws boost::system::system_error Thrown on failure.
+   */
+  void assign_fd(int fd)
+  {
+    boost::system::error_code ec;
+    impl_.get_service().assign_fd(impl_.get_implementation(), fd, ec);
+    asio::detail::throw_error(ec, "assign_fd");
+  }
+
+  /// Open the usb device from a file descriptor.
+  /**
+   * This function wraps the file descriptor of an opened usb device node and
+   * claims the interface as open() does, without enumerating the bus.
+   *
+   * @param fd The file descriptor. It is not closed by close(); the caller
+   * closes it after the usb device has been closed. The wrapped device is
+   * released by close(), after which native_handle() returns null.
+   *
+   * @param ec Set to indicate what error occurred, if any.
+   */
+  BOOST_ASIO_SYNC_OP_VOID assign_fd(int fd, boost::system::error_code& ec)
+  {
+    impl_.get_service().assign_fd(impl_.get_implementation(), fd, ec);
+    BOOST_ASIO_SYNC_OP_VOID_RETURN(ec);
+  }
+
   /// Determine whether the usb device is open.
   bool is_open() const
   {
@@ -231,7 +323,9 @@ public:
   /**
    * This function is used to close the usb device. Any asynchronous read or
    * write operations will be cancelled immediately, and will complete with the
-   * boost::system::error::operation_aborted error.
+   * boost::system::error::operation_aborted error. The device is released
+   * once libusb has returned the cancelled transfers, or after
+   * usb_service_options::shutdown_timeout.
    *
    * @throws boost::system::system_error Thrown on failure.
    */
@@ -246,7 +340,9 @@ public:
   /**
    * This function is used to close the usb device. Any asynchronous read or
    * write operations will be cancelled immediately, and will complete with the
-   * boost::system::error::operation_aborted error.
+   * boost::system::error::operation_aborted error. The device is released
+   * once libusb has returned the cancelled transfers, or after
+   * usb_service_options::shutdown_timeout.
    *
    * @param ec Set to indicate what error occurred, if any.
    */
@@ -267,6 +363,177 @@ public:
     return impl_.get_service().native_handle(impl_.get_implementation());
   }
 
+  /// Get the libusb context the usb device is open in.
+  /**
+   * This is the context of the service's context shard the device was opened
+   * on, or null for the default context. It stays set after the device is
+   * closed, until it is opened again.
+   */
+  struct libusb_context* native_context()
+  {
+    return impl_.get_service().native_context(impl_.get_implementation());
+  }
+
+  /// Get the device descriptor.
+  /**
+   * The device descriptor is cached when a native usb device is assigned.
+   *
+   * @throws boost::system::system_error Thrown on failure.
+   */
+  struct libusb_device_descriptor device_descriptor() const
+  {
+    boost::system::error_code ec;
+    struct libusb_device_descriptor descriptor = device_descriptor(ec);
+    asio::detail::throw_error(ec, "device_descriptor");
+    return descriptor;
+  }
+
+  /// Get the device descriptor.
+  /**
+   * The device descriptor is cached when a native usb device is assigned.
+   *
+   * @param ec Set to indicate what error occurred, if any.
+   */
+  struct libusb_device_descriptor device_descriptor(
+      boost::system::error_code& ec) const
+  {
+    struct libusb_device_descriptor descriptor = {};
+    impl_.get_service().device_descriptor(impl_.get_implementation(),
+        descriptor, ec);
+    return descriptor;
+  }
+
+  /// Get a configuration descriptor.
+  /**
+   * The configuration descriptors are cached when a native usb device is
+   * assigned.
+   *
+   * @param index The index of the configuration, not its bConfigurationValue.
+   *
+   * @throws boost::system::system_error Thrown on failure.
+   */
+  std::shared_ptr<const struct libusb_config_descriptor> config_descriptor(
+      std::uint8_t index) const
+  {
+    boost::system::error_code ec;
+    auto config = config_descriptor(index, ec);
+    asio::detail::throw_error(ec, "config_descriptor");
+    return config;
+  }
+
+  /// Get a configuration descriptor.
+  /**
+   * The configuration descriptors are cached when a native usb device is
+   * assigned.
+   *
+   * @param index The index of the configuration, not its bConfigurationValue.
+   *
+   * @param ec Set to indicate what error occurred, if any.
+   */
+  std::shared_ptr<const struct libusb_config_descriptor> config_descriptor(
+      std::uint8_t index, boost::system::error_code& ec) const
+  {
+    return impl_.get_service().config_descriptor(impl_.get_implementation(),
+        index, ec);
+  }
+
+  /// Get the BOS descriptor.
+  /**
+   * The BOS descriptor is cached when the usb device is opened. If the device
+   * has none, it is requested from the open device on every call.
+   *
+   * @throws boost::system::system_error Thrown on failure.
+   */
+  std::shared_ptr<const struct libusb_bos_descriptor> bos_descriptor()
+  {
+    boost::system::error_code ec;
+    auto bos = bos_descriptor(ec);
+    asio::detail::throw_error(ec, "bos_descriptor");
+    return bos;
+  }
+
+  /// Get the BOS descriptor.
+  /**
+   * The BOS descriptor is cached when the usb device is opened. If the device
+   * has none, it is requested from the open device on every call.
+   *
+   * @param ec Set to indicate what error occurred, if any.
+   */
+  std::shared_ptr<const struct libusb_bos_descriptor> bos_descriptor(
+      boost::system::error_code& ec)
+  {
+    return impl_.get_service().bos_descriptor(impl_.get_implementation(), ec);
+  }
+
+  /// Get a string descriptor in ASCII.
+  /**
+   * The manufacturer, product and serial number strings are cached when the
+   * usb device is opened. Other strings are read from the open device with a
+   * blocking control transfer on first use and cached afterwards; use
+   * async_read_string_descriptor() to keep the control transfer off the
+   * calling thread.
+   *
+   * @param index The string index, e.g. iSerialNumber of the device
+   * descriptor.
+   *
+   * @throws boost::system::system_error Thrown on failure.
+   */
+  std::string string_descriptor(std::uint8_t index)
+  {
+    boost::system::error_code ec;
+    std::string value = string_descriptor(index, ec);
+    asio::detail::throw_error(ec, "string_descriptor");
+    return value;
+  }
+
+  /// Get a string descriptor in ASCII.
+  /**
+   * The manufacturer, product and serial number strings are cached when the
+   * usb device is opened. Other strings are read from the open device with a
+   * blocking control transfer on first use and cached afterwards; use
+   * async_read_string_descriptor() to keep the control transfer off the
+   * calling thread.
+   *
+   * @param index The string index, e.g. iSerialNumber of the device
+   * descriptor.
+   *
+   * @param ec Set to indicate what error occurred, if any.
+   */
+  std::string string_descriptor(std::uint8_t index,
+      boost::system::error_code& ec)
+  {
+    return impl_.get_service().string_descriptor(impl_.get_implementation(),
+        index, ec);
+  }
+
+  /// Start an asynchronous read of a string descriptor in ASCII.
+  /**
+   * Cached strings complete without a control transfer. Others are read on
+   * the pool of threads that performs async_open() and cached. The function
+   * call always returns immediately.
+   *
+   * @param index The string index, e.g. iSerialNumber of the device
+   * descriptor.
+   *
+   * @param handler The handler to be called when the read completes. Copies
+   * will be made of the handler as required. The function signature of the
+   * handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::string value                       // The string.
+   * ); @endcode
+   */
+  template <typename StringHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(StringHandler,
+      void (boost::system::error_code, std::string))
+  async_read_string_descriptor(std::uint8_t index,
+      BOOST_ASIO_MOVE_ARG(StringHandler) handler)
+  {
+    return asio::async_initiate<StringHandler,
+      void (boost::system::error_code, std::string)>(
+        initiate_async_string_descriptor(), handler, this, index);
+  }
+
   /// Cancel all asynchronous operations associated with the usb device.
   /**
    * This function causes all outstanding asynchronous read or write operations
@@ -447,6 +714,9 @@ public:
    * immediate completion, invocation of the handler will be performed in a
    * manner equivalent to using asio::post().
    *
+   * If the usb_device_base::send_queue_limit option is set and the device is
+   * at its limit, the send fails with boost::asio::error::would_block.
+   *
    * @par Example
    * To write a single data buffer use the @ref buffer function as follows:
    * @code
@@ -465,7 +735,86 @@ public:
   {
     return asio::async_initiate<WriteHandler,
       void (boost::system::error_code, std::size_t)>(
-        initiate_async_send(), handler, this, buffers);
+        initiate_async_send(), handler, this, buffers, normal);
+  }
+
+  /// Start an asynchronous send with a priority.
+  /**
+   * This function is used to asynchronously send data to the usb device in a
+   * priority class. Urgent sends are performed ahead of queued normal
+   * transfers and are not limited by the usb_device_base::send_queue_limit
+   * option. The ordering applies to the resolver thread, which a concurrency
+   * hint without locking disables; see usb_device_base::transfer_priority.
+   * The function call always returns immediately.
+   *
+   * @param buffers One or more data buffers to be written to the usb device.
+   * Although the buffers object may be copied as necessary, ownership of the
+   * underlying memory blocks is retained by the caller, which must guarantee
+   * that they remain valid until the handler is called.
+   *
+   * @param priority The priority class of the send.
+   *
+   * @param handler The handler to be called when the write operation completes.
+   * Copies will be made of the handler as required. The function signature of
+   * the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   *
+   * @par Example
+   * @code
+   * usb_device.async_send(asio::buffer(emergency_stop),
+   *     libusb::usb_device_base::urgent, handler);
+   * @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send(const ConstBufferSequence& buffers, transfer_priority priority,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_send(), handler, this, buffers, priority);
+  }
+
+  /// Start an asynchronous wait for room to send.
+  /**
+   * This function is used to asynchronously wait until the usb device has
+   * fewer outstanding sends than allowed by the
+   * usb_device_base::send_queue_limit option, so that producers are throttled
+   * to the pace of the device. The function call always returns immediately.
+   *
+   * Room is not reserved: when several producers wait, a send started after
+   * the wait may still fail with boost::asio::error::would_block.
+   *
+   * @param handler The handler to be called when the device has room to send.
+   * Copies will be made of the handler as required. The function signature of
+   * the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error // Result of operation.
+   * ); @endcode
+   *
+   * @par Example
+   * @code
+   * void send_next()
+   * {
+   *   device.async_wait_writable([this](boost::system::error_code ec)
+   *       {
+   *         if (!ec)
+   *           device.async_send(next_block(), on_sent);
+   *       });
+   * }
+   * @endcode
+   */
+  template <typename WaitHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WaitHandler,
+      void (boost::system::error_code))
+  async_wait_writable(BOOST_ASIO_MOVE_ARG(WaitHandler) handler)
+  {
+    return asio::async_initiate<WaitHandler, void (boost::system::error_code)>(
+        initiate_async_wait_writable(), handler, this);
   }
 
   /// Receive some data from the usb device.
@@ -541,6 +890,9 @@ public:
    * immediate completion, invocation of the handler will be performed in a
    * manner equivalent to using asio::post().
    *
+   * If the usb_device_base::receive_queue_limit option is set and the device
+   * is at its limit, the receive fails with boost::asio::error::would_block.
+   *
    * @par Example
    * To read into a single data buffer use the @ref buffer function as follows:
    * @code
@@ -559,27 +911,312 @@ public:
   {
     return asio::async_initiate<ReadHandler,
       void (boost::system::error_code, std::size_t)>(
-        initiate_async_receive(), handler, this, buffers);
+        initiate_async_receive(), handler, this, buffers, normal);
+  }
+
+  /// Start an asynchronous receive with a priority.
+  /**
+   * This function is used to asynchronously receive data from the usb device
+   * in a priority class. Urgent receives are performed ahead of queued normal
+   * transfers and are not limited by the usb_device_base::receive_queue_limit
+   * option. The ordering applies to the resolver thread, which a concurrency
+   * hint without locking disables; see usb_device_base::transfer_priority.
+   * The function call always returns immediately.
+   *
+   * @param buffers One or more buffers into which the data will be received.
+   * Although the buffers object may be copied as necessary, ownership of the
+   * underlying memory blocks is retained by the caller, which must guarantee
+   * that they remain valid until the handler is called.
+   *
+   * @param priority The priority class of the receive.
+   *
+   * @param handler The handler to be called when the receive operation
+   * completes. Copies will be made of the handler as required. The function
+   * signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes received.
+   * ); @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive(const MutableBufferSequence& buffers,
+      transfer_priority priority, BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_receive(), handler, this, buffers, priority);
+  }
+
+  /// Start an asynchronous send reporting its timestamps.
+  /**
+   * This function is used to asynchronously send data to the usb device like
+   * async_send(), additionally passing the times at which the transfer was
+   * submitted to libusb and at which libusb reported its completion. The
+   * function call always returns immediately.
+   *
+   * @param buffers One or more data buffers to be written to the usb device.
+   * Although the buffers object may be copied as necessary, ownership of the
+   * underlying memory blocks is retained by the caller, which must guarantee
+   * that they remain valid until the handler is called.
+   *
+   * @param handler The handler to be called when the write operation completes.
+   * Copies will be made of the handler as required. The function signature of
+   * the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred,          // Number of bytes written.
+   *   libusb::transfer_timing timing          // Submit and callback times.
+   * ); @endcode
+   * The timestamps are zero if the transfer was never submitted.
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t, transfer_timing))
+  async_send_timed(const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t, transfer_timing)>(
+        initiate_async_send_timed(), handler, this, buffers);
+  }
+
+  /// Start an asynchronous receive reporting its timestamps.
+  /**
+   * This function is used to asynchronously receive data from the usb device
+   * like async_receive(), additionally passing the times at which the
+   * transfer was submitted to libusb and at which libusb reported its
+   * completion. The completion time is taken before the completion is handed
+   * to the executor, so it stamps the data independently of when the handler
+   * runs. The function call always returns immediately.
+   *
+   * @param buffers One or more buffers into which the data will be received.
+   * Although the buffers object may be copied as necessary, ownership of the
+   * underlying memory blocks is retained by the caller, which must guarantee
+   * that they remain valid until the handler is called.
+   *
+   * @param handler The handler to be called when the receive operation
+   * completes. Copies will be made of the handler as required. The function
+   * signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred,          // Number of bytes received.
+   *   libusb::transfer_timing timing          // Submit and callback times.
+   * ); @endcode
+   * The timestamps are zero if the transfer was never submitted.
+   *
+   * @par Example
+   * @code
+   * device.async_receive_timed(asio::buffer(sample),
+   *     [](boost::system::error_code ec, std::size_t n,
+   *       libusb::transfer_timing timing)
+   *     {
+   *       align(sample, timing.completed);
+   *     });
+   * @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t, transfer_timing))
+  async_receive_timed(const MutableBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t, transfer_timing)>(
+        initiate_async_receive_timed(), handler, this, buffers);
+  }
+
+  /// Get the transfer statistics of an endpoint.
+  /**
+   * Every successful transfer, timed or not, updates the rolling interval,
+   * jitter and latency statistics of its endpoint.
+   *
+   * @param address The endpoint address, including the direction bit.
+   */
+  endpoint_statistics transfer_statistics(std::uint8_t address) const
+  {
+    return impl_.get_service().transfer_statistics(
+        impl_.get_implementation(), address);
+  }
+
+  /// Clear the transfer statistics of an endpoint.
+  /**
+   * @param address The endpoint address, including the direction bit.
+   */
+  void reset_transfer_statistics(std::uint8_t address)
+  {
+    impl_.get_service().reset_transfer_statistics(
+        impl_.get_implementation(), address);
+  }
+
+  /// Start an asynchronous send on a bulk stream.
+  /**
+   * This function is used to asynchronously send data on one of the bulk
+   * streams of a USB 3 usb device. The streams must have been requested with
+   * the usb_device_base::stream_count option before the device was opened.
+   * The function call always returns immediately.
+   *
+   * @param stream_id The stream to send on, from 1 to the number of streams
+   * granted. Other ids fail with boost::asio::error::invalid_argument.
+   *
+   * @param buffers One or more data buffers to be written to the usb device.
+   * Although the buffers object may be copied as necessary, ownership of the
+   * underlying memory blocks is retained by the caller, which must guarantee
+   * that they remain valid until the handler is called.
+   *
+   * @param handler The handler to be called when the write operation completes.
+   * Copies will be made of the handler as required. The function signature of
+   * the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send_stream(std::uint32_t stream_id,
+      const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_send_stream(), handler, this, stream_id, buffers);
+  }
+
+  /// Start an asynchronous receive on a bulk stream.
+  /**
+   * This function is used to asynchronously receive data on one of the bulk
+   * streams of a USB 3 usb device. The streams must have been requested with
+   * the usb_device_base::stream_count option before the device was opened.
+   * The function call always returns immediately.
+   *
+   * @param stream_id The stream to receive on, from 1 to the number of streams
+   * granted. Other ids fail with boost::asio::error::invalid_argument.
+   *
+   * @param buffers One or more buffers into which the data will be received.
+   * Although the buffers object may be copied as necessary, ownership of the
+   * underlying memory blocks is retained by the caller, which must guarantee
+   * that they remain valid until the handler is called.
+   *
+   * @param handler The handler to be called when the receive operation
+   * completes. Copies will be made of the handler as required. The function
+   * signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes received.
+   * ); @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive_stream(std::uint32_t stream_id,
+      const MutableBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_receive_stream(), handler, this, stream_id,
+        buffers);
   }
 
 private:
+  template <std::uint8_t, enum libusb_transfer_type, std::size_t, typename>
+  friend class usb_endpoint;
+
   asio::detail::io_object_impl<detail::usb_device_service, Executor> impl_;
 
   // Disallow copying and assignment.
   usb_device(const usb_device&) BOOST_ASIO_DELETED;
   usb_device& operator=(const usb_device&) BOOST_ASIO_DELETED; 
 
+  struct initiate_async_open
+  {
+    template <typename OpenHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(OpenHandler) handler,
+        usb_device* self) const
+    {
+      LIBUSB_OPEN_HANDLER_CHECK(OpenHandler, handler) type_check;
+
+      asio::detail::non_const_lvalue<OpenHandler> handler2(handler);
+      self->impl_.get_service().async_open(
+          self->impl_.get_implementation(), handler2.value,
+          self->impl_.get_implementation_executor());
+    }
+  };
+
+  struct initiate_async_string_descriptor
+  {
+    template <typename StringHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(StringHandler) handler,
+        usb_device* self, std::uint8_t index) const
+    {
+      LIBUSB_STRING_HANDLER_CHECK(StringHandler, handler) type_check;
+
+      asio::detail::non_const_lvalue<StringHandler> handler2(handler);
+      self->impl_.get_service().async_string_descriptor(
+          self->impl_.get_implementation(), index, handler2.value,
+          self->impl_.get_implementation_executor());
+    }
+  };
+
   struct initiate_async_send
   {
     template <typename WriteHandler, typename ConstBufferSequence>
     void operator()(BOOST_ASIO_MOVE_ARG(WriteHandler) handler,
-        usb_device* self, const ConstBufferSequence& buffers) const
+        usb_device* self, const ConstBufferSequence& buffers,
+        transfer_priority priority) const
     {
       BOOST_ASIO_WRITE_HANDLER_CHECK(WriteHandler, handler) type_check;
 
       asio::detail::non_const_lvalue<WriteHandler> handler2(handler);
       self->impl_.get_service().async_send(
           self->impl_.get_implementation(), buffers, handler2.value, 
+          self->impl_.get_implementation_executor(), priority);
+    }
+  };
+
+  struct initiate_async_send_stream
+  {
+    template <typename WriteHandler, typename ConstBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(WriteHandler) handler,
+        usb_device* self, std::uint32_t stream_id,
+        const ConstBufferSequence& buffers) const
+    {
+      BOOST_ASIO_WRITE_HANDLER_CHECK(WriteHandler, handler) type_check;
+
+      asio::detail::non_const_lvalue<WriteHandler> handler2(handler);
+      self->impl_.get_service().async_send_stream(
+          self->impl_.get_implementation(), stream_id, buffers,
+          handler2.value, self->impl_.get_implementation_executor());
+    }
+  };
+
+  struct initiate_async_send_timed
+  {
+    template <typename WriteHandler, typename ConstBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(WriteHandler) handler,
+        usb_device* self, const ConstBufferSequence& buffers) const
+    {
+      asio::detail::non_const_lvalue<WriteHandler> handler2(handler);
+      self->impl_.get_service().async_send_timed(
+          self->impl_.get_implementation(), buffers, handler2.value, 
+          self->impl_.get_implementation_executor());
+    }
+  };
+
+  struct initiate_async_wait_writable
+  {
+    template <typename WaitHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(WaitHandler) handler,
+        usb_device* self) const
+    {
+      BOOST_ASIO_WAIT_HANDLER_CHECK(WaitHandler, handler) type_check;
+
+      asio::detail::non_const_lvalue<WaitHandler> handler2(handler);
+      self->impl_.get_service().async_wait_writable(
+          self->impl_.get_implementation(), handler2.value,
           self->impl_.get_implementation_executor());
     }
   };
@@ -588,12 +1225,42 @@ private:
   {
     template <typename ReadHandler, typename MutableBufferSequence>
     void operator()(BOOST_ASIO_MOVE_ARG(ReadHandler) handler,
-        usb_device* self, const MutableBufferSequence& buffers) const
+        usb_device* self, const MutableBufferSequence& buffers,
+        transfer_priority priority) const
     {
       BOOST_ASIO_READ_HANDLER_CHECK(ReadHandler, handler) type_check;
 
       asio::detail::non_const_lvalue<ReadHandler> handler2(handler);
       self->impl_.get_service().async_receive(
+          self->impl_.get_implementation(), buffers, handler2.value,
+          self->impl_.get_implementation_executor(), priority);
+    }
+  };
+
+  struct initiate_async_receive_stream
+  {
+    template <typename ReadHandler, typename MutableBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(ReadHandler) handler,
+        usb_device* self, std::uint32_t stream_id,
+        const MutableBufferSequence& buffers) const
+    {
+      BOOST_ASIO_READ_HANDLER_CHECK(ReadHandler, handler) type_check;
+
+      asio::detail::non_const_lvalue<ReadHandler> handler2(handler);
+      self->impl_.get_service().async_receive_stream(
+          self->impl_.get_implementation(), stream_id, buffers,
+          handler2.value, self->impl_.get_implementation_executor());
+    }
+  };
+
+  struct initiate_async_receive_timed
+  {
+    template <typename ReadHandler, typename MutableBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(ReadHandler) handler,
+        usb_device* self, const MutableBufferSequence& buffers) const
+    {
+      asio::detail::non_const_lvalue<ReadHandler> handler2(handler);
+      self->impl_.get_service().async_receive_timed(
           self->impl_.get_implementation(), buffers, handler2.value,
           self->impl_.get_implementation_executor());
     }
@@ -9,7 +9,7 @@ namespace libusb {
 
 namespace asio = boost::asio;
 
-template <typename Executor = asio::executor>
+template <typename Executor = asio::io_context::executor_type>
 class usb_device_acceptor
   : public usb_device_base
 {
@@ -1,12 +1,46 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <boost/asio.hpp>
 
 namespace libusb {
 
+class usb_capture;
+
+namespace detail {
+class usb_device_service;
+} // namespace detail
+
 class usb_device_base
 {
 public:
+  /// Priority classes of transfers.
+  /**
+   * On the resolver thread, urgent transfers are performed ahead of all
+   * queued normal transfers, of any device. Urgent transfers are not counted
+   * against the send_queue_limit and receive_queue_limit options, so capping
+   * the normal transfers keeps room for urgent traffic.
+   *
+   * The resolver thread performs one transfer at a time, so an urgent
+   * transfer still waits for the transfer in flight, which may be a receive
+   * that waits for data indefinitely. A bound on the latency of urgent
+   * transfers requires usb_service_options::event_thread or
+   * usb_service_options::busy_poll, where transfers are submitted at once.
+   *
+   * An io_context constructed with a concurrency hint that disables locking,
+   * such as BOOST_ASIO_CONCURRENCY_HINT_UNSAFE, has no resolver thread:
+   * transfers in the resolver_thread mode fail with
+   * boost::asio::error::operation_not_supported whatever their priority, and
+   * the event_thread or busy_poll mode must be used, where priorities have no
+   * effect.
+   */
+  enum transfer_priority
+  {
+    normal,
+    urgent
+  };
+
   /// Usb device option to permit changing the interface number.
   /**
    * Implements changing the interfcae number for a given usb device.
@@ -49,6 +83,240 @@ public:
     int value_;
   };
 
+  /// Usb device option to select the configuration set when opening.
+  /**
+   * Implements selecting the configuration that is activated when a given
+   * usb device is opened. The default of -1 leaves the active configuration
+   * unchanged.
+   */
+  class configuration
+  {
+  public:
+    explicit configuration(int t = -1)
+      : value_(t)
+    {
+    }
+
+    int value() const
+    {
+      return value_;
+    }
+
+  private:
+    int value_;
+  };
+
+  /// Usb device option to detach kernel drivers when opening.
+  /**
+   * Implements detaching a kernel driver bound to the interface of a given
+   * usb device while the interface is claimed, and reattaching it on close.
+   */
+  class detach_kernel_driver
+  {
+  public:
+    explicit detach_kernel_driver(bool t = false)
+      : value_(t)
+    {
+    }
+
+    bool value() const
+    {
+      return value_;
+    }
+
+  private:
+    bool value_;
+  };
+
+  /// Usb device option to select the transfer type of the endpoint.
+  /**
+   * Implements choosing whether the transfers of a given usb device on the
+   * endpoint set with the endpoint_address option are interrupt or bulk
+   * transfers. The default is interrupt. Transfers on bulk streams are always
+   * bulk transfers.
+   */
+  class transfer_type
+  {
+  public:
+    enum type
+    {
+      interrupt,
+      bulk
+    };
+
+    explicit transfer_type(type t = interrupt)
+      : value_(t)
+    {
+    }
+
+    type value() const
+    {
+      return value_;
+    }
+
+  private:
+    type value_;
+  };
+
+  /// Usb device option to place a device on a context shard.
+  /**
+   * Implements choosing which of the libusb contexts configured with
+   * usb_service_options::context_shards a given usb device is opened in,
+   * overriding the service's shard policy. The index is taken modulo the
+   * number of shards. The default of -1 leaves the choice to the policy.
+   */
+  class shard
+  {
+  public:
+    explicit shard(int t = -1)
+      : value_(t)
+    {
+    }
+
+    int value() const
+    {
+      return value_;
+    }
+
+  private:
+    int value_;
+  };
+
+  /// Usb device option to permit changing the number of bulk streams.
+  /**
+   * Implements requesting bulk streams on the endpoints of a given USB 3 usb
+   * device. The streams are allocated when the device is opened and freed when
+   * it is closed. Once the device is open, the option reads the number of
+   * streams the host controller granted.
+   */
+  class stream_count
+  {
+  public:
+    explicit stream_count(std::uint32_t t = 0)
+      : value_(t)
+    {
+    }
+
+    std::uint32_t value() const
+    {
+      return value_;
+    }
+
+  private:
+    std::uint32_t value_;
+  };
+
+  /// Usb device option to record transfers into a capture.
+  /**
+   * Implements attaching a usb_capture to a given usb device. A null capture
+   * detaches the device from any capture.
+   */
+  class capture
+  {
+  public:
+    explicit capture(usb_capture* c = 0)
+      : value_(c)
+    {
+    }
+
+    usb_capture* value() const
+    {
+      return value_;
+    }
+
+  private:
+    usb_capture* value_;
+  };
+
+  /// Usb device option to bound the outstanding sends.
+  /**
+   * Implements limiting the number and the total size of the sends a given
+   * usb device has outstanding. Zero, the default, is no limit. While the
+   * device is at a limit new sends fail with boost::asio::error::would_block;
+   * producers wait with usb_device::async_wait_writable before sending.
+   */
+  class send_queue_limit
+  {
+  public:
+    explicit send_queue_limit(std::size_t operations = 0,
+        std::size_t bytes = 0)
+      : operations_(operations)
+      , bytes_(bytes)
+    {
+    }
+
+    std::size_t operations() const
+    {
+      return operations_;
+    }
+
+    std::size_t bytes() const
+    {
+      return bytes_;
+    }
+
+  private:
+    std::size_t operations_;
+    std::size_t bytes_;
+  };
+
+  /// Usb device option to bound the outstanding receives.
+  /**
+   * Implements limiting the number and the total size of the receives a
+   * given usb device has outstanding, so that a consumer cannot queue an
+   * unbounded number of reads ahead of the urgent traffic. Zero, the default,
+   * is no limit. While the device is at a limit new receives fail with
+   * boost::asio::error::would_block.
+   */
+  class receive_queue_limit
+  {
+  public:
+    explicit receive_queue_limit(std::size_t operations = 0,
+        std::size_t bytes = 0)
+      : operations_(operations)
+      , bytes_(bytes)
+    {
+    }
+
+    std::size_t operations() const
+    {
+      return operations_;
+    }
+
+    std::size_t bytes() const
+    {
+      return bytes_;
+    }
+
+  private:
+    std::size_t operations_;
+    std::size_t bytes_;
+  };
+
+  /// Usb device option to read the maximum packet size of the endpoint.
+  /**
+   * Implements querying the maximum packet size of the OUT endpoint of an
+   * open usb device. The option can only be read.
+   */
+  class max_packet_size
+  {
+  public:
+    explicit max_packet_size(int t = 0)
+      : value_(t)
+    {
+    }
+
+    int value() const
+    {
+      return value_;
+    }
+
+  private:
+    friend class detail::usb_device_service;
+
+    int value_;
+  };
+
 protected:
   /// Protected destructor to prevent deletion through this type.
   ~usb_device_base()
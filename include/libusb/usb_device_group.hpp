@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Sends the same data to a group of usb devices.
+/**
+ * A usb_device_group issues one logical send to all of its members from a
+ * single buffer. The sends to the members are started together; one handler
+ * receives the result of every member once all of them completed.
+ *
+ * The sends only progress concurrently when the usb device service runs in
+ * usb_service_options::event_thread or busy_poll mode. In the default
+ * resolver_thread mode they are performed one after another, so the group
+ * takes as long as sending to each member in turn.
+ *
+ * The member devices must outlive the group and every send in progress.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+template <typename Device>
+class usb_device_group
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// The result of a send to one member.
+  struct result
+  {
+    /// The member the result belongs to.
+    Device* device;
+
+    /// The result of the send.
+    boost::system::error_code error;
+
+    /// The number of bytes sent.
+    std::size_t bytes_transferred;
+  };
+
+  /// The results of a send, in member order.
+  typedef std::vector<result> results_type;
+
+  /// Construct an empty group.
+  /**
+   * @param ex The executor on which handlers are invoked by default.
+   */
+  explicit usb_device_group(const executor_type& ex)
+    : executor_(ex)
+  {
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return executor_;
+  }
+
+  /// Add a usb device to the group.
+  /**
+   * Sends in progress are not affected.
+   */
+  void add(Device& device)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_.push_back(&device);
+  }
+
+  /// Remove a usb device from the group.
+  /**
+   * Sends in progress are not affected.
+   */
+  void remove(Device& device)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_.erase(std::remove(members_.begin(), members_.end(), &device),
+        members_.end());
+  }
+
+  /// Get the number of members.
+  std::size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return members_.size();
+  }
+
+  /// Start an asynchronous send to all members.
+  /**
+   * @param data The data to be sent. The group holds a reference until all
+   * members completed. If it is null, the handler is called with
+   * boost::asio::error::invalid_argument and no results.
+   *
+   * @param handler The handler to be called when all members completed. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // First error, if any.
+   *   results_type results                    // Result of every member.
+   * ); @endcode
+   */
+  template <typename SendHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(SendHandler,
+      void (boost::system::error_code, results_type))
+  async_send(std::shared_ptr<const std::vector<unsigned char> > data,
+      BOOST_ASIO_MOVE_ARG(SendHandler) handler)
+  {
+    if (!data)
+    {
+      return asio::async_initiate<SendHandler,
+        void (boost::system::error_code, results_type)>(
+          initiate_failed_send(), handler, this,
+          boost::system::error_code(asio::error::invalid_argument));
+    }
+
+    asio::const_buffer buffer(asio::buffer(*data));
+    return asio::async_initiate<SendHandler,
+      void (boost::system::error_code, results_type)>(
+        initiate_async_send(), handler, this, buffer,
+        std::shared_ptr<const void>(std::move(data)));
+  }
+
+  /// Start an asynchronous send to all members.
+  /**
+   * @param buffer The data to be sent. Ownership of the underlying memory is
+   * retained by the caller, which must guarantee that it remains valid until
+   * the handler is called.
+   *
+   * @param handler The handler to be called when all members completed. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // First error, if any.
+   *   results_type results                    // Result of every member.
+   * ); @endcode
+   */
+  template <typename SendHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(SendHandler,
+      void (boost::system::error_code, results_type))
+  async_send(const asio::const_buffer& buffer,
+      BOOST_ASIO_MOVE_ARG(SendHandler) handler)
+  {
+    return asio::async_initiate<SendHandler,
+      void (boost::system::error_code, results_type)>(
+        initiate_async_send(), handler, this, buffer,
+        std::shared_ptr<const void>());
+  }
+
+private:
+  typedef detail::erased_handler<boost::system::error_code, results_type>
+    handler_type;
+
+  // State shared by the member sends of one logical send.
+  struct fan_out
+  {
+    fan_out(handler_type handler, std::shared_ptr<const void> data,
+        std::size_t count)
+      : handler_(std::move(handler))
+      , data_(std::move(data))
+      , results_(count)
+      , remaining_(count)
+    {
+    }
+
+    void complete(std::size_t index, const boost::system::error_code& ec,
+        std::size_t n)
+    {
+      results_[index].error = ec;
+      results_[index].bytes_transferred = n;
+      if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        finish();
+    }
+
+    void finish()
+    {
+      boost::system::error_code ec;
+      for (auto& r : results_)
+      {
+        if (r.error)
+        {
+          ec = r.error;
+          break;
+        }
+      }
+      data_.reset();
+      handler_(ec, std::move(results_));
+    }
+
+    handler_type handler_;
+    std::shared_ptr<const void> data_;
+    results_type results_;
+    std::atomic<std::size_t> remaining_;
+  };
+
+  // Disallow copying and assignment.
+  usb_device_group(const usb_device_group&) BOOST_ASIO_DELETED;
+  usb_device_group& operator=(const usb_device_group&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_send
+  {
+    template <typename SendHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(SendHandler) handler,
+        usb_device_group* self, const asio::const_buffer& buffer,
+        const std::shared_ptr<const void>& data) const
+    {
+      std::vector<Device*> members;
+      {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        members = self->members_;
+      }
+
+      auto f(std::make_shared<fan_out>(
+            handler_type(BOOST_ASIO_MOVE_CAST(SendHandler)(handler),
+              self->executor_), data, members.size()));
+      for (std::size_t i = 0; i < members.size(); ++i)
+        f->results_[i].device = members[i];
+
+      if (members.empty())
+      {
+        f->finish();
+        return;
+      }
+
+      for (std::size_t i = 0; i < members.size(); ++i)
+      {
+        members[i]->async_send(buffer,
+            [f, i](const boost::system::error_code& ec, std::size_t n)
+            {
+              f->complete(i, ec, n);
+            });
+      }
+    }
+  };
+
+  struct initiate_failed_send
+  {
+    template <typename SendHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(SendHandler) handler,
+        usb_device_group* self, const boost::system::error_code& ec) const
+    {
+      handler_type h(BOOST_ASIO_MOVE_CAST(SendHandler)(handler),
+          self->executor_);
+      h(ec, results_type());
+    }
+  };
+
+  executor_type executor_;
+  mutable std::mutex mutex_;
+  std::vector<Device*> members_;
+};
+
+} // namespace libusb
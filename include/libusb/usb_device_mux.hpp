@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Receives from many usb devices into a single queue.
+/**
+ * A usb_device_mux keeps reads armed on every member device. Each completed
+ * read becomes an event carrying the member id and a view of the received
+ * data; the events of all members are queued in completion order and drained
+ * by the consumer in batches.
+ *
+ * The buffers viewed by drained events remain valid until the next drain,
+ * which re-arms the reads into them. Members may be added and removed at any
+ * time without affecting the reads of the others. Reads armed on a removed
+ * member complete once the device is closed; their data is discarded.
+ *
+ * The member devices must outlive their membership.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe. Only one drain may be outstanding at a time.
+ */
+template <typename Device>
+class usb_device_mux
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// A completed read.
+  struct event
+  {
+    /// The id of the member the data was received from.
+    std::size_t id;
+
+    /// The received data, valid until the next drain.
+    asio::const_buffer data;
+
+    /// The result of the read. A member stops receiving into a buffer whose
+    /// read failed.
+    boost::system::error_code error;
+  };
+
+  /// Construct an empty multiplexer.
+  /**
+   * @param ex The executor on which handlers are invoked by default.
+   *
+   * @param max_batch The maximum number of events returned by one drain.
+   */
+  explicit usb_device_mux(const executor_type& ex,
+      std::size_t max_batch = 64)
+    : state_(std::make_shared<state>(ex, max_batch))
+  {
+  }
+
+  /// Destroys the multiplexer.
+  /**
+   * An outstanding drain completes with boost::asio::error::operation_aborted.
+   */
+  ~usb_device_mux()
+  {
+    state_->abort();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->executor_;
+  }
+
+  /// Add a usb device and arm reads on it.
+  /**
+   * @param device The usb device to receive from.
+   *
+   * @param buffer_size The size of each read.
+   *
+   * @param depth The number of reads kept armed on the device.
+   *
+   * @returns The id identifying the member in events.
+   */
+  std::size_t add(Device& device, std::size_t buffer_size = 64,
+      std::size_t depth = 2)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->add(device, buffer_size, depth ? depth : 1);
+  }
+
+  /// Remove a member.
+  /**
+   * Queued events of the member are discarded.
+   */
+  void remove(std::size_t id)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    state_->remove(id);
+  }
+
+  /// Get the number of members.
+  std::size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->members_.size();
+  }
+
+  /// Drain queued events without waiting.
+  /**
+   * @param events Replaced by up to max_batch queued events.
+   *
+   * @returns The number of events drained.
+   */
+  std::size_t drain(std::vector<event>& events)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->drain(events);
+  }
+
+  /// Start an asynchronous drain.
+  /**
+   * This function waits until at least one event is queued and drains up to
+   * max_batch events. The function call always returns immediately.
+   *
+   * @param events Replaced by the drained events. Ownership is retained by the
+   * caller, which must guarantee that it remains valid until the handler is
+   * called.
+   *
+   * @param handler The handler to be called when events were drained. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t count                       // Number of events drained.
+   * ); @endcode
+   */
+  template <typename DrainHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(DrainHandler,
+      void (boost::system::error_code, std::size_t))
+  async_drain(std::vector<event>& events,
+      BOOST_ASIO_MOVE_ARG(DrainHandler) handler)
+  {
+    return asio::async_initiate<DrainHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_drain(), handler, state_, &events);
+  }
+
+private:
+  typedef detail::erased_handler<boost::system::error_code, std::size_t>
+    handler_type;
+
+  struct member
+  {
+    Device* device_;
+    std::size_t id_;
+    bool removed_;
+    std::vector<std::vector<unsigned char> > buffers_;
+  };
+
+  // A completed read whose buffer is queued or held by the consumer.
+  struct completion
+  {
+    std::shared_ptr<member> member_;
+    std::size_t index_;
+    std::size_t size_;
+    boost::system::error_code ec_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(const executor_type& ex, std::size_t max_batch)
+      : executor_(ex)
+      , max_batch_(max_batch ? max_batch : 1)
+      , next_id_(0)
+      , events_(0)
+      , aborted_(false)
+    {
+    }
+
+    // Called with the mutex held.
+    std::size_t add(Device& device, std::size_t buffer_size,
+        std::size_t depth)
+    {
+      auto m(std::make_shared<member>());
+      m->device_ = &device;
+      m->id_ = next_id_++;
+      m->removed_ = false;
+      m->buffers_.assign(depth, std::vector<unsigned char>(buffer_size));
+      members_.emplace(m->id_, m);
+
+      for (std::size_t i = 0; i < depth; ++i)
+        read(m, i);
+      return m->id_;
+    }
+
+    // Called with the mutex held.
+    void remove(std::size_t id)
+    {
+      auto it = members_.find(id);
+      if (it == members_.end())
+        return;
+
+      it->second->removed_ = true;
+      members_.erase(it);
+
+      ready_.erase(std::remove_if(ready_.begin(), ready_.end(),
+            [id](const completion& c) { return c.member_->id_ == id; }),
+          ready_.end());
+    }
+
+    void read(const std::shared_ptr<member>& m, std::size_t index)
+    {
+      auto self(this->shared_from_this());
+      m->device_->async_receive(asio::buffer(m->buffers_[index]),
+          [self, m, index](const boost::system::error_code& ec,
+            std::size_t n)
+          {
+            self->on_read(m, index, ec, n);
+          });
+    }
+
+    void on_read(const std::shared_ptr<member>& m, std::size_t index,
+        const boost::system::error_code& ec, std::size_t n)
+    {
+      handler_type handler;
+      std::size_t count = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (m->removed_ || aborted_)
+          return;
+
+        ready_.push_back(completion{ m, index, n, ec });
+        if (!handler_)
+          return;
+
+        count = drain(*events_);
+        handler = std::move(handler_);
+      }
+
+      handler(boost::system::error_code(), count);
+    }
+
+    // Release the buffers of the previous batch and move the next batch to
+    // events. Called with the mutex held.
+    std::size_t drain(std::vector<event>& events)
+    {
+      for (auto& c : held_)
+        if (!c.member_->removed_ && !c.ec_)
+          read(c.member_, c.index_);
+      held_.clear();
+
+      events.clear();
+      while (!ready_.empty() && events.size() < max_batch_)
+      {
+        completion& c = ready_.front();
+        events.push_back(event{ c.member_->id_,
+            asio::const_buffer(c.member_->buffers_[c.index_].data(), c.size_),
+            c.ec_ });
+        held_.push_back(std::move(c));
+        ready_.pop_front();
+      }
+      return events.size();
+    }
+
+    void abort()
+    {
+      handler_type handler;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        handler = std::move(handler_);
+        for (auto& m : members_)
+          m.second->removed_ = true;
+      }
+
+      if (handler)
+        handler(asio::error::operation_aborted, 0);
+    }
+
+    executor_type executor_;
+    std::size_t max_batch_;
+    std::size_t next_id_;
+    mutable std::mutex mutex_;
+    std::map<std::size_t, std::shared_ptr<member> > members_;
+    std::deque<completion> ready_;
+    std::vector<completion> held_;
+    handler_type handler_;
+    std::vector<event>* events_;
+    bool aborted_;
+  };
+
+  // Disallow copying and assignment.
+  usb_device_mux(const usb_device_mux&) BOOST_ASIO_DELETED;
+  usb_device_mux& operator=(const usb_device_mux&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_drain
+  {
+    template <typename DrainHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(DrainHandler) handler,
+        const std::shared_ptr<state>& s, std::vector<event>* events) const
+    {
+      handler_type h(BOOST_ASIO_MOVE_CAST(DrainHandler)(handler),
+          s->executor_);
+
+      std::unique_lock<std::mutex> lock(s->mutex_);
+      if (s->handler_)
+      {
+        lock.unlock();
+        h(asio::error::in_progress, 0);
+        return;
+      }
+
+      std::size_t count = s->drain(*events);
+      if (count == 0)
+      {
+        s->events_ = events;
+        s->handler_ = std::move(h);
+        return;
+      }
+      lock.unlock();
+
+      h(boost::system::error_code(), count);
+    }
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <boost/asio.hpp>
+#include <libusb.h>
+#include "libusb/usb_device.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Provides transfers on an endpoint fixed at compile time.
+/**
+ * The usb_endpoint class template binds an endpoint address, transfer type
+ * and maximum packet size of a usb_device at compile time. Transfers started
+ * through it do not consult the usb_device_base::endpoint_address option and
+ * fill the libusb transfer with constants. The direction is part of the
+ * address, so sending on an IN endpoint or receiving on an OUT endpoint does
+ * not compile. Receives into fixed-size arrays are checked to be a whole
+ * number of packets.
+ *
+ * An endpoint does not own the device; the usb_device must be open and
+ * outlive the endpoint.
+ *
+ * @code
+ * typedef libusb::usb_endpoint<0x81, LIBUSB_TRANSFER_TYPE_INTERRUPT, 64>
+ *   status_endpoint;
+ * status_endpoint status(device);
+ * std::array<unsigned char, 64> report;
+ * status.async_receive(report, handler);
+ * @endcode
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe, as for the usb_device.
+ */
+template <std::uint8_t Address, enum libusb_transfer_type Type,
+         std::size_t MaxPacket,
+         typename Executor = asio::io_context::executor_type>
+class usb_endpoint
+{
+  static_assert(Type == LIBUSB_TRANSFER_TYPE_BULK
+      || Type == LIBUSB_TRANSFER_TYPE_INTERRUPT,
+      "usb_endpoint supports bulk and interrupt endpoints");
+  static_assert((Address & LIBUSB_ENDPOINT_ADDRESS_MASK) != 0
+      && (Address & ~(LIBUSB_ENDPOINT_ADDRESS_MASK | LIBUSB_ENDPOINT_DIR_MASK))
+        == 0,
+      "invalid endpoint address");
+  static_assert(MaxPacket > 0 && MaxPacket <= 1024,
+      "invalid maximum packet size");
+
+public:
+  /// The type of the executor associated with the object.
+  typedef Executor executor_type;
+
+  /// The type of the usb device the endpoint belongs to.
+  typedef usb_device<Executor> device_type;
+
+  /// The endpoint address, including the direction bit.
+  static constexpr std::uint8_t address = Address;
+
+  /// Whether the endpoint is an IN endpoint.
+  static constexpr bool is_in = (Address & LIBUSB_ENDPOINT_IN) != 0;
+
+  /// The transfer type of the endpoint.
+  static constexpr enum libusb_transfer_type transfer_type = Type;
+
+  /// The maximum packet size of the endpoint.
+  static constexpr std::size_t max_packet_size = MaxPacket;
+
+  /// Get the number of packets needed to transfer size bytes.
+  static constexpr std::size_t packets(std::size_t size)
+  {
+    return (size + MaxPacket - 1) / MaxPacket;
+  }
+
+  /// Construct an endpoint of a usb device.
+  /**
+   * @param device The usb device the endpoint belongs to.
+   */
+  explicit usb_endpoint(device_type& device)
+    : device_(device)
+  {
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return device_.get_executor();
+  }
+
+  /// Get the usb device the endpoint belongs to.
+  device_type& device()
+  {
+    return device_;
+  }
+
+  /// Start an asynchronous send on an OUT endpoint.
+  /**
+   * @param buffers The data to be written to the endpoint. Ownership of the
+   * underlying memory is retained by the caller, which must guarantee that it
+   * remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the send operation
+   * completes. The function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send(const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    static_assert(!is_in, "cannot send on an IN endpoint");
+
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transfer(), handler, &device_, buffers, false, 0);
+  }
+
+  /// Start an asynchronous receive on an IN endpoint.
+  /**
+   * @param buffers The buffer into which the data will be received. Ownership
+   * of the underlying memory is retained by the caller, which must guarantee
+   * that it remains valid until the handler is called. Its size should be a
+   * multiple of the maximum packet size, as the device may otherwise send
+   * more than fits and the transfer fails with an overflow.
+   *
+   * @param handler The handler to be called when the receive operation
+   * completes. The function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes received.
+   * ); @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive(const MutableBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    static_assert(is_in, "cannot receive on an OUT endpoint");
+
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transfer(), handler, &device_, buffers, false, 0);
+  }
+
+  /// Start an asynchronous receive into an array of whole packets.
+  template <std::size_t N, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive(std::array<unsigned char, N>& data,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    static_assert(N > 0 && N % MaxPacket == 0,
+        "receive size must be a multiple of the maximum packet size");
+
+    return async_receive(asio::buffer(data),
+        BOOST_ASIO_MOVE_CAST(ReadHandler)(handler));
+  }
+
+  /// Start an asynchronous receive into an array of whole packets.
+  template <std::size_t N, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive(unsigned char (&data)[N],
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    static_assert(N % MaxPacket == 0,
+        "receive size must be a multiple of the maximum packet size");
+
+    return async_receive(asio::buffer(data),
+        BOOST_ASIO_MOVE_CAST(ReadHandler)(handler));
+  }
+
+  /// Start an asynchronous send on a bulk stream of an OUT endpoint.
+  /**
+   * The streams must have been requested with the
+   * usb_device_base::stream_count option before the device was opened.
+   *
+   * @param stream_id The stream to send on, from 1 to the number of streams
+   * granted. Other ids fail with boost::asio::error::invalid_argument.
+   *
+   * @param buffers The data to be written to the endpoint. Ownership of the
+   * underlying memory is retained by the caller, which must guarantee that it
+   * remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the send operation
+   * completes. The function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send_stream(std::uint32_t stream_id,
+      const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    static_assert(!is_in, "cannot send on an IN endpoint");
+    static_assert(Type == LIBUSB_TRANSFER_TYPE_BULK,
+        "streams exist on bulk endpoints only");
+
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transfer(), handler, &device_, buffers, true,
+        stream_id);
+  }
+
+  /// Start an asynchronous receive on a bulk stream of an IN endpoint.
+  /**
+   * The streams must have been requested with the
+   * usb_device_base::stream_count option before the device was opened.
+   *
+   * @param stream_id The stream to receive on, from 1 to the number of
+   * streams granted. Other ids fail with boost::asio::error::invalid_argument.
+   *
+   * @param buffers The buffer into which the data will be received. Ownership
+   * of the underlying memory is retained by the caller, which must guarantee
+   * that it remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the receive operation
+   * completes. The function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes received.
+   * ); @endcode
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler,
+      void (boost::system::error_code, std::size_t))
+  async_receive_stream(std::uint32_t stream_id,
+      const MutableBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    static_assert(is_in, "cannot receive on an OUT endpoint");
+    static_assert(Type == LIBUSB_TRANSFER_TYPE_BULK,
+        "streams exist on bulk endpoints only");
+
+    return asio::async_initiate<ReadHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transfer(), handler, &device_, buffers, true,
+        stream_id);
+  }
+
+private:
+  struct initiate_async_transfer
+  {
+    template <typename Handler, typename BufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler,
+        device_type* device, const BufferSequence& buffers, bool stream,
+        std::uint32_t stream_id) const
+    {
+      BOOST_ASIO_READ_HANDLER_CHECK(Handler, handler) type_check;
+
+      asio::detail::non_const_lvalue<Handler> handler2(handler);
+      device->impl_.get_service().template async_endpoint_transfer<
+        Address, Type>(device->impl_.get_implementation(), buffers,
+            handler2.value, device->impl_.get_implementation_executor(),
+            stream, stream_id);
+    }
+  };
+
+  device_type& device_;
+};
+
+} // namespace libusb
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <boost/asio.hpp>
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Paces the sends to a usb device to a byte rate.
+/**
+ * A usb_paced_writer releases sends to the usb device according to a token
+ * bucket: tokens accrue at the configured rate up to the burst size, and a
+ * send is submitted once the bucket holds as many tokens as the send has
+ * bytes, or is full. A send larger than the burst size therefore waits for a
+ * full bucket and leaves the bucket in debt. Sends are released in order;
+ * time is taken from the monotonic steady clock and waiting is done with a
+ * timer on the device's executor.
+ *
+ * A device consuming output at a fixed rate, paced slightly above that rate,
+ * no longer NAKs a flood of queued transfers, leaving the bus bandwidth to
+ * other devices on the same controller. Each writer paces one device; give
+ * every device on a controller its own writer with its share of the rate.
+ *
+ * The device must outlive the writer.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+template <typename Device>
+class usb_paced_writer
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// Construct a paced writer on a usb device.
+  /**
+   * @param device The usb device to send to.
+   *
+   * @param rate The sustained rate in bytes per second.
+   *
+   * @param burst The size of the token bucket in bytes. The bucket starts
+   * full, so up to this many bytes are sent at once.
+   */
+  usb_paced_writer(Device& device, std::uint64_t rate, std::size_t burst)
+    : state_(std::make_shared<state>(device, rate, burst))
+  {
+  }
+
+  /// Destroys the writer.
+  /**
+   * Sends that have not been released yet complete with
+   * boost::asio::error::operation_aborted.
+   */
+  ~usb_paced_writer()
+  {
+    state_->abort();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->device_.get_executor();
+  }
+
+  /// Start an asynchronous paced send.
+  /**
+   * This function queues the send until the token bucket allows it. The
+   * function call always returns immediately.
+   *
+   * @param buffers The data to be written to the usb device, as a single
+   * buffer; a sequence of more than one buffer does not compile. Ownership of
+   * the underlying memory is retained by the caller, which must guarantee that
+   * it remains valid until the handler is called.
+   *
+   * @param handler The handler to be called when the send completes. The
+   * function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Number of bytes written.
+   * ); @endcode
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler,
+      void (boost::system::error_code, std::size_t))
+  async_send(const ConstBufferSequence& buffers,
+      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    static_assert(
+        std::is_convertible<ConstBufferSequence, asio::const_buffer>::value,
+        "ConstBufferSequence must be a single buffer");
+    return asio::async_initiate<WriteHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_send(), handler, state_, asio::const_buffer(buffers));
+  }
+
+  /// Get the rate in bytes per second.
+  std::uint64_t rate() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->rate_;
+  }
+
+  /// Change the rate in bytes per second.
+  /**
+   * Tokens accrued so far are kept. A rate of zero holds all sends back
+   * until the rate is raised again.
+   */
+  void rate(std::uint64_t bytes_per_second)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    state_->refill(clock_type::now());
+    state_->rate_ = bytes_per_second;
+
+    // A timer armed for the old rate reschedules the release when cancelled.
+    if (state_->timer_armed_)
+      state_->timer_.cancel();
+    else
+      state_->release();
+  }
+
+  /// Get the number of sends waiting to be released.
+  std::size_t queued() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->queue_.size();
+  }
+
+private:
+  typedef std::chrono::steady_clock clock_type;
+
+  typedef detail::erased_handler<boost::system::error_code, std::size_t>
+    handler_type;
+
+  typedef asio::basic_waitable_timer<clock_type,
+    asio::wait_traits<clock_type>, executor_type> timer_type;
+
+  struct pending
+  {
+    asio::const_buffer buffer_;
+    handler_type handler_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(Device& device, std::uint64_t rate, std::size_t burst)
+      : device_(device)
+      , rate_(rate)
+      , burst_(burst ? static_cast<double>(burst) : 1.0)
+      , tokens_(burst_)
+      , last_(clock_type::now())
+      , timer_(device.get_executor())
+      , timer_armed_(false)
+      , stopped_(false)
+    {
+    }
+
+    // Add the tokens accrued since the last refill. Called with the mutex
+    // held.
+    void refill(clock_type::time_point now)
+    {
+      std::chrono::duration<double> elapsed = now - last_;
+      last_ = now;
+      tokens_ += elapsed.count() * static_cast<double>(rate_);
+      if (tokens_ > burst_)
+        tokens_ = burst_;
+    }
+
+    // Submit the sends the bucket allows and arm the timer for the next one.
+    // Called with the mutex held, so that the sends reach the device in
+    // order.
+    void release()
+    {
+      refill(clock_type::now());
+
+      auto self(this->shared_from_this());
+      while (!queue_.empty())
+      {
+        double size = static_cast<double>(queue_.front().buffer_.size());
+        double needed = size < burst_ ? size : burst_;
+        if (tokens_ < needed)
+          break;
+        tokens_ -= size;
+
+        std::shared_ptr<handler_type> h(
+            std::make_shared<handler_type>(std::move(queue_.front().handler_)));
+        asio::const_buffer buffer(queue_.front().buffer_);
+        queue_.pop_front();
+        device_.async_send(buffer,
+            [self, h](const boost::system::error_code& ec, std::size_t n)
+            {
+              (*h)(ec, n);
+            });
+      }
+
+      if (!queue_.empty() && !timer_armed_ && rate_ != 0)
+      {
+        double size = static_cast<double>(queue_.front().buffer_.size());
+        double needed = (size < burst_ ? size : burst_) - tokens_;
+        std::chrono::nanoseconds wait(static_cast<std::int64_t>(
+              needed * 1e9 / static_cast<double>(rate_)) + 1);
+
+        timer_armed_ = true;
+        timer_.expires_after(wait);
+        timer_.async_wait([self](const boost::system::error_code&)
+            {
+              self->on_timer();
+            });
+      }
+    }
+
+    void on_timer()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      timer_armed_ = false;
+      if (!stopped_)
+        release();
+    }
+
+    void abort()
+    {
+      std::deque<pending> aborted;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        aborted.swap(queue_);
+        if (timer_armed_)
+          timer_.cancel();
+      }
+
+      for (auto& p : aborted)
+        p.handler_(asio::error::operation_aborted, 0);
+    }
+
+    Device& device_;
+    mutable std::mutex mutex_;
+    std::uint64_t rate_;
+    double burst_;
+    double tokens_;
+    clock_type::time_point last_;
+    std::deque<pending> queue_;
+    timer_type timer_;
+    bool timer_armed_;
+    bool stopped_;
+  };
+
+  // Disallow copying and assignment.
+  usb_paced_writer(const usb_paced_writer&) BOOST_ASIO_DELETED;
+  usb_paced_writer& operator=(const usb_paced_writer&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_send
+  {
+    template <typename WriteHandler>
+    void operator()(BOOST_ASIO_MOVE_ARG(WriteHandler) handler,
+        const std::shared_ptr<state>& s,
+        const asio::const_buffer& buffer) const
+    {
+      handler_type h(BOOST_ASIO_MOVE_CAST(WriteHandler)(handler),
+          s->device_.get_executor());
+
+      std::lock_guard<std::mutex> lock(s->mutex_);
+      s->queue_.push_back(pending{ buffer, std::move(h) });
+      s->release();
+    }
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "libusb/detail/erased_handler.hpp"
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Pipelined request/response transactions over a usb device.
+/**
+ * A usb_pipeline sends commands on the OUT endpoint of a usb device and
+ * matches the replies arriving on the IN endpoint to the waiting transactions
+ * by a tag. Any number of transactions may be outstanding at once. A fixed
+ * number of reads is kept armed on the IN endpoint; each reply is passed to
+ * the tag extractor, which has the signature
+ * @code bool extractor(
+ *   asio::const_buffer reply, // The received reply.
+ *   Tag& tag                  // Set to the tag of the reply.
+ * ); @endcode
+ * and returns false if the reply carries no valid tag. Replies that match no
+ * outstanding transaction are discarded and counted.
+ *
+ * Commands and reads are only in flight concurrently when the usb device
+ * service runs in usb_service_options::event_thread or busy_poll mode. In the
+ * default resolver_thread mode transfers are performed one after another, so
+ * an armed read blocks all following commands.
+ *
+ * The device must outlive the pipeline. Reads stay armed once started; use
+ * the device's cancel() or close() to stop them. A read failing with
+ * boost::asio::error::operation_aborted or no_such_device fails all
+ * outstanding transactions. A read failing with another error only stops
+ * that read, which the next transaction re-arms; the outstanding
+ * transactions are then bounded by their timeouts.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+template <typename Device, typename Tag,
+    typename TagExtractor = std::function<bool (asio::const_buffer, Tag&)> >
+class usb_pipeline
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// The type of the transaction tags.
+  typedef Tag tag_type;
+
+  /// The clock used for transaction timeouts.
+  typedef std::chrono::steady_clock clock_type;
+
+  /// Construct a pipeline on a usb device.
+  /**
+   * @param device The usb device carrying commands and replies.
+   *
+   * @param extractor The function object extracting the tag from a reply.
+   *
+   * @param reply_size The size of each read buffer. Must be at least the size
+   * of the largest reply.
+   *
+   * @param read_depth The number of reads kept armed on the IN endpoint.
+   */
+  usb_pipeline(Device& device, TagExtractor extractor,
+      std::size_t reply_size = 512, std::size_t read_depth = 4)
+    : state_(std::make_shared<state>(device, std::move(extractor),
+          reply_size, read_depth))
+  {
+  }
+
+  /// Destroys the pipeline.
+  /**
+   * Outstanding transactions complete with
+   * boost::asio::error::operation_aborted.
+   */
+  ~usb_pipeline()
+  {
+    cancel();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->device_.get_executor();
+  }
+
+  /// Start an asynchronous transaction.
+  /**
+   * This function sends a command and waits for the reply carrying the given
+   * tag. The function call always returns immediately.
+   *
+   * @param tag The tag of the expected reply. Only one transaction per tag may
+   * be outstanding.
+   *
+   * @param command One or more buffers holding the command. Ownership of the
+   * underlying memory is retained by the caller, which must guarantee that it
+   * remains valid until the handler is called.
+   *
+   * @param reply The buffer into which the reply is copied.
+   *
+   * @param timeout The time after which the transaction fails with
+   * boost::asio::error::timed_out.
+   *
+   * @param handler The handler to be called when the transaction completes.
+   * The function signature of the handler must be:
+   * @code void handler(
+   *   const boost::system::error_code& error, // Result of operation.
+   *   std::size_t bytes_transferred           // Size of the reply.
+   * ); @endcode
+   * A reply that does not fit into @c reply is truncated and completes with
+   * boost::asio::error::message_size.
+   */
+  template <typename ConstBufferSequence, typename TransactHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(TransactHandler,
+      void (boost::system::error_code, std::size_t))
+  async_transact(const tag_type& tag, const ConstBufferSequence& command,
+      const asio::mutable_buffer& reply, clock_type::duration timeout,
+      BOOST_ASIO_MOVE_ARG(TransactHandler) handler)
+  {
+    return asio::async_initiate<TransactHandler,
+      void (boost::system::error_code, std::size_t)>(
+        initiate_async_transact(), handler, state_, tag, command, reply,
+        timeout);
+  }
+
+  /// Cancel all outstanding transactions.
+  /**
+   * The handlers of outstanding transactions are passed the
+   * boost::asio::error::operation_aborted error.
+   */
+  void cancel()
+  {
+    state_->fail_all(asio::error::operation_aborted);
+  }
+
+  /// Get the number of outstanding transactions.
+  std::size_t pending() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->pending_.size();
+  }
+
+  /// Get the number of replies that matched no outstanding transaction.
+  std::size_t unmatched() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->unmatched_;
+  }
+
+private:
+  typedef detail::erased_handler<boost::system::error_code, std::size_t>
+    handler_type;
+
+  typedef asio::basic_waitable_timer<clock_type,
+    asio::wait_traits<clock_type>, executor_type> timer_type;
+
+  struct transaction
+  {
+    std::uint64_t id_;
+    asio::mutable_buffer reply_;
+    handler_type handler_;
+    std::unique_ptr<timer_type> timer_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(Device& device, TagExtractor extractor, std::size_t reply_size,
+        std::size_t read_depth)
+      : device_(device)
+      , extractor_(std::move(extractor))
+      , buffers_(read_depth, std::vector<unsigned char>(reply_size))
+      , armed_(read_depth, false)
+      , next_id_(0)
+      , unmatched_(0)
+    {
+    }
+
+    // Mark the reads that are not armed as armed and get their buffers, to be
+    // read into once the mutex is released. Called with the mutex held.
+    std::vector<std::size_t> take_stopped()
+    {
+      std::vector<std::size_t> stopped;
+      for (std::size_t i = 0; i < armed_.size(); ++i)
+      {
+        if (!armed_[i])
+        {
+          armed_[i] = true;
+          stopped.push_back(i);
+        }
+      }
+      return stopped;
+    }
+
+    void read(std::size_t index)
+    {
+      auto self(this->shared_from_this());
+      device_.async_receive(asio::buffer(buffers_[index]),
+          [self, index](const boost::system::error_code& ec, std::size_t n)
+          {
+            self->on_read(index, ec, n);
+          });
+    }
+
+    void on_read(std::size_t index, const boost::system::error_code& ec,
+        std::size_t n)
+    {
+      if (ec)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          armed_[index] = false;
+        }
+        if (ec == asio::error::operation_aborted
+            || ec == boost::system::errc::no_such_device)
+          fail_all(ec);
+        return;
+      }
+
+      asio::const_buffer reply(buffers_[index].data(), n);
+      tag_type tag;
+      transaction t;
+      bool found = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (extractor_(reply, tag))
+        {
+          auto it = pending_.find(tag);
+          if (it != pending_.end())
+          {
+            t = std::move(it->second);
+            pending_.erase(it);
+            found = true;
+          }
+        }
+        if (!found)
+          ++unmatched_;
+      }
+
+      if (found)
+      {
+        std::size_t copied = asio::buffer_copy(t.reply_, reply);
+        boost::system::error_code result;
+        if (copied < n)
+          result = asio::error::message_size;
+        t.handler_(result, copied);
+      }
+
+      read(index);
+    }
+
+    void on_timeout(const tag_type& tag, std::uint64_t id,
+        const boost::system::error_code& ec)
+    {
+      if (ec == asio::error::operation_aborted)
+        return;
+
+      transaction t;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_.find(tag);
+        if (it == pending_.end() || it->second.id_ != id)
+          return;
+        t = std::move(it->second);
+        pending_.erase(it);
+      }
+
+      t.handler_(asio::error::timed_out, 0);
+    }
+
+    void on_send(const tag_type& tag, std::uint64_t id,
+        const boost::system::error_code& ec)
+    {
+      if (!ec)
+        return;
+
+      transaction t;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_.find(tag);
+        if (it == pending_.end() || it->second.id_ != id)
+          return;
+        t = std::move(it->second);
+        pending_.erase(it);
+      }
+
+      t.handler_(ec, 0);
+    }
+
+    void fail_all(const boost::system::error_code& ec)
+    {
+      std::map<tag_type, transaction> failed;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failed.swap(pending_);
+      }
+
+      for (auto& t : failed)
+        t.second.handler_(ec, 0);
+    }
+
+    Device& device_;
+    TagExtractor extractor_;
+    std::vector<std::vector<unsigned char> > buffers_;
+    mutable std::mutex mutex_;
+    std::map<tag_type, transaction> pending_;
+    std::vector<bool> armed_;
+    std::uint64_t next_id_;
+    std::size_t unmatched_;
+  };
+
+  // Disallow copying and assignment.
+  usb_pipeline(const usb_pipeline&) BOOST_ASIO_DELETED;
+  usb_pipeline& operator=(const usb_pipeline&) BOOST_ASIO_DELETED;
+
+  struct initiate_async_transact
+  {
+    template <typename TransactHandler, typename ConstBufferSequence>
+    void operator()(BOOST_ASIO_MOVE_ARG(TransactHandler) handler,
+        const std::shared_ptr<state>& s, const tag_type& tag,
+        const ConstBufferSequence& command, const asio::mutable_buffer& reply,
+        clock_type::duration timeout) const
+    {
+      executor_type ex(s->device_.get_executor());
+      handler_type h(BOOST_ASIO_MOVE_CAST(TransactHandler)(handler), ex);
+
+      transaction t;
+      std::vector<std::size_t> stopped;
+      {
+        std::lock_guard<std::mutex> lock(s->mutex_);
+        if (s->pending_.count(tag))
+        {
+          h(asio::error::in_progress, 0);
+          return;
+        }
+
+        t.id_ = s->next_id_++;
+        t.reply_ = reply;
+        t.handler_ = std::move(h);
+        t.timer_.reset(new timer_type(ex, timeout));
+        t.timer_->async_wait(
+            [s, tag, id = t.id_](const boost::system::error_code& ec)
+            {
+              s->on_timeout(tag, id, ec);
+            });
+
+        std::uint64_t id = t.id_;
+        s->pending_.emplace(tag, std::move(t));
+
+        s->device_.async_send(command,
+            [s, tag, id](const boost::system::error_code& ec, std::size_t)
+            {
+              s->on_send(tag, id, ec);
+            });
+
+        stopped = s->take_stopped();
+      }
+
+      for (std::size_t index : stopped)
+        s->read(index);
+    }
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
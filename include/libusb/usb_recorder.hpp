@@ -0,0 +1,427 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+/// Records the data of an IN endpoint to disk.
+/**
+ * A usb_recorder rotates a fixed set of page-aligned buffers between reads on
+ * the device and writes to a file, so memory use is bounded and received data
+ * is never copied. Reads are armed into every free buffer; each completed
+ * read is handed to a background thread that writes it to the file and then
+ * re-arms the buffer. When the disk falls behind, fewer reads stay armed
+ * until the writes catch up (see starved()).
+ *
+ * Written data is pushed to the disk as it is written and dropped from the
+ * page cache afterwards, so a long recording does not build up dirty pages
+ * that are flushed in bursts. Alternatively the file can be opened for direct
+ * I/O.
+ *
+ * The recording may be split into segments of a maximum size. Segments are
+ * named by appending a running number to the path, e.g. @c data.bin.0,
+ * @c data.bin.1 and so on. A segment is only ever split at a transfer
+ * boundary.
+ *
+ * The device must be closed before the recorder is destroyed, so that the
+ * reads armed into the recorder's buffers complete.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+template <typename Device>
+class usb_recorder
+{
+public:
+  /// The type of the executor associated with the object.
+  typedef typename Device::executor_type executor_type;
+
+  /// The alignment of the buffers and of direct I/O.
+  static constexpr std::size_t alignment = 4096;
+
+  /// Open the file and prepare the buffers.
+  /**
+   * @param device The usb device to receive from.
+   *
+   * @param path The file to write. An existing file is truncated.
+   *
+   * @param buffer_size The size of each read. It is rounded up to a multiple
+   * of the alignment.
+   *
+   * @param buffers The number of buffers rotated between reads and writes.
+   *
+   * @param segment_size The maximum size of a segment file, or 0 to record to
+   * a single file.
+   *
+   * @param direct_io Whether to bypass the page cache with O_DIRECT. Direct
+   * writes are used as long as every read fills its buffer; after a short
+   * read the remainder of the segment is written through the page cache.
+   *
+   * @throws boost::system::system_error Thrown if the file cannot be opened.
+   */
+  usb_recorder(Device& device, const std::string& path,
+      std::size_t buffer_size = 65536, std::size_t buffers = 8,
+      std::uint64_t segment_size = 0, bool direct_io = false)
+    : state_(std::make_shared<state>(device, path,
+          (buffer_size + alignment - 1) / alignment * alignment,
+          buffers ? buffers : 1, segment_size, direct_io))
+  {
+    boost::system::error_code ec;
+    state_->open_segment(ec);
+    asio::detail::throw_error(ec, "usb_recorder");
+
+    state_->thread_ = std::thread([s = state_.get()]{ s->run(); });
+  }
+
+  /// Stop the recording.
+  /**
+   * Writes all data already received and closes the file.
+   */
+  ~usb_recorder()
+  {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex_);
+      state_->stopped_ = true;
+    }
+    state_->cond_.notify_one();
+    state_->thread_.join();
+    state_->close_segment();
+  }
+
+  /// Get the executor associated with the object.
+  executor_type get_executor() BOOST_ASIO_NOEXCEPT
+  {
+    return state_->device_.get_executor();
+  }
+
+  /// Arm a read into every free buffer.
+  void start()
+  {
+    std::vector<std::size_t> free;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex_);
+      if (state_->stopped_ || state_->error_)
+        return;
+      free.swap(state_->free_);
+    }
+
+    for (std::size_t index : free)
+      state_->read(index);
+  }
+
+  /// Get the first error of a read or write. The recording stops on error.
+  boost::system::error_code error() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    return state_->error_;
+  }
+
+  /// Get the number of bytes written.
+  std::uint64_t bytes_written() const
+  {
+    return state_->bytes_written_.load(std::memory_order_relaxed);
+  }
+
+  /// Get the number of segment files opened.
+  std::size_t segments() const
+  {
+    return state_->segment_.load(std::memory_order_relaxed);
+  }
+
+  /// Get the number of reads that completed while no other read was armed.
+  /**
+   * Each such event is a window in which the device could not deliver data
+   * because all buffers were waiting to be written.
+   */
+  std::size_t starved() const
+  {
+    return state_->starved_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct buffer_deleter
+  {
+    void operator()(unsigned char* p) const
+    {
+      std::free(p);
+    }
+  };
+
+  typedef std::unique_ptr<unsigned char, buffer_deleter> buffer_ptr;
+
+  // A completed read waiting to be written.
+  struct chunk
+  {
+    std::size_t index_;
+    std::size_t size_;
+  };
+
+  struct state
+    : std::enable_shared_from_this<state>
+  {
+    state(Device& device, const std::string& path, std::size_t buffer_size,
+        std::size_t buffers, std::uint64_t segment_size, bool direct_io)
+      : device_(device)
+      , path_(path)
+      , buffer_size_(buffer_size)
+      , segment_size_(segment_size)
+      , direct_io_(direct_io)
+      , fd_(-1)
+      , direct_(false)
+      , offset_(0)
+      , flushed_(0)
+      , dropped_(0)
+      , armed_(0)
+      , stopped_(false)
+      , bytes_written_(0)
+      , segment_(0)
+      , starved_(0)
+    {
+      for (std::size_t i = 0; i < buffers; ++i)
+      {
+        void* p = 0;
+        if (::posix_memalign(&p, alignment, buffer_size_) != 0)
+          throw std::bad_alloc();
+        buffers_.emplace_back(static_cast<unsigned char*>(p));
+        free_.push_back(i);
+      }
+    }
+
+    void read(std::size_t index)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_)
+        {
+          free_.push_back(index);
+          return;
+        }
+        ++armed_;
+      }
+
+      auto self(this->shared_from_this());
+      device_.async_receive(
+          asio::buffer(buffers_[index].get(), buffer_size_),
+          [self, index](const boost::system::error_code& ec, std::size_t n)
+          {
+            self->on_read(index, ec, n);
+          });
+    }
+
+    void on_read(std::size_t index, const boost::system::error_code& ec,
+        std::size_t n)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--armed_ == 0 && !ec && !stopped_)
+          starved_.fetch_add(1, std::memory_order_relaxed);
+        if (stopped_)
+          return;
+
+        if (ec)
+        {
+          if (!error_)
+            error_ = ec;
+          free_.push_back(index);
+          return;
+        }
+
+        ready_.push_back(chunk{ index, n });
+      }
+      cond_.notify_one();
+    }
+
+    // Writer thread.
+    void run()
+    {
+      auto self(this->shared_from_this());
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (;;)
+      {
+        cond_.wait(lock, [this]{ return stopped_ || !ready_.empty(); });
+        if (ready_.empty())
+          break;
+
+        chunk c = ready_.front();
+        ready_.pop_front();
+        bool failed = static_cast<bool>(error_);
+        lock.unlock();
+
+        boost::system::error_code ec;
+        if (!failed)
+          write(buffers_[c.index_].get(), c.size_, ec);
+
+        lock.lock();
+        if (ec && !error_)
+          error_ = ec;
+        if (stopped_ || error_)
+        {
+          free_.push_back(c.index_);
+          continue;
+        }
+
+        // Re-arm the buffer from the device's executor.
+        std::size_t index = c.index_;
+        asio::post(device_.get_executor(),
+            [self, index]{ self->read(index); });
+      }
+    }
+
+    void write(const unsigned char* data, std::size_t size,
+        boost::system::error_code& ec)
+    {
+      if (segment_size_ && offset_ && offset_ + size > segment_size_)
+      {
+        close_segment();
+        open_segment(ec);
+        if (ec)
+          return;
+      }
+
+#if defined(O_DIRECT)
+      if (direct_ && size != buffer_size_)
+      {
+        // Direct I/O needs aligned lengths and offsets, which a short read
+        // breaks for the rest of the segment.
+        ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+        direct_ = false;
+      }
+#endif
+
+      std::size_t written = 0;
+      while (written < size)
+      {
+        ssize_t r = ::write(fd_, data + written, size - written);
+        if (r < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          ec = boost::system::error_code(errno,
+              asio::error::get_system_category());
+          return;
+        }
+        written += static_cast<std::size_t>(r);
+      }
+
+      offset_ += size;
+      bytes_written_.fetch_add(size, std::memory_order_relaxed);
+      if (!direct_)
+        write_behind();
+    }
+
+    // Start writeback of the newly written data and drop the data written
+    // before it from the page cache.
+    void write_behind()
+    {
+#if defined(__linux__)
+      if (offset_ - flushed_ < buffer_size_)
+        return;
+
+      ::sync_file_range(fd_, flushed_, offset_ - flushed_,
+          SYNC_FILE_RANGE_WRITE);
+      if (flushed_ > dropped_)
+      {
+        ::sync_file_range(fd_, dropped_, flushed_ - dropped_,
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+            | SYNC_FILE_RANGE_WAIT_AFTER);
+        ::posix_fadvise(fd_, dropped_, flushed_ - dropped_,
+            POSIX_FADV_DONTNEED);
+        dropped_ = flushed_;
+      }
+      flushed_ = offset_;
+#endif
+    }
+
+    void open_segment(boost::system::error_code& ec)
+    {
+      std::size_t segment = segment_.fetch_add(1, std::memory_order_relaxed);
+      std::string name(segment_size_
+          ? path_ + "." + std::to_string(segment) : path_);
+
+      int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+      direct_ = false;
+#if defined(O_DIRECT)
+      if (direct_io_)
+      {
+        fd_ = ::open(name.c_str(), flags | O_DIRECT, 0644);
+        direct_ = fd_ >= 0;
+      }
+#endif
+      if (fd_ < 0)
+        fd_ = ::open(name.c_str(), flags, 0644);
+      if (fd_ < 0)
+      {
+        ec = boost::system::error_code(errno,
+            asio::error::get_system_category());
+      }
+
+      offset_ = 0;
+      flushed_ = 0;
+      dropped_ = 0;
+    }
+
+    void close_segment()
+    {
+      if (fd_ < 0)
+        return;
+
+      ::fdatasync(fd_);
+#if defined(__linux__)
+      ::posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+      ::close(fd_);
+      fd_ = -1;
+    }
+
+    Device& device_;
+    std::string path_;
+    std::size_t buffer_size_;
+    std::uint64_t segment_size_;
+    bool direct_io_;
+    std::vector<buffer_ptr> buffers_;
+
+    // Owned by the writer thread.
+    int fd_;
+    bool direct_;
+    std::uint64_t offset_;
+    std::uint64_t flushed_;
+    std::uint64_t dropped_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::size_t> free_;
+    std::deque<chunk> ready_;
+    std::size_t armed_;
+    bool stopped_;
+    boost::system::error_code error_;
+    std::thread thread_;
+
+    std::atomic<std::uint64_t> bytes_written_;
+    std::atomic<std::size_t> segment_;
+    std::atomic<std::size_t> starved_;
+  };
+
+  // Disallow copying and assignment.
+  usb_recorder(const usb_recorder&) BOOST_ASIO_DELETED;
+  usb_recorder& operator=(const usb_recorder&) BOOST_ASIO_DELETED;
+
+  std::shared_ptr<state> state_;
+};
+
+} // namespace libusb
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <boost/asio.hpp>
+
+namespace libusb {
+
+namespace asio = boost::asio;
+
+namespace detail {
+class usb_device_service;
+} // namespace detail
+
+/// Options controlling how the usb device service drives libusb.
+/**
+ * The options apply to all usb devices and acceptors of an execution context.
+ * They must be set with set_service_options() before the first transfer is
+ * started.
+ */
+class usb_service_options
+{
+public:
+  /// The way libusb events are handled.
+  enum event_mode
+  {
+    /// Transfers are submitted and waited for one after another on the
+    /// service's private resolver thread.
+    resolver_thread,
+
+    /// Transfers are submitted directly by the initiating thread. A dedicated
+    /// thread handles libusb events and hands completed transfers to the
+    /// execution context in batches.
+    event_thread,
+
+    /// Transfers are submitted directly by the initiating thread. A dedicated
+    /// thread polls libusb for events without blocking and runs completion
+    /// handlers itself, trading a busy core for the lowest wake-up latency.
+    /// After a period without events, adapted to the traffic and at most
+    /// spin_threshold(), it blocks until the next event.
+    busy_poll
+  };
+
+  /// How devices are distributed over the context shards.
+  enum shard_policy
+  {
+    /// Each opened device goes to the next shard in turn.
+    round_robin,
+
+    /// Devices go to the shard given by their bus number, so the devices of
+    /// one host controller share a shard.
+    by_bus
+  };
+
+  usb_service_options()
+    : mode_(resolver_thread)
+    , open_threads_(0)
+    , cpu_affinity_(-1)
+    , spin_threshold_(1000)
+    , shutdown_timeout_(1000)
+    , device_discovery_(true)
+    , context_shards_(0)
+    , shard_policy_(round_robin)
+  {
+  }
+
+  /// Get the event handling mode.
+  event_mode mode() const
+  {
+    return mode_;
+  }
+
+  /// Set the event handling mode.
+  usb_service_options& mode(event_mode m)
+  {
+    mode_ = m;
+    return *this;
+  }
+
+  /// Get the number of threads opening devices for async_open.
+  std::size_t open_threads() const
+  {
+    return open_threads_;
+  }
+
+  /// Set the number of threads opening devices for async_open.
+  /**
+   * Zero, the default, uses one thread per hardware thread. The pool is
+   * created by the first async_open, so later changes have no effect.
+   */
+  usb_service_options& open_threads(std::size_t n)
+  {
+    open_threads_ = n;
+    return *this;
+  }
+
+  /// Get the cpu the event thread is pinned to, or -1 if it is not pinned.
+  int cpu_affinity() const
+  {
+    return cpu_affinity_;
+  }
+
+  /// Pin the event thread to a cpu.
+  /**
+   * Applies to the event_thread and busy_poll modes. The thread is pinned
+   * when it starts; -1, the default, leaves it to the scheduler.
+   */
+  usb_service_options& cpu_affinity(int cpu)
+  {
+    cpu_affinity_ = cpu;
+    return *this;
+  }
+
+  /// Get the longest the busy_poll thread spins without events before
+  /// blocking.
+  std::chrono::microseconds spin_threshold() const
+  {
+    return spin_threshold_;
+  }
+
+  /// Set the longest the busy_poll thread spins without events before
+  /// blocking.
+  /**
+   * The thread spins for about twice the recent gap between events, and
+   * shortens the spin each time it has to block, within a sixteenth of the
+   * threshold and the threshold itself. The default is 1ms. Use
+   * std::chrono::microseconds::max() to never block.
+   */
+  usb_service_options& spin_threshold(std::chrono::microseconds threshold)
+  {
+    spin_threshold_ = threshold;
+    return *this;
+  }
+
+  /// Get how long outstanding transfers are waited for when shutting down.
+  std::chrono::milliseconds shutdown_timeout() const
+  {
+    return shutdown_timeout_;
+  }
+
+  /// Set how long outstanding transfers are waited for when shutting down.
+  /**
+   * Closing or destroying a device, and destroying the execution context,
+   * cancel the outstanding transfers and wait at most this long for libusb to
+   * return them. Transfers still outstanding after that are abandoned: they
+   * are taken back by closing the device handle and complete with
+   * boost::asio::error::operation_aborted. The default is 1s.
+   */
+  usb_service_options& shutdown_timeout(std::chrono::milliseconds timeout)
+  {
+    shutdown_timeout_ = timeout;
+    return *this;
+  }
+
+  /// Get whether libusb enumerates the bus.
+  bool device_discovery() const
+  {
+    return device_discovery_;
+  }
+
+  /// Set whether libusb enumerates the bus.
+  /**
+   * Disabling discovery initialises libusb with
+   * LIBUSB_OPTION_NO_DEVICE_DISCOVERY, so it neither scans the bus at startup
+   * nor monitors hotplug events. Devices are then only reachable through
+   * usb_device::assign_fd() from file descriptors opened elsewhere, such as
+   * by a privileged broker. The option must be set before the first usb
+   * device of the execution context is constructed. The default is true.
+   *
+   * libusb applies the option to the whole process: once disabled, discovery
+   * stays disabled for the default context and for every context initialised
+   * afterwards, including those of other execution contexts, and it cannot be
+   * enabled again.
+   */
+  usb_service_options& device_discovery(bool enable)
+  {
+    device_discovery_ = enable;
+    return *this;
+  }
+
+  /// Get the number of libusb contexts devices are distributed over.
+  std::size_t context_shards() const
+  {
+    return context_shards_;
+  }
+
+  /// Set the number of libusb contexts devices are distributed over.
+  /**
+   * Zero, the default, opens all devices in libusb's default context. With n
+   * shards the service creates n contexts, opens each device in one of them
+   * and, in the event_thread and busy_poll modes, handles the events of each
+   * on its own thread, so that devices on different shards do not contend for
+   * one event lock. A cpu_affinity() pins the thread of shard i to cpu + i.
+   * The option must be set before the first device is opened.
+   *
+   * On Linux a device is opened in its shard from its device node, without
+   * enumerating the bus, so shards also work with device_discovery()
+   * disabled. Elsewhere the shard's context enumerates the bus on each open.
+   */
+  usb_service_options& context_shards(std::size_t n)
+  {
+    context_shards_ = n;
+    return *this;
+  }
+
+  /// Get how devices are distributed over the context shards.
+  shard_policy policy() const
+  {
+    return shard_policy_;
+  }
+
+  /// Set how devices are distributed over the context shards.
+  /**
+   * The usb_device_base::shard option places a device on a shard explicitly
+   * instead. Devices opened from a file descriptor have no bus number before
+   * they are opened and are distributed round robin under by_bus. The default
+   * is round_robin.
+   */
+  usb_service_options& policy(shard_policy p)
+  {
+    shard_policy_ = p;
+    return *this;
+  }
+
+private:
+  event_mode mode_;
+  std::size_t open_threads_;
+  int cpu_affinity_;
+  std::chrono::microseconds spin_threshold_;
+  std::chrono::milliseconds shutdown_timeout_;
+  bool device_discovery_;
+  std::size_t context_shards_;
+  shard_policy shard_policy_;
+};
+
+/// Set the options of the usb device service of an execution context.
+/**
+ * @param context The execution context whose usb devices are configured.
+ *
+ * @param options The options to apply.
+ *
+ * @throws boost::system::system_error Thrown with
+ * boost::asio::error::already_started if transfers have already been started
+ * in a different event mode, if device discovery is changed after a usb
+ * device has been constructed, or if the context shards are changed after a
+ * usb device has been opened.
+ */
+template <typename ExecutionContext>
+void set_service_options(ExecutionContext& context,
+    const usb_service_options& options)
+{
+  boost::system::error_code ec;
+  asio::use_service<detail::usb_device_service>(context).set_options(
+      options, ec);
+  asio::detail::throw_error(ec, "set_service_options");
+}
+
+} // namespace libusb
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <time.h>
+
+namespace libusb {
+
+/// Clock timestamping transfers.
+/**
+ * The clock reads CLOCK_MONOTONIC_RAW, which is not slewed by NTP, so the
+ * intervals it measures are those of the local oscillator. On Linux 5.3 and
+ * later the common architectures, such as x86 and arm64, serve
+ * CLOCK_MONOTONIC_RAW from the vDSO without entering the kernel. Older
+ * kernels and other architectures may make a system call for each read.
+ * Where CLOCK_MONOTONIC_RAW is not available the clock falls back to
+ * CLOCK_MONOTONIC.
+ *
+ * Timestamps of different devices on the same host share this time base.
+ */
+struct raw_monotonic_clock
+{
+  typedef std::chrono::nanoseconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<raw_monotonic_clock> time_point;
+
+  static const bool is_steady = true;
+
+  static time_point now() noexcept
+  {
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+    ::clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return time_point(duration(
+          static_cast<rep>(ts.tv_sec) * 1000000000 + ts.tv_nsec));
+  }
+};
+
+/// Timestamps of a completed transfer.
+struct transfer_timing
+{
+  /// Taken just before the transfer was handed to libusb.
+  raw_monotonic_clock::time_point submitted;
+
+  /// Taken on entry to the libusb completion callback, before the completion
+  /// is passed on to the executor.
+  raw_monotonic_clock::time_point completed;
+
+  /// Time from submission to the libusb callback.
+  raw_monotonic_clock::duration latency() const
+  {
+    return completed - submitted;
+  }
+};
+
+/// Rolling statistics of the transfers completed on one endpoint.
+/**
+ * Only successfully completed transfers are counted. The interval is the time
+ * between the callbacks of consecutive transfers; the jitter is the running
+ * mean of the difference between consecutive intervals, smoothed with a gain
+ * of 1/16 as for the RTP interarrival jitter (RFC 3550). The mean interval and
+ * mean latency are smoothed the same way.
+ */
+struct endpoint_statistics
+{
+  endpoint_statistics()
+    : transfers(0)
+    , last_interval(0)
+    , mean_interval(0)
+    , jitter(0)
+    , min_latency(0)
+    , max_latency(0)
+    , mean_latency(0)
+  {
+  }
+
+  /// Number of transfers counted.
+  std::uint64_t transfers;
+
+  /// Callback time of the last transfer counted.
+  raw_monotonic_clock::time_point last_completed;
+
+  /// Interval before the last transfer counted.
+  raw_monotonic_clock::duration last_interval;
+
+  /// Smoothed interval between transfers.
+  raw_monotonic_clock::duration mean_interval;
+
+  /// Smoothed difference between consecutive intervals.
+  raw_monotonic_clock::duration jitter;
+
+  /// Shortest time from submission to callback.
+  raw_monotonic_clock::duration min_latency;
+
+  /// Longest time from submission to callback.
+  raw_monotonic_clock::duration max_latency;
+
+  /// Smoothed time from submission to callback.
+  raw_monotonic_clock::duration mean_latency;
+};
+
+} // namespace libusb
@@ -0,0 +1,73 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using namespace libusb;
+  namespace asio = boost::asio;
+
+  "discovery is fixed once a device exists"_test = []
+  {
+    asio::io_context io_context;
+    set_service_options(io_context,
+        usb_service_options().device_discovery(false));
+    usb_device<> device(io_context);
+
+    boost::system::error_code ec;
+    try
+    {
+      set_service_options(io_context,
+          usb_service_options().device_discovery(true));
+    }
+    catch (const boost::system::system_error& e)
+    {
+      ec = e.code();
+    }
+    expect(ec == asio::error::already_started);
+
+    // Other options may still change.
+    set_service_options(io_context, usb_service_options()
+        .device_discovery(false).shutdown_timeout(std::chrono::seconds(2)));
+  };
+
+  "disabled discovery cannot be enabled again"_test = []
+  {
+    asio::io_context io_context;
+    set_service_options(io_context,
+        usb_service_options().device_discovery(false));
+    {
+      usb_device<> device(io_context);
+    }
+
+    boost::system::error_code ec;
+    try
+    {
+      set_service_options(io_context,
+          usb_service_options().device_discovery(true));
+    }
+    catch (const boost::system::system_error& e)
+    {
+      ec = e.code();
+    }
+    expect(ec == asio::error::already_started);
+  };
+
+  "a descriptor that is no usb device is refused"_test = []
+  {
+    asio::io_context io_context;
+    usb_device<> device(io_context);
+
+    int fd = ::open("/dev/null", O_RDWR);
+    expect(fd >= 0);
+
+    boost::system::error_code ec;
+    device.assign_fd(fd, ec);
+    expect(!!ec);
+    expect(!device.is_open());
+    ::close(fd);
+  };
+}
@@ -0,0 +1,45 @@
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using namespace libusb;
+  namespace asio = boost::asio;
+
+  "async open completes on the io_context"_test = []
+  {
+    asio::io_context io_context;
+    set_service_options(io_context, usb_service_options().open_threads(4));
+
+    std::vector<std::unique_ptr<usb_device<>>> devices;
+    for (int i = 0; i < 16; ++i)
+      devices.emplace_back(new usb_device<>(io_context));
+
+    // Devices that were never assigned fail to open without touching libusb.
+    int completed = 0;
+    bool on_io_thread = true;
+    std::thread::id io_thread = std::this_thread::get_id();
+    for (auto& device : devices)
+    {
+      device->async_open([&](const boost::system::error_code& ec)
+          {
+            expect(ec == asio::error::no_such_device);
+            on_io_thread = on_io_thread
+              && std::this_thread::get_id() == io_thread;
+            ++completed;
+          });
+    }
+
+    io_context.run();
+
+    expect(16_i == completed);
+    expect(on_io_thread);
+    for (auto& device : devices)
+      expect(!device->is_open());
+  };
+}
@@ -0,0 +1,137 @@
+#include <functional>
+#include <string>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/buffered_usb_stream.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::buffered_usb_stream<fake_device> stream;
+
+int main()
+{
+  using namespace boost::ut;
+
+  "small reads from one transfer"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    stream s(dev, 64, 2);
+
+    char out[4];
+    std::vector<std::string> reads;
+    std::function<void ()> next = [&]
+    {
+      s.async_read_some(asio::buffer(out),
+          [&](boost::system::error_code ec, std::size_t n)
+          {
+            if (ec)
+              return;
+            reads.emplace_back(out, n);
+            if (reads.size() < 4)
+              next();
+          });
+    };
+    next();
+    io.poll();
+    expect(2_ul == dev.receives_.size());
+
+    dev.deliver("abcdefghij");
+    io.poll();
+    expect(3_ul == reads.size());
+    expect(reads[0] == "abcd" && reads[1] == "efgh" && reads[2] == "ij");
+    expect(2_ul == dev.receives_.size());
+
+    dev.deliver("kl");
+    io.poll();
+    expect(4_ul == reads.size());
+    expect(reads[3] == "kl");
+  };
+
+  "read until delimiter"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    stream s(dev, 16, 2);
+
+    std::string line;
+    asio::async_read_until(s, asio::dynamic_buffer(line), '\n',
+        [&](boost::system::error_code ec, std::size_t n)
+        {
+          expect(!ec);
+          line.resize(n);
+        });
+    io.poll();
+    dev.deliver("hel");
+    dev.deliver("lo\nworld");
+    io.poll();
+    expect(line == "hello\n");
+  };
+
+  "zero copy view and error"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    stream s(dev, 16, 1);
+
+    std::size_t available = 0;
+    s.async_fill([&](boost::system::error_code ec, std::size_t n)
+        {
+          expect(!ec);
+          available = n;
+        });
+    io.poll();
+    dev.deliver("");
+    io.poll();
+    expect(0_ul == available);
+    dev.deliver("xyz", asio::error::no_such_device);
+    io.poll();
+    expect(3_ul == available);
+    expect(3_ul == s.data().size());
+    expect(*static_cast<const char*>(s.data().data()) == 'x');
+
+    s.consume(3);
+    boost::system::error_code error;
+    s.async_fill([&](boost::system::error_code ec, std::size_t) { error = ec; });
+    io.restart();
+    io.poll();
+    expect(error == asio::error::no_such_device);
+    expect(0_ul == dev.receives_.size());
+  };
+
+  "buffered data behind a failed chunk is delivered first"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    stream s(dev, 16, 2);
+
+    // Start read-ahead without a read waiting.
+    s.async_fill([](boost::system::error_code, std::size_t) {});
+    io.poll();
+    expect(2_ul == dev.receives_.size());
+    dev.fail_one(asio::error::no_such_device);
+    dev.deliver("cd");
+    io.restart();
+    io.poll();
+
+    char out[4];
+    boost::system::error_code first, second;
+    std::size_t n = 0;
+    s.async_read_some(asio::buffer(out),
+        [&](boost::system::error_code ec, std::size_t bytes)
+        {
+          first = ec;
+          n = bytes;
+        });
+    io.restart();
+    io.poll();
+    expect(!first);
+    expect(2_ul == n && out[0] == 'c' && out[1] == 'd');
+
+    s.async_read_some(asio::buffer(out),
+        [&](boost::system::error_code ec, std::size_t) { second = ec; });
+    io.restart();
+    io.poll();
+    expect(second == asio::error::no_such_device);
+  };
+}
@@ -0,0 +1,75 @@
+#include <chrono>
+#include <functional>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+#include "libusb/detail/adaptive_spin.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using namespace libusb;
+  namespace asio = boost::asio;
+  using libusb::detail::adaptive_spin;
+  using std::chrono::microseconds;
+
+  "spin follows the gap between events"_test = []
+  {
+    adaptive_spin spin(microseconds(1600));
+    expect(true == (spin.threshold() == microseconds(1600)));
+
+    for (int i = 0; i < 100; ++i)
+      spin.caught(microseconds(200));
+    expect(true == (spin.threshold() > microseconds(390)));
+    expect(true == (spin.threshold() < microseconds(410)));
+  };
+
+  "spin decays when blocking, within its bounds"_test = []
+  {
+    adaptive_spin spin(microseconds(1600));
+    spin.blocked();
+    expect(true == (spin.threshold() == microseconds(1400)));
+
+    for (int i = 0; i < 100; ++i)
+      spin.blocked();
+    expect(true == (spin.threshold() == microseconds(100)));
+
+    for (int i = 0; i < 100; ++i)
+      spin.caught(microseconds(5000));
+    expect(true == (spin.threshold() == microseconds(1600)));
+  };
+
+  "spin without bound is not adapted"_test = []
+  {
+    adaptive_spin spin(microseconds::max());
+    spin.blocked();
+    spin.caught(microseconds(1));
+    expect(true == (spin.threshold() == microseconds::max()));
+  };
+
+  "handlers run by the polling thread can start transfers"_test = []
+  {
+    int completed = 0;
+    {
+      asio::io_context io_context;
+      set_service_options(io_context, usb_service_options()
+          .mode(usb_service_options::busy_poll)
+          .spin_threshold(std::chrono::milliseconds(1)));
+
+      // Transfers on a device that was never opened fail, but start the
+      // polling thread, which may run their handlers itself.
+      usb_device<> device(io_context);
+      unsigned char data[8];
+      std::function<void (const boost::system::error_code&, std::size_t)>
+        handler = [&](const boost::system::error_code& ec, std::size_t)
+        {
+          expect(!!ec);
+          if (++completed < 8)
+            device.async_receive(asio::buffer(data), handler);
+        };
+      device.async_receive(asio::buffer(data), handler);
+      io_context.run();
+    }
+    expect(8_i == completed);
+  };
+}
@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <boost/ut.hpp>
+#include "libusb/usb_capture.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using namespace libusb;
+
+  "capture ring"_test = []
+  {
+    detail::capture_ring ring(3, 2);
+    expect(4_ul == ring.capacity());
+
+    detail::usbmon_packet h = {};
+    const unsigned char data[] = { 1, 2, 3 };
+    for (int i = 0; i < 4; ++i)
+      expect(ring.push(h, data, sizeof(data)));
+    expect(!ring.push(h, data, sizeof(data)));
+    expect(1_ul == ring.dropped());
+
+    std::size_t n = ring.consume(
+        [](const detail::usbmon_packet& p, const unsigned char* payload,
+          std::size_t size)
+        {
+          expect(2_u == p.len_cap);
+          expect(3_ul == size);
+          expect(1_i == payload[0] && 2_i == payload[1]);
+        });
+    expect(4_ul == n);
+    expect(ring.push(h, data, sizeof(data)));
+  };
+
+  "pcapng file"_test = []
+  {
+    const char* path = "capture_test.pcapng";
+    {
+      usb_capture capture(path, 16, 4);
+      const unsigned char data[] = { 0xde, 0xad, 0xbe, 0xef, 0x00 };
+      capture.record('S', 1, NULL, 0x01, LIBUSB_TRANSFER_TYPE_INTERRUPT,
+          -115, sizeof(data), data, sizeof(data));
+      capture.record('C', 1, NULL, 0x01, LIBUSB_TRANSFER_TYPE_INTERRUPT,
+          0, sizeof(data), NULL, 0);
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)),
+        std::istreambuf_iterator<char>());
+    std::remove(path);
+
+    auto u32 = [&file](std::size_t off)
+    {
+      std::uint32_t v;
+      std::memcpy(&v, &file[off], sizeof(v));
+      return v;
+    };
+
+    // Section header, interface description and two enhanced packet blocks
+    // of 32 + 64 + 4 and 32 + 64 bytes.
+    expect(244_ul == file.size());
+    expect(u32(0) == 0x0A0D0D0Au);
+    expect(u32(8) == 0x1A2B3C4Du);
+    expect(220_u == (u32(36) & 0xffff));
+    expect(6_u == u32(48));
+    expect(68_u == u32(48 + 20));
+    expect(69_u == u32(48 + 24));
+  };
+}
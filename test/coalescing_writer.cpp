@@ -0,0 +1,94 @@
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_coalescing_writer.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::usb_coalescing_writer<fake_device> writer;
+
+int main()
+{
+  using namespace boost::ut;
+
+  "flush on size"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.max_packet_size_ = 16;
+    writer w(dev, 40, std::chrono::seconds(10));
+
+    unsigned char data[12] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+    std::vector<std::size_t> sizes;
+    for (int i = 0; i < 5; ++i)
+    {
+      w.async_send(asio::buffer(data, 8 + i % 2 * 4),
+          [&](boost::system::error_code ec, std::size_t n)
+          {
+            expect(!ec);
+            sizes.push_back(n);
+          });
+    }
+
+    // The limit is 32, two packets: 8 + 12 + 8 fill the first batch, the
+    // fourth send would overflow it.
+    expect(1_ul == dev.sent_.size());
+    expect(28_ul == dev.sent_[0].data_.size());
+    expect(20_ul == w.pending());
+
+    dev.complete_send();
+    io.poll();
+    expect(3_ul == sizes.size());
+    expect(sizes[0] == 8 && sizes[1] == 12 && sizes[2] == 8);
+  };
+
+  "flush on deadline"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.max_packet_size_ = 0;
+    writer w(dev, 4096, std::chrono::microseconds(500));
+
+    unsigned char data[4] = { 1, 2, 3, 4 };
+    int completed = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+      w.async_send(asio::buffer(data),
+          [&](boost::system::error_code, std::size_t n)
+          {
+            completed += n == 4;
+          });
+    }
+    expect(0_ul == dev.sent_.size());
+
+    io.run_one();
+    expect(1_ul == dev.sent_.size());
+    expect(12_ul == dev.sent_[0].data_.size());
+
+    dev.complete_send();
+    io.run();
+    expect(3_i == completed);
+    expect(1_ul == w.transfers());
+  };
+
+  "explicit flush keeps order"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.max_packet_size_ = 64;
+    writer w(dev, 64, std::chrono::seconds(10));
+
+    unsigned char a[2] = { 1, 1 }, b[2] = { 2, 2 };
+    w.async_send(asio::buffer(a), [](boost::system::error_code, std::size_t){});
+    w.flush();
+    w.async_send(asio::buffer(b), [](boost::system::error_code, std::size_t){});
+    w.flush();
+
+    expect(1_ul == dev.sent_.size());
+    dev.complete_send();
+    io.poll();
+    expect(2_ul == dev.sent_.size());
+    expect(dev.sent_[0].data_[0] == 1 && dev.sent_[1].data_[0] == 2);
+    dev.complete_send();
+    io.poll();
+  };
+}
@@ -0,0 +1,103 @@
+#include <thread>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/detail/completion_queue.hpp"
+
+namespace asio = boost::asio;
+
+struct test_op : asio::detail::operation
+{
+  test_op(int producer, int sequence)
+    : asio::detail::operation(&test_op::do_complete)
+    , entry_(this)
+    , producer_(producer)
+    , sequence_(sequence)
+  {
+  }
+
+  static void do_complete(void*, asio::detail::operation*,
+      const boost::system::error_code&, std::size_t)
+  {
+  }
+
+  libusb::detail::completion_queue::entry entry_;
+  int producer_;
+  int sequence_;
+};
+
+int main()
+{
+  using namespace boost::ut;
+  using libusb::detail::completion_queue;
+
+  "fifo order"_test = []
+  {
+    completion_queue queue;
+    test_op a(0, 0), b(0, 1), c(0, 2);
+
+    expect(queue.empty());
+    expect(queue.push(&a.entry_));
+    expect(!queue.push(&b.entry_));
+    expect(!queue.push(&c.entry_));
+
+    asio::detail::op_queue<asio::detail::operation> ops;
+    queue.pop_all(ops);
+    expect(queue.empty());
+
+    int expected = 0;
+    while (asio::detail::operation* op = ops.front())
+    {
+      ops.pop();
+      expect(expected++ == static_cast<test_op*>(op)->sequence_);
+    }
+    expect(3_i == expected);
+  };
+
+  "concurrent producers"_test = []
+  {
+    const int producers = 4;
+    const int per_producer = 10000;
+
+    std::vector<std::vector<test_op>> storage(producers);
+    for (int p = 0; p < producers; ++p)
+    {
+      storage[p].reserve(per_producer);
+      for (int i = 0; i < per_producer; ++i)
+        storage[p].emplace_back(p, i);
+    }
+
+    completion_queue queue;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+      threads.emplace_back([&queue, &storage, p]
+          {
+            for (auto& op : storage[p])
+              queue.push(&op.entry_);
+          });
+    }
+
+    std::vector<int> next(producers, 0);
+    int received = 0;
+    bool ordered = true;
+    while (received < producers * per_producer)
+    {
+      asio::detail::op_queue<asio::detail::operation> ops;
+      queue.pop_all(ops);
+      while (asio::detail::operation* op = ops.front())
+      {
+        ops.pop();
+        auto t = static_cast<test_op*>(op);
+        ordered = ordered && t->sequence_ == next[t->producer_]++;
+        ++received;
+      }
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    expect(ordered);
+    expect(queue.empty());
+  };
+}
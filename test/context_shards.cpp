@@ -0,0 +1,65 @@
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using namespace libusb;
+  namespace asio = boost::asio;
+
+  "shards are fixed once created"_test = []
+  {
+    asio::io_context io_context;
+    usb_service_options options = usb_service_options()
+      .mode(usb_service_options::event_thread)
+      .context_shards(4)
+      .policy(usb_service_options::by_bus);
+    set_service_options(io_context, options);
+
+    // Changing the shards before they exist is allowed.
+    options.context_shards(2);
+    set_service_options(io_context, options);
+
+    // A transfer on a device that was never opened fails, but starts the
+    // shards' event threads.
+    usb_device<> device(io_context);
+    unsigned char data[8];
+    bool completed = false;
+    device.async_receive(asio::buffer(data),
+        [&](const boost::system::error_code& ec, std::size_t)
+        {
+          expect(!!ec);
+          completed = true;
+        });
+    io_context.run();
+    expect(true == completed);
+
+    boost::system::error_code ec;
+    try
+    {
+      set_service_options(io_context, options.context_shards(8));
+    }
+    catch (const boost::system::system_error& e)
+    {
+      ec = e.code();
+    }
+    expect(ec == asio::error::already_started);
+
+    set_service_options(io_context, options.context_shards(2));
+  };
+
+  "devices can be placed on a shard"_test = []
+  {
+    asio::io_context io_context;
+    usb_device<> device(io_context);
+
+    usb_device_base::shard option;
+    device.get_option(option);
+    expect(-1_i == option.value());
+
+    device.set_option(usb_device_base::shard(3));
+    device.get_option(option);
+    expect(3_i == option.value());
+  };
+}
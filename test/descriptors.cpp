@@ -0,0 +1,59 @@
+#include <string>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using namespace libusb;
+  namespace asio = boost::asio;
+
+  "unassigned device has no descriptors"_test = []
+  {
+    asio::io_context io_context;
+    usb_device<> device(io_context);
+
+    boost::system::error_code ec;
+    device.device_descriptor(ec);
+    expect(ec == asio::error::no_such_device);
+
+    expect(!device.config_descriptor(0, ec));
+    expect(ec == asio::error::no_such_device);
+
+    expect(!device.bos_descriptor(ec));
+    expect(ec == asio::error::bad_descriptor);
+
+    device.string_descriptor(0, ec);
+    expect(ec == asio::error::invalid_argument);
+
+    device.string_descriptor(1, ec);
+    expect(ec == asio::error::bad_descriptor);
+  };
+
+  "async string read completes on the io_context"_test = []
+  {
+    asio::io_context io_context;
+    usb_device<> device(io_context);
+
+    int completed = 0;
+    device.async_read_string_descriptor(0,
+        [&](const boost::system::error_code& ec, std::string value)
+        {
+          expect(ec == asio::error::invalid_argument);
+          expect(value.empty());
+          ++completed;
+        });
+    device.async_read_string_descriptor(3,
+        [&](const boost::system::error_code& ec, std::string)
+        {
+          expect(ec == asio::error::bad_descriptor);
+          ++completed;
+        });
+    expect(0_i == completed);
+
+    io_context.run();
+
+    expect(2_i == completed);
+  };
+}
@@ -0,0 +1,97 @@
+#include <memory>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device_group.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::usb_device_group<fake_device> group;
+
+int main()
+{
+  using namespace boost::ut;
+
+  "fan out from one buffer"_test = []
+  {
+    asio::io_context io;
+    std::vector<std::unique_ptr<fake_device>> devices;
+    group g(io.get_executor());
+    for (int i = 0; i < 8; ++i)
+    {
+      devices.emplace_back(new fake_device(io));
+      devices.back()->complete_sends_ = true;
+      if (i == 5)
+        devices.back()->send_error_ = asio::error::no_such_device;
+      g.add(*devices.back());
+    }
+    g.remove(*devices[7]);
+    expect(7_ul == g.size());
+
+    auto data = std::make_shared<const std::vector<unsigned char>>(512, 0xa5);
+    std::weak_ptr<const std::vector<unsigned char>> weak(data);
+    boost::system::error_code error;
+    group::results_type results;
+    g.async_send(std::move(data),
+        [&](boost::system::error_code ec, group::results_type r)
+        {
+          error = ec;
+          results = std::move(r);
+        });
+    expect(!weak.expired());
+
+    io.run();
+
+    expect(weak.expired());
+    expect(error == asio::error::no_such_device);
+    expect(7_ul == results.size());
+    bool shared = true;
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+      expect(results[i].device == devices[i].get());
+      shared = shared && devices[i]->sent_[0].buffer_.data()
+        == devices[0]->sent_[0].buffer_.data();
+      if (i == 5)
+        expect(results[i].error == asio::error::no_such_device);
+      else
+        expect(!results[i].error && results[i].bytes_transferred == 512);
+    }
+    expect(shared);
+    expect(devices[7]->sent_.empty());
+  };
+
+  "empty group completes"_test = []
+  {
+    asio::io_context io;
+    group g(io.get_executor());
+    unsigned char data[4] = {};
+    bool called = false;
+    g.async_send(asio::buffer(data),
+        [&](boost::system::error_code ec, group::results_type r)
+        {
+          called = !ec && r.empty();
+        });
+    io.run();
+    expect(called);
+  };
+
+  "null data is rejected"_test = []
+  {
+    asio::io_context io;
+    fake_device device(io);
+    device.complete_sends_ = true;
+    group g(io.get_executor());
+    g.add(device);
+    boost::system::error_code error;
+    bool called = false;
+    g.async_send(std::shared_ptr<const std::vector<unsigned char>>(),
+        [&](boost::system::error_code ec, group::results_type r)
+        {
+          error = ec;
+          called = r.empty();
+        });
+    io.run();
+    expect(called);
+    expect(error == asio::error::invalid_argument);
+    expect(device.sent_.empty());
+  };
+}
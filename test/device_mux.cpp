@@ -0,0 +1,140 @@
+#include <string>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device_mux.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::usb_device_mux<fake_device> mux;
+
+std::string text(const mux::event& e)
+{
+  return std::string(static_cast<const char*>(e.data.data()), e.data.size());
+}
+
+int main()
+{
+  using namespace boost::ut;
+
+  "events of all members in completion order"_test = []
+  {
+    asio::io_context io;
+    fake_device a(io), b(io);
+    mux m(io.get_executor());
+    std::size_t ia = m.add(a, 16, 2);
+    std::size_t ib = m.add(b, 16, 2);
+    expect(2_ul == m.size());
+    expect(2_ul == a.receives_.size() && 2_ul == b.receives_.size());
+
+    std::vector<mux::event> events;
+    std::size_t count = 0;
+    m.async_drain(events,
+        [&](boost::system::error_code ec, std::size_t n)
+        {
+          count = ec ? 0 : n;
+        });
+
+    b.deliver("b0");
+    io.restart();
+    io.poll();
+    expect(1_ul == count);
+    expect(events.size() == 1 && events[0].id == ib && text(events[0]) == "b0");
+
+    a.deliver("a0");
+    b.deliver("b1");
+    a.deliver("a1");
+    io.restart();
+    io.poll();
+    expect(3_ul == m.drain(events));
+    bool ordered = events[0].id == ia && text(events[0]) == "a0"
+      && events[1].id == ib && text(events[1]) == "b1"
+      && events[2].id == ia && text(events[2]) == "a1";
+    expect(ordered);
+
+    // The buffers of the previous batch were re-armed by the drain.
+    expect(0_ul == m.drain(events));
+    expect(2_ul == a.receives_.size() && 2_ul == b.receives_.size());
+  };
+
+  "batches are bounded"_test = []
+  {
+    asio::io_context io;
+    fake_device a(io);
+    mux m(io.get_executor(), 2);
+    m.add(a, 8, 4);
+    for (int i = 0; i < 4; ++i)
+      a.deliver(std::to_string(i));
+    io.restart();
+    io.poll();
+
+    std::vector<mux::event> events;
+    expect(2_ul == m.drain(events));
+    expect(text(events[0]) == "0" && text(events[1]) == "1");
+    expect(2_ul == m.drain(events));
+    expect(text(events[0]) == "2" && text(events[1]) == "3");
+  };
+
+  "members come and go without disturbing others"_test = []
+  {
+    asio::io_context io;
+    fake_device a(io), b(io), c(io);
+    mux m(io.get_executor());
+    std::size_t ia = m.add(a, 8, 1);
+    std::size_t ib = m.add(b, 8, 1);
+
+    b.deliver("b0");
+    io.restart();
+    io.poll();
+    m.remove(ib);
+    expect(1_ul == m.size());
+
+    std::vector<mux::event> events;
+    expect(0_ul == m.drain(events));
+
+    std::size_t ic = m.add(c, 8, 1);
+    expect(ic != ia && ic != ib);
+    expect(1_ul == a.receives_.size());
+
+    a.deliver("a0");
+    c.deliver("c0");
+    b.close();
+    io.restart();
+    io.poll();
+    expect(2_ul == m.drain(events));
+    expect(events[0].id == ia && events[1].id == ic);
+  };
+
+  "failed reads are not re-armed"_test = []
+  {
+    asio::io_context io;
+    fake_device a(io);
+    mux m(io.get_executor());
+    m.add(a, 8, 2);
+    a.deliver("", asio::error::no_such_device);
+    io.restart();
+    io.poll();
+
+    std::vector<mux::event> events;
+    expect(1_ul == m.drain(events));
+    expect(events[0].error == asio::error::no_such_device);
+    m.drain(events);
+    expect(1_ul == a.receives_.size());
+  };
+
+  "destruction aborts the drain"_test = []
+  {
+    asio::io_context io;
+    fake_device a(io);
+    std::vector<mux::event> events;
+    boost::system::error_code error;
+    {
+      mux m(io.get_executor());
+      m.add(a, 8, 1);
+      m.async_drain(events,
+          [&](boost::system::error_code ec, std::size_t) { error = ec; });
+    }
+    a.close();
+    io.run();
+    expect(error == asio::error::operation_aborted);
+  };
+}
@@ -0,0 +1,95 @@
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_endpoint.hpp"
+
+namespace asio = boost::asio;
+
+typedef libusb::usb_endpoint<0x81, LIBUSB_TRANSFER_TYPE_INTERRUPT, 64>
+  interrupt_in;
+typedef libusb::usb_endpoint<0x02, LIBUSB_TRANSFER_TYPE_BULK, 512>
+  bulk_out;
+
+static_assert(interrupt_in::is_in, "0x81 is an IN endpoint");
+static_assert(!bulk_out::is_in, "0x02 is an OUT endpoint");
+static_assert(interrupt_in::packets(65) == 2, "65 bytes take two packets");
+static_assert(bulk_out::transfer_type == LIBUSB_TRANSFER_TYPE_BULK,
+    "transfer type is kept");
+
+static void LIBUSB_CALL callback(struct libusb_transfer*)
+{
+}
+
+int main()
+{
+  using namespace boost::ut;
+
+  "static endpoint fills like the runtime one"_test = []
+  {
+    unsigned char data[128];
+    int user_data = 0;
+
+    struct libusb_transfer expected = {};
+    libusb::detail::runtime_endpoint::fill(&expected, 0, 0x81, 0,
+        data, sizeof(data), &callback, &user_data);
+
+    struct libusb_transfer actual = {};
+    libusb::detail::static_endpoint<0x81,
+      LIBUSB_TRANSFER_TYPE_INTERRUPT>::fill(&actual, 0, 0, 0,
+          data, sizeof(data), &callback, &user_data);
+
+    expect(actual.endpoint == expected.endpoint);
+    expect(actual.type == expected.type);
+    expect(actual.timeout == expected.timeout);
+    expect(actual.buffer == expected.buffer);
+    expect(actual.length == expected.length);
+    expect(actual.callback == expected.callback);
+    expect(actual.user_data == expected.user_data);
+  };
+
+  "static endpoint fills a bulk stream like the runtime one"_test = []
+  {
+    unsigned char data[512];
+
+    struct libusb_transfer* expected = libusb_alloc_transfer(0);
+    libusb::detail::runtime_endpoint::fill(expected, 0, 0x02, 3,
+        data, sizeof(data), &callback, 0);
+
+    struct libusb_transfer* actual = libusb_alloc_transfer(0);
+    libusb::detail::static_endpoint<0x02,
+      LIBUSB_TRANSFER_TYPE_BULK>::fill(actual, 0, 0, 3,
+          data, sizeof(data), &callback, 0);
+
+    expect(actual->endpoint == expected->endpoint);
+    expect(actual->type == LIBUSB_TRANSFER_TYPE_BULK_STREAM);
+    expect(actual->type == expected->type);
+    expect(libusb_transfer_get_stream_id(actual)
+        == libusb_transfer_get_stream_id(expected));
+    libusb_free_transfer(actual);
+    libusb_free_transfer(expected);
+  };
+
+  "endpoint transfers go through the device"_test = []
+  {
+    asio::io_context io;
+    libusb::usb_device<> device(io);
+    interrupt_in in(device);
+    bulk_out out(device);
+
+    // The device was never opened, so both transfers fail without data.
+    std::array<unsigned char, 64> report;
+    unsigned char data[512] = {};
+    int failed = 0;
+    in.async_receive(report,
+        [&](boost::system::error_code ec, std::size_t n)
+        {
+          failed += ec && n == 0;
+        });
+    out.async_send_stream(1, asio::buffer(data),
+        [&](boost::system::error_code ec, std::size_t n)
+        {
+          failed += ec && n == 0;
+        });
+    io.run();
+    expect(2_i == failed);
+  };
+}
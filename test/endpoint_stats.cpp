@@ -0,0 +1,96 @@
+#include <chrono>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+#include "libusb/detail/endpoint_stats.hpp"
+
+namespace asio = boost::asio;
+
+using libusb::raw_monotonic_clock;
+using libusb::transfer_timing;
+
+static transfer_timing timing(long submitted_us, long completed_us)
+{
+  transfer_timing t;
+  t.submitted = raw_monotonic_clock::time_point(
+      std::chrono::microseconds(submitted_us));
+  t.completed = raw_monotonic_clock::time_point(
+      std::chrono::microseconds(completed_us));
+  return t;
+}
+
+int main()
+{
+  using namespace boost::ut;
+  using libusb::detail::endpoint_stats;
+  using std::chrono::microseconds;
+
+  "raw clock is monotonic"_test = []
+  {
+    auto a = raw_monotonic_clock::now();
+    auto b = raw_monotonic_clock::now();
+    expect(true == (b >= a));
+    expect(true == (a.time_since_epoch().count() > 0));
+  };
+
+  "periodic transfers have no jitter"_test = []
+  {
+    endpoint_stats stats;
+    for (long i = 0; i < 10; ++i)
+      stats.record(0x81, timing(i * 1000, i * 1000 + 125));
+
+    auto s = stats.get(0x81);
+    expect(10_ul == s.transfers);
+    expect(true == (s.mean_interval == microseconds(1000)));
+    expect(true == (s.last_interval == microseconds(1000)));
+    expect(true == (s.jitter == microseconds(0)));
+    expect(true == (s.min_latency == microseconds(125)));
+    expect(true == (s.max_latency == microseconds(125)));
+    expect(true == (s.mean_latency == microseconds(125)));
+  };
+
+  "uneven intervals raise the jitter"_test = []
+  {
+    endpoint_stats stats;
+    long t = 0;
+    for (long i = 0; i < 20; ++i)
+    {
+      t += (i % 2) ? 900 : 1100;
+      stats.record(0x81, timing(t - 100, t));
+    }
+
+    auto s = stats.get(0x81);
+    expect(true == (s.jitter > microseconds(0)));
+    expect(true == (s.jitter <= microseconds(200)));
+    expect(true == (s.mean_interval > microseconds(900)));
+    expect(true == (s.mean_interval < microseconds(1100)));
+  };
+
+  "latency extremes are kept"_test = []
+  {
+    endpoint_stats stats;
+    stats.record(0x02, timing(0, 50));
+    stats.record(0x02, timing(1000, 1400));
+    stats.record(0x02, timing(2000, 2100));
+
+    auto s = stats.get(0x02);
+    expect(true == (s.min_latency == microseconds(50)));
+    expect(true == (s.max_latency == microseconds(400)));
+  };
+
+  "endpoints and directions are kept apart"_test = []
+  {
+    endpoint_stats stats;
+    stats.record(0x81, timing(0, 10));
+    stats.record(0x01, timing(0, 10));
+    stats.record(0x01, timing(10, 20));
+
+    expect(1_ul == stats.get(0x81).transfers);
+    expect(2_ul == stats.get(0x01).transfers);
+    expect(0_ul == stats.get(0x82).transfers);
+
+    stats.reset(0x01);
+    expect(0_ul == stats.get(0x01).transfers);
+    expect(1_ul == stats.get(0x81).transfers);
+  };
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "libusb/error.hpp"
+#include "libusb/usb_device_base.hpp"
+
+namespace asio = boost::asio;
+
+// In-memory stand-in for usb_device. Transfers stay pending until the test
+// completes them, except that sends complete at once when complete_sends_ is
+// set. Every send is also recorded in sent_. The native handle is a number
+// that the test may use as a generation.
+class fake_device
+{
+public:
+  typedef asio::io_context::executor_type executor_type;
+  typedef int native_handle_type;
+  typedef std::function<void (boost::system::error_code, std::size_t)>
+    handler_type;
+
+  struct transfer
+  {
+    asio::mutable_buffer buffer_;
+    handler_type handler_;
+  };
+
+  struct sent
+  {
+    asio::const_buffer buffer_;
+    std::vector<unsigned char> data_;
+    std::chrono::steady_clock::time_point time_;
+  };
+
+  explicit fake_device(asio::io_context& io)
+    : io_(io)
+    , complete_sends_(false)
+    , max_packet_size_(0)
+    , native_(1)
+    , open_(true)
+    , opens_(0)
+  {
+  }
+
+  executor_type get_executor()
+  {
+    return io_.get_executor();
+  }
+
+  native_handle_type native_handle()
+  {
+    return native_;
+  }
+
+  void assign(native_handle_type native, boost::system::error_code&)
+  {
+    native_ = native;
+  }
+
+  void open(boost::system::error_code&)
+  {
+    open_ = true;
+    ++opens_;
+  }
+
+  // Close the device, aborting every pending transfer.
+  void close(boost::system::error_code&)
+  {
+    open_ = false;
+    fail_all(asio::error::operation_aborted);
+  }
+
+  void close()
+  {
+    boost::system::error_code ec;
+    close(ec);
+  }
+
+  void cancel(boost::system::error_code&)
+  {
+    fail_all(asio::error::operation_aborted);
+  }
+
+  // Fails with bad_descriptor unless max_packet_size_ is set.
+  void get_option(libusb::usb_device_base::max_packet_size& option,
+      boost::system::error_code& ec)
+  {
+    if (max_packet_size_ == 0)
+      ec = asio::error::bad_descriptor;
+    else
+      option = libusb::usb_device_base::max_packet_size(max_packet_size_);
+  }
+
+  template <typename ConstBufferSequence, typename Handler>
+  void async_send(const ConstBufferSequence& buffers, Handler handler)
+  {
+    asio::const_buffer b(*asio::buffer_sequence_begin(buffers));
+    sent s{ b, std::vector<unsigned char>(asio::buffer_size(buffers)),
+      std::chrono::steady_clock::now() };
+    asio::buffer_copy(asio::buffer(s.data_), buffers);
+    sent_.push_back(s);
+
+    if (complete_sends_)
+    {
+      boost::system::error_code ec = send_error_;
+      std::size_t n = ec ? 0 : s.data_.size();
+      asio::post(io_, [handler, ec, n]{ handler(ec, n); });
+      return;
+    }
+
+    sends_.push_back(transfer{
+        asio::mutable_buffer(const_cast<void*>(b.data()), b.size()),
+        handler });
+  }
+
+  template <typename MutableBufferSequence, typename Handler>
+  void async_receive(const MutableBufferSequence& buffers, Handler handler)
+  {
+    receives_.push_back(transfer{
+        asio::mutable_buffer(*asio::buffer_sequence_begin(buffers)),
+        handler });
+  }
+
+  // Complete the oldest pending send, with all its bytes unless it fails.
+  void complete_send(
+      const boost::system::error_code& ec = boost::system::error_code())
+  {
+    transfer t = take(sends_);
+    std::size_t n = ec ? 0 : t.buffer_.size();
+    asio::post(io_, [t, ec, n]{ t.handler_(ec, n); });
+  }
+
+  // Complete the oldest pending receive with data.
+  void deliver(const std::string& data,
+      const boost::system::error_code& ec = boost::system::error_code())
+  {
+    deliver_buffer(asio::buffer(data), ec);
+  }
+
+  void deliver(const std::vector<unsigned char>& data,
+      const boost::system::error_code& ec = boost::system::error_code())
+  {
+    deliver_buffer(asio::buffer(data), ec);
+  }
+
+  void deliver_buffer(const asio::const_buffer& data,
+      const boost::system::error_code& ec)
+  {
+    transfer t = take(receives_);
+    std::size_t n = asio::buffer_copy(t.buffer_, data);
+    asio::post(io_, [t, ec, n]{ t.handler_(ec, n); });
+  }
+
+  // Fail the oldest pending receive.
+  void fail_one(const boost::system::error_code& ec)
+  {
+    transfer t = take(receives_);
+    asio::post(io_, [t, ec]{ t.handler_(ec, 0); });
+  }
+
+  // Fail every pending transfer.
+  void fail_all(const boost::system::error_code& ec)
+  {
+    std::vector<transfer> all(sends_.begin(), sends_.end());
+    all.insert(all.end(), receives_.begin(), receives_.end());
+    sends_.clear();
+    receives_.clear();
+    for (auto& t : all)
+      asio::post(io_, [t, ec]{ t.handler_(ec, 0); });
+  }
+
+  // Fail every pending transfer as if the device was unplugged.
+  void unplug()
+  {
+    fail_all(libusb_error(LIBUSB_ERROR_NO_DEVICE));
+  }
+
+  asio::io_context& io_;
+  bool complete_sends_;
+  boost::system::error_code send_error_;
+  int max_packet_size_;
+  native_handle_type native_;
+  bool open_;
+  int opens_;
+  std::deque<transfer> sends_;
+  std::deque<transfer> receives_;
+  std::vector<sent> sent_;
+
+private:
+  static transfer take(std::deque<transfer>& q)
+  {
+    transfer t = q.front();
+    q.pop_front();
+    return t;
+  }
+};
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/detail/async_transfer_op.hpp"
+
+namespace asio = boost::asio;
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+  ++allocations;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+template <typename T>
+struct counting_allocator
+{
+  typedef T value_type;
+
+  explicit counting_allocator(std::size_t* count)
+    : count_(count)
+  {
+  }
+
+  template <typename U>
+  counting_allocator(const counting_allocator<U>& other)
+    : count_(other.count_)
+  {
+  }
+
+  T* allocate(std::size_t n)
+  {
+    ++*count_;
+    return static_cast<T*>(std::malloc(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, std::size_t)
+  {
+    std::free(p);
+  }
+
+  bool operator==(const counting_allocator& other) const
+  {
+    return count_ == other.count_;
+  }
+
+  bool operator!=(const counting_allocator& other) const
+  {
+    return count_ != other.count_;
+  }
+
+  std::size_t* count_;
+};
+
+struct transfer_handler
+{
+  void operator()(const boost::system::error_code&, std::size_t)
+  {
+  }
+};
+
+struct allocating_handler : transfer_handler
+{
+  typedef counting_allocator<void> allocator_type;
+
+  allocator_type get_allocator() const
+  {
+    return allocator_type(count_);
+  }
+
+  std::size_t* count_;
+};
+
+template <typename Handler>
+struct transfer_ops
+{
+  typedef libusb::detail::async_transfer_op<asio::mutable_buffer, Handler,
+    asio::io_context::executor_type> op;
+
+  // Create and destroy a batch of outstanding operations.
+  static void cycle(asio::io_context& io_context,
+      libusb::detail::op_arena& arena, Handler handler, std::size_t depth,
+      std::vector<struct libusb_transfer*>* seen = 0)
+  {
+    auto& sched = asio::use_service<asio::detail::scheduler>(io_context);
+    unsigned char data[64];
+    op* ops[16];
+
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+      typename op::ptr p = { asio::detail::addressof(handler),
+        op::ptr::allocate(handler, &arena), 0, &arena };
+      p.p = new (p.v) op(NULL, NULL, 0x81, 0, asio::buffer(data), NULL, &arena,
+          NULL, sched, handler, io_context.get_executor());
+      ops[i] = p.p;
+      if (seen)
+        seen->push_back(ops[i]->native_transfer());
+      p.v = p.p = 0;
+    }
+
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+      typename op::ptr p = { asio::detail::addressof(handler),
+        ops[i], ops[i], &arena };
+      p.reset();
+    }
+  }
+};
+
+int main()
+{
+  using namespace boost::ut;
+  namespace detail = libusb::detail;
+
+  "size classes"_test = []
+  {
+    detail::op_arena arena;
+    void* a = arena.allocate(100);
+    arena.deallocate(a, 100);
+    expect(a == arena.allocate(128));
+    void* b = arena.allocate(129);
+    expect(a != b);
+    arena.deallocate(a, 128);
+    arena.deallocate(b, 129);
+
+    void* large = arena.allocate(1 << 20);
+    arena.deallocate(large, 1 << 20);
+  };
+
+  "arena outlives its owner until its blocks are returned"_test = []
+  {
+    detail::op_arena::pointer owner(new detail::op_arena);
+    detail::op_arena* arena = owner.get();
+    void* block = arena->allocate(64);
+    struct libusb_transfer* transfer = arena->alloc_transfer();
+    owner.reset();
+
+    // The arena is freed with the last block.
+    arena->free_transfer(transfer);
+    arena->deallocate(block, 64);
+  };
+
+  "steady state transfers do not allocate"_test = []
+  {
+    asio::io_context io_context;
+    detail::op_arena arena;
+    const std::size_t depth = 8;
+
+    std::vector<struct libusb_transfer*> first, second;
+    first.reserve(depth);
+    second.reserve(depth);
+
+    transfer_ops<transfer_handler>::cycle(io_context, arena,
+        transfer_handler(), depth, &first);
+
+    std::size_t before = allocations;
+    for (int i = 0; i < 1000; ++i)
+      transfer_ops<transfer_handler>::cycle(io_context, arena,
+          transfer_handler(), depth);
+    transfer_ops<transfer_handler>::cycle(io_context, arena,
+        transfer_handler(), depth, &second);
+
+    expect(0_ul == allocations - before);
+
+    // The libusb transfers are recycled as well.
+    std::sort(first.begin(), first.end());
+    std::sort(second.begin(), second.end());
+    expect(first == second);
+  };
+
+  "associated allocator overrides the arena"_test = []
+  {
+    asio::io_context io_context;
+    detail::op_arena arena;
+    std::size_t count = 0;
+    allocating_handler handler;
+    handler.count_ = &count;
+
+    transfer_ops<allocating_handler>::cycle(io_context, arena, handler, 4);
+    expect(4_ul == count);
+  };
+}
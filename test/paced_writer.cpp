@@ -0,0 +1,88 @@
+#include <chrono>
+#include <memory>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_paced_writer.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::usb_paced_writer<fake_device> writer;
+
+int main()
+{
+  using namespace boost::ut;
+
+  "sends beyond the burst are paced"_test = []
+  {
+    asio::io_context io;
+    fake_device device(io);
+    device.complete_sends_ = true;
+    // 1 MB/s with a 1000 byte bucket: 500 bytes take 0.5 ms.
+    writer w(device, 1000000, 1000);
+    unsigned char data[500] = {};
+
+    int completed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 6; ++i)
+      w.async_send(asio::buffer(data),
+          [&](const boost::system::error_code& ec, std::size_t n)
+          {
+            expect(!ec);
+            expect(500_ul == n);
+            ++completed;
+          });
+
+    // The full bucket lets two sends through at once.
+    expect(2_ul == device.sent_.size());
+    expect(4_ul == w.queued());
+
+    io.run();
+    expect(6_i == completed);
+    expect(6_ul == device.sent_.size());
+
+    // The other four needed 2000 bytes of tokens.
+    auto elapsed = device.sent_.back().time_ - start;
+    expect(true == (elapsed >= std::chrono::microseconds(1900)));
+  };
+
+  "raising the rate releases held sends"_test = []
+  {
+    asio::io_context io;
+    fake_device device(io);
+    device.complete_sends_ = true;
+    writer w(device, 0, 100);
+    unsigned char data[100] = {};
+
+    int completed = 0;
+    for (int i = 0; i < 3; ++i)
+      w.async_send(asio::buffer(data),
+          [&](const boost::system::error_code&, std::size_t) { ++completed; });
+    expect(1_ul == device.sent_.size());
+
+    w.rate(100000000);
+    io.run();
+    expect(3_i == completed);
+  };
+
+  "destruction aborts queued sends"_test = []
+  {
+    asio::io_context io;
+    fake_device device(io);
+    device.complete_sends_ = true;
+    unsigned char data[100] = {};
+    int aborted = 0;
+
+    {
+      writer w(device, 0, 100);
+      for (int i = 0; i < 3; ++i)
+        w.async_send(asio::buffer(data),
+            [&](const boost::system::error_code& ec, std::size_t)
+            {
+              if (ec == asio::error::operation_aborted)
+                ++aborted;
+            });
+    }
+
+    io.run();
+    expect(2_i == aborted);
+  };
+}
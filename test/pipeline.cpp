@@ -0,0 +1,147 @@
+#include <cstdint>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_pipeline.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::usb_pipeline<fake_device, std::uint8_t> pipeline;
+typedef std::vector<unsigned char> reply;
+
+static bool first_byte(asio::const_buffer reply, std::uint8_t& tag)
+{
+  if (reply.size() == 0)
+    return false;
+  tag = *static_cast<const std::uint8_t*>(reply.data());
+  return true;
+}
+
+int main()
+{
+  using namespace boost::ut;
+
+  "out of order replies"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.complete_sends_ = true;
+    pipeline p(dev, first_byte, 16, 2);
+
+    std::uint8_t commands[3][2] = { { 0, 10 }, { 1, 11 }, { 2, 12 } };
+    unsigned char replies[3][4] = {};
+    std::size_t sizes[3] = {};
+    boost::system::error_code errors[3];
+    for (int i = 0; i < 3; ++i)
+    {
+      p.async_transact(i, asio::buffer(commands[i]), asio::buffer(replies[i]),
+          std::chrono::seconds(10),
+          [&, i](boost::system::error_code ec, std::size_t n)
+          {
+            errors[i] = ec;
+            sizes[i] = n;
+          });
+    }
+    io.poll();
+
+    expect(3_ul == dev.sent_.size());
+    expect(2_ul == dev.receives_.size());
+    expect(3_ul == p.pending());
+
+    dev.deliver(reply{ 2, 22, 23 });
+    dev.deliver(reply{ 9, 99 });
+    io.poll();
+    dev.deliver(reply{ 0, 20 });
+    dev.deliver(reply{ 1, 21, 1, 1, 1 });
+    io.poll();
+
+    expect(0_ul == p.pending());
+    expect(1_ul == p.unmatched());
+    expect(!errors[0] && sizes[0] == 2 && replies[0][1] == 20);
+    expect(errors[1] == asio::error::message_size && sizes[1] == 4);
+    expect(!errors[2] && sizes[2] == 3 && replies[2][2] == 23);
+    expect(2_ul == dev.receives_.size());
+  };
+
+  "timeout and duplicate tag"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.complete_sends_ = true;
+    pipeline p(dev, first_byte);
+
+    std::uint8_t command[1] = { 5 };
+    unsigned char reply[4];
+    boost::system::error_code first, second;
+    p.async_transact(5, asio::buffer(command), asio::buffer(reply),
+        std::chrono::milliseconds(1),
+        [&](boost::system::error_code ec, std::size_t) { first = ec; });
+    p.async_transact(5, asio::buffer(command), asio::buffer(reply),
+        std::chrono::milliseconds(1),
+        [&](boost::system::error_code ec, std::size_t) { second = ec; });
+    io.run();
+
+    expect(first == asio::error::timed_out);
+    expect(second == asio::error::in_progress);
+    expect(0_ul == p.pending());
+  };
+
+  "read error fails pending"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.complete_sends_ = true;
+    pipeline p(dev, first_byte);
+
+    std::uint8_t command[1] = { 7 };
+    unsigned char reply[4];
+    boost::system::error_code error;
+    p.async_transact(7, asio::buffer(command), asio::buffer(reply),
+        std::chrono::seconds(10),
+        [&](boost::system::error_code ec, std::size_t) { error = ec; });
+    io.poll();
+    dev.fail_all(asio::error::no_such_device);
+    io.run();
+
+    expect(error == asio::error::no_such_device);
+    expect(0_ul == p.pending());
+  };
+
+  "transient read error re-arms only that read"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    dev.complete_sends_ = true;
+    pipeline p(dev, first_byte, 16, 4);
+
+    std::uint8_t commands[2][1] = { { 7 }, { 8 } };
+    unsigned char replies[2][4] = {};
+    int completed = 0;
+    auto handler = [&](boost::system::error_code ec, std::size_t)
+    {
+      expect(!ec) << ec;
+      ++completed;
+    };
+
+    p.async_transact(7, asio::buffer(commands[0]), asio::buffer(replies[0]),
+        std::chrono::seconds(10), decltype(handler)(handler));
+    io.poll();
+    expect(4_ul == dev.receives_.size());
+
+    dev.fail_one(asio::error::broken_pipe);
+    io.poll();
+    expect(1_ul == p.pending());
+    expect(3_ul == dev.receives_.size());
+
+    p.async_transact(8, asio::buffer(commands[1]), asio::buffer(replies[1]),
+        std::chrono::seconds(10), decltype(handler)(handler));
+    io.poll();
+    expect(4_ul == dev.receives_.size());
+
+    dev.deliver(reply{ 8 });
+    dev.deliver(reply{ 7 });
+    io.poll();
+    expect(2_i == completed);
+    expect(0_ul == p.pending());
+    expect(4_ul == dev.receives_.size());
+  };
+}
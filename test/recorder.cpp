@@ -0,0 +1,113 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_recorder.hpp"
+#include "fake_device.hpp"
+
+typedef libusb::usb_recorder<fake_device> recorder;
+
+std::string contents(const std::string& path)
+{
+  std::ifstream f(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f),
+      std::istreambuf_iterator<char>());
+}
+
+// Run the io_context until the device has the given number of armed reads.
+void rearm(asio::io_context& io, fake_device& device, std::size_t n)
+{
+  while (device.receives_.size() < n)
+  {
+    io.restart();
+    io.run_for(std::chrono::milliseconds(1));
+  }
+}
+
+int main()
+{
+  using namespace boost::ut;
+
+  "records received data in order"_test = []
+  {
+    std::string path("recorder_test.bin");
+    asio::io_context io;
+    fake_device device(io);
+    {
+      recorder r(device, path, 16, 2);
+      r.start();
+      expect(2_ul == device.receives_.size());
+
+      std::string expected;
+      for (int i = 0; i < 10; ++i)
+      {
+        std::string data("chunk" + std::to_string(i));
+        expected += data;
+        device.deliver(data);
+        rearm(io, device, 2);
+      }
+      device.close();
+      io.restart();
+      io.run();
+
+      // Stopped because the device was closed.
+      expect(r.error() == asio::error::operation_aborted);
+      r.start();
+      expect(0_ul == device.receives_.size());
+
+      while (r.bytes_written() < expected.size())
+        std::this_thread::yield();
+      expect(r.bytes_written() == expected.size());
+      expect(1_ul == r.segments());
+    }
+    expect(contents(path) == std::string("chunk0chunk1chunk2chunk3chunk4"
+          "chunk5chunk6chunk7chunk8chunk9"));
+    std::remove(path.c_str());
+  };
+
+  "rotates segments at transfer boundaries"_test = []
+  {
+    std::string path("recorder_test.seg");
+    asio::io_context io;
+    fake_device device(io);
+    {
+      recorder r(device, path, 16, 1, 10);
+      r.start();
+      for (const char* data : { "aaaa", "bbbb", "cccc", "dddd", "eeeeeeeeee" })
+      {
+        device.deliver(data);
+        rearm(io, device, 1);
+      }
+      device.close();
+      io.restart();
+      io.run();
+      expect(3_ul == r.segments());
+    }
+    expect(contents(path + ".0") == std::string("aaaabbbb"));
+    expect(contents(path + ".1") == std::string("ccccdddd"));
+    expect(contents(path + ".2") == std::string("eeeeeeeeee"));
+    for (int i = 0; i < 3; ++i)
+      std::remove((path + "." + std::to_string(i)).c_str());
+  };
+
+  "unopenable file throws"_test = []
+  {
+    asio::io_context io;
+    fake_device device(io);
+    bool thrown = false;
+    try
+    {
+      recorder r(device, "no/such/dir/file.bin");
+    }
+    catch (const boost::system::system_error&)
+    {
+      thrown = true;
+    }
+    expect(thrown);
+  };
+}
@@ -0,0 +1,135 @@
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/resilient_usb_device.hpp"
+#include "fake_device.hpp"
+
+// Locator that finds the device again once the test plugs it back in.
+struct test_locator
+{
+  typedef int native_handle_type;
+
+  template <typename Device>
+  void remember(Device& device)
+  {
+    remembered_ = device.native_handle();
+  }
+
+  native_handle_type find(boost::system::error_code&)
+  {
+    return plugged_ ? remembered_ + 1 : 0;
+  }
+
+  native_handle_type remembered_ = 0;
+  bool plugged_ = false;
+};
+
+typedef libusb::resilient_usb_device<fake_device, test_locator> device;
+
+int main()
+{
+  using namespace boost::ut;
+
+  "replay idempotent transfers"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    device d(dev, device::replay_idempotent, std::chrono::seconds(10),
+        std::chrono::microseconds(100));
+
+    unsigned char a[4], b[8], c[2];
+    boost::system::error_code plain_error, idempotent_error, receive_error;
+    std::size_t received = 0;
+    d.async_send(asio::buffer(a),
+        [&](boost::system::error_code ec, std::size_t) { plain_error = ec; });
+    d.async_send(asio::buffer(b), device::idempotent,
+        [&](boost::system::error_code ec, std::size_t) { idempotent_error = ec; });
+    d.async_receive(asio::buffer(c),
+        [&](boost::system::error_code ec, std::size_t n)
+        {
+          receive_error = ec;
+          received = n;
+        });
+    expect(2_ul == dev.sends_.size());
+
+    dev.unplug();
+    io.poll();
+    expect(!d.connected());
+    expect(!dev.open_);
+    expect(plain_error == boost::system::errc::no_such_device);
+    expect(d.locator().remembered_ == 1);
+
+    d.locator().plugged_ = true;
+    io.run_one();
+    expect(d.connected());
+    expect(1_ul == d.reconnects());
+    expect(dev.open_ && dev.native_ == 2 && dev.opens_ == 1);
+    expect(1_ul == dev.sends_.size() && dev.sends_[0].buffer_.size() == 8);
+    expect(1_ul == dev.receives_.size());
+
+    dev.sends_[0].handler_(boost::system::error_code(), 8);
+    dev.receives_[0].handler_(boost::system::error_code(), 2);
+    io.poll();
+    expect(!idempotent_error && !receive_error && received == 2);
+  };
+
+  "transfers cancelled for the reconnect are replayed"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    device d(dev, device::replay_idempotent, std::chrono::seconds(10),
+        std::chrono::microseconds(100));
+
+    unsigned char a[4], b[8], c[2];
+    boost::system::error_code plain_error;
+    bool receive_done = false;
+    d.async_send(asio::buffer(a), device::idempotent,
+        [&](boost::system::error_code, std::size_t) {});
+    d.async_send(asio::buffer(b),
+        [&](boost::system::error_code ec, std::size_t) { plain_error = ec; });
+    d.async_receive(asio::buffer(c),
+        [&](boost::system::error_code, std::size_t) { receive_done = true; });
+
+    // Only the first send sees the device gone; the others are cancelled.
+    auto lost = dev.sends_[0];
+    dev.sends_.erase(dev.sends_.begin());
+    lost.handler_(libusb_error(LIBUSB_ERROR_NO_DEVICE), 0);
+    io.poll();
+    expect(!d.connected());
+    expect(0_ul == dev.sends_.size() && 0_ul == dev.receives_.size());
+    expect(plain_error == boost::system::errc::no_such_device);
+    expect(!receive_done);
+
+    d.locator().plugged_ = true;
+    while (!d.connected())
+      io.run_one();
+    expect(1_ul == dev.sends_.size() && dev.sends_[0].buffer_.size() == 4);
+    expect(1_ul == dev.receives_.size() && dev.receives_[0].buffer_.size() == 2);
+    expect(!receive_done);
+  };
+
+  "held transfers fail after timeout"_test = []
+  {
+    asio::io_context io;
+    fake_device dev(io);
+    device d(dev, device::replay_all, std::chrono::milliseconds(2),
+        std::chrono::microseconds(200));
+
+    unsigned char a[4];
+    boost::system::error_code first, second;
+    d.async_send(asio::buffer(a),
+        [&](boost::system::error_code ec, std::size_t) { first = ec; });
+    dev.unplug();
+    io.run_one();
+    expect(!d.connected());
+
+    d.async_send(asio::buffer(a),
+        [&](boost::system::error_code ec, std::size_t) { second = ec; });
+    expect(0_ul == dev.sends_.size());
+
+    io.run();
+    expect(d.connected());
+    expect(0_ul == d.reconnects());
+    expect(first == boost::system::errc::no_such_device);
+    expect(second == boost::system::errc::no_such_device);
+  };
+}
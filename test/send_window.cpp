@@ -0,0 +1,131 @@
+#include <boost/ut.hpp>
+#include <boost/asio.hpp>
+#include "libusb/usb_device.hpp"
+#include "libusb/detail/send_window.hpp"
+
+namespace asio = boost::asio;
+
+struct test_wait_op : libusb::detail::send_wait_op
+{
+  test_wait_op()
+    : libusb::detail::send_wait_op(&test_wait_op::do_complete)
+  {
+  }
+
+  static void do_complete(void*, asio::detail::operation*,
+      const boost::system::error_code&, std::size_t)
+  {
+  }
+
+  const boost::system::error_code& error() const
+  {
+    return ec_;
+  }
+};
+
+int main()
+{
+  using namespace boost::ut;
+  using libusb::detail::send_window;
+
+  "window is bounded by operations"_test = []
+  {
+    send_window window;
+    send_window::ready_queue ready;
+    window.limit(2, 0, ready);
+
+    expect(true == window.acquire(100));
+    expect(true == window.acquire(100));
+    expect(false == window.acquire(100));
+
+    test_wait_op op;
+    window.wait(&op, ready);
+    expect(true == ready.empty());
+
+    window.release(100, ready);
+    expect(&op == ready.front());
+    ready.pop();
+    expect(false == static_cast<bool>(op.error()));
+  };
+
+  "window is bounded by bytes"_test = []
+  {
+    send_window window;
+    send_window::ready_queue ready;
+    window.limit(0, 1000, ready);
+
+    // A send larger than the limit still goes through on its own.
+    expect(true == window.acquire(4000));
+    expect(false == window.acquire(1));
+    window.release(4000, ready);
+    expect(true == window.acquire(999));
+    expect(true == window.acquire(1));
+    expect(false == window.acquire(1));
+  };
+
+  "raising the limit wakes the waiters"_test = []
+  {
+    send_window window;
+    send_window::ready_queue ready;
+    window.limit(1, 0, ready);
+    expect(true == window.acquire(1));
+
+    test_wait_op op;
+    window.wait(&op, ready);
+    window.limit(2, 0, ready);
+    expect(&op == ready.front());
+    ready.pop();
+  };
+
+  "cancel aborts the waiters"_test = []
+  {
+    send_window window;
+    send_window::ready_queue ready;
+    window.limit(1, 0, ready);
+    expect(true == window.acquire(1));
+
+    test_wait_op op;
+    window.wait(&op, ready);
+    window.cancel(ready);
+    expect(&op == ready.front());
+    ready.pop();
+    expect(op.error() == asio::error::operation_aborted);
+  };
+
+  "idle device is writable"_test = []
+  {
+    asio::io_context io_context;
+    libusb::usb_device<> device(io_context);
+    device.set_option(libusb::usb_device_base::send_queue_limit(4, 65536));
+
+    libusb::usb_device_base::send_queue_limit limit;
+    device.get_option(limit);
+    expect(4_ul == limit.operations());
+    expect(65536_ul == limit.bytes());
+
+    bool writable = false;
+    device.async_wait_writable([&](const boost::system::error_code& ec)
+        {
+          writable = !ec;
+        });
+    io_context.run();
+    expect(true == writable);
+  };
+
+  "receive limit is kept apart from the send limit"_test = []
+  {
+    asio::io_context io_context;
+    libusb::usb_device<> device(io_context);
+    device.set_option(libusb::usb_device_base::receive_queue_limit(2, 1024));
+
+    libusb::usb_device_base::receive_queue_limit receive_limit;
+    device.get_option(receive_limit);
+    expect(2_ul == receive_limit.operations());
+    expect(1024_ul == receive_limit.bytes());
+
+    libusb::usb_device_base::send_queue_limit send_limit;
+    device.get_option(send_limit);
+    expect(0_ul == send_limit.operations());
+    expect(0_ul == send_limit.bytes());
+  };
+}
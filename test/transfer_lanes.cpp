@@ -0,0 +1,74 @@
+#include <vector>
+#include <boost/ut.hpp>
+#include "libusb/detail/transfer_lanes.hpp"
+
+struct test_transfer
+{
+  explicit test_transfer(std::vector<int>& order, int id)
+    : entry_(&test_transfer::run, this)
+    , order_(order)
+    , id_(id)
+  {
+  }
+
+  static void run(void* op)
+  {
+    auto t(static_cast<test_transfer*>(op));
+    t->order_.push_back(t->id_);
+  }
+
+  libusb::detail::transfer_lanes::entry entry_;
+  std::vector<int>& order_;
+  int id_;
+};
+
+int main()
+{
+  using namespace boost::ut;
+  using libusb::detail::transfer_lanes;
+
+  "urgent transfers run ahead of queued normal ones"_test = []
+  {
+    transfer_lanes lanes;
+    std::vector<int> order;
+    test_transfer a(order, 1), b(order, 2), c(order, 3), d(order, 4);
+
+    lanes.push(&a.entry_, transfer_lanes::normal);
+    lanes.push(&b.entry_, transfer_lanes::normal);
+    lanes.push(&c.entry_, transfer_lanes::urgent);
+
+    // One slot is run per queued transfer, whichever transfer posted it.
+    lanes.pop()->run();
+    lanes.push(&d.entry_, transfer_lanes::urgent);
+    lanes.pop()->run();
+    lanes.pop()->run();
+    lanes.pop()->run();
+
+    expect(true == (order == std::vector<int>{3, 4, 1, 2}));
+    expect(true == (lanes.pop() == 0));
+  };
+
+  "removed entries are skipped"_test = []
+  {
+    transfer_lanes lanes;
+    std::vector<int> order;
+    test_transfer a(order, 1), b(order, 2), c(order, 3);
+
+    lanes.push(&a.entry_, transfer_lanes::normal);
+    lanes.push(&b.entry_, transfer_lanes::normal);
+    lanes.push(&c.entry_, transfer_lanes::normal);
+    lanes.remove(&c.entry_);
+    lanes.remove(&a.entry_);
+
+    lanes.pop()->run();
+    expect(true == (lanes.pop() == 0));
+
+    // Removing an entry that is no longer queued has no effect.
+    lanes.remove(&b.entry_);
+    lanes.push(&a.entry_, transfer_lanes::normal);
+    lanes.pop()->run();
+
+    expect(true == (order == std::vector<int>{2, 1}));
+    expect(true == (lanes.pop() == 0));
+  };
+}
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/ut.hpp>
+#include <libusb.h>
+#include "libusb/detail/transfer_tracker.hpp"
+
+int main()
+{
+  using namespace boost::ut;
+  using libusb::detail::transfer_tracker;
+  typedef transfer_tracker::clock_type clock;
+
+  "cancel aborts operations not yet submitted"_test = []
+  {
+    auto tracker = std::make_shared<transfer_tracker>();
+    std::uint64_t before = tracker->enter();
+    tracker->cancel();
+    std::uint64_t after = tracker->enter();
+
+    expect(false == tracker->submit(0, before));
+    expect(true == tracker->leave(0));
+    expect(true == tracker->submit(0, after));
+    expect(1_ul == tracker->outstanding());
+  };
+
+  "wait returns when the last operation leaves"_test = []
+  {
+    auto tracker = std::make_shared<transfer_tracker>();
+    struct libusb_transfer* transfer = libusb_alloc_transfer(0);
+    expect(true == tracker->submit(transfer, tracker->enter()));
+
+    std::thread callback([&]
+        {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          tracker->leave(transfer);
+        });
+
+    expect(true == tracker->wait(clock::now() + std::chrono::seconds(10)));
+    expect(0_ul == tracker->outstanding());
+    callback.join();
+    libusb_free_transfer(transfer);
+  };
+
+  "abandoned transfers are listed until their callbacks run"_test = []
+  {
+    auto tracker = std::make_shared<transfer_tracker>();
+    struct libusb_transfer* first = libusb_alloc_transfer(0);
+    struct libusb_transfer* second = libusb_alloc_transfer(0);
+    expect(true == tracker->submit(first, tracker->enter()));
+    expect(true == tracker->submit(second, tracker->enter()));
+
+    expect(true == tracker->leave(first));
+    tracker->abandon();
+    expect(true == tracker->abandoned());
+
+    std::vector<struct libusb_transfer*> transfers;
+    tracker->submitted(transfers);
+    expect(1_ul == transfers.size());
+    expect(true == (transfers.front() == second));
+
+    expect(false == tracker->leave(second));
+    tracker->submitted(transfers);
+    expect(true == transfers.empty());
+    libusb_free_transfer(first);
+    libusb_free_transfer(second);
+  };
+
+  "an abandoned tracker lives until its last operation leaves"_test = []
+  {
+    auto tracker = std::make_shared<transfer_tracker>();
+    std::weak_ptr<transfer_tracker> weak = tracker;
+    tracker->enter();
+
+    auto start = clock::now();
+    expect(false == tracker->wait(start + std::chrono::milliseconds(20)));
+    expect(true == (clock::now() - start < std::chrono::seconds(5)));
+
+    tracker->abandon();
+    transfer_tracker* raw = tracker.get();
+    tracker.reset();
+    expect(false == weak.expired());
+
+    // A late callback is told that the tracker was abandoned.
+    expect(false == raw->leave(0));
+    expect(true == weak.expired());
+  };
+
+  "jobs do not start after a cancel"_test = []
+  {
+    int owner = 0;
+    transfer_tracker tracker(&owner);
+    std::uint64_t generation = tracker.generation();
+    expect(true == (tracker.begin_job(generation) == &owner));
+    tracker.end_job();
+    tracker.wait_jobs();
+
+    tracker.cancel();
+    expect(true == (tracker.begin_job(generation) == 0));
+  };
+
+  "owner moves only between jobs"_test = []
+  {
+    int owner = 0, other = 0;
+    transfer_tracker tracker(&owner);
+    std::uint64_t generation = tracker.generation();
+    expect(true == (tracker.begin_job(generation) == &owner));
+    expect(false == tracker.move_owner(&other));
+    tracker.end_job();
+
+    expect(true == tracker.move_owner(&other));
+    expect(true == (tracker.begin_job(generation) == &other));
+    tracker.end_job();
+  };
+}
@@ -1,3 +1,4 @@
+#include <set>
 #include <boost/ut.hpp>
 #include <boost/asio.hpp>
 #include "libusb/usb_device.hpp"
@@ -79,5 +80,161 @@ int main()
 
       io_context.run();
     };
+
+    should("read string descriptors") = [&io_context, &device]
+    {
+      struct libusb_device_descriptor descriptor = device->device_descriptor();
+      auto config = device->config_descriptor(0);
+      std::uint8_t indices[2] = { descriptor.iProduct,
+        config->iConfiguration };
+
+      for (std::uint8_t index : indices)
+      {
+        if (index == 0)
+          continue;
+
+        std::string value = device->string_descriptor(index);
+        expect(value == device->string_descriptor(index));
+
+        io_context.restart();
+        std::string async_value;
+        device->async_read_string_descriptor(index,
+            [&](const boost::system::error_code& ec, std::string s)
+            {
+              expect(!ec) << ec;
+              async_value = s;
+            });
+        io_context.run();
+        expect(value == async_value);
+      }
+    };
+
+    should("read a string and open across moves") = [&io_context, &device]
+    {
+      // A read started before a move completes with the moved-to device.
+      std::uint8_t index = device->device_descriptor().iProduct;
+      std::string value;
+      if (index != 0)
+        value = device->string_descriptor(index);
+
+      io_context.restart();
+      std::string async_value;
+      if (index != 0)
+      {
+        device->async_read_string_descriptor(index,
+            [&](const boost::system::error_code& ec, std::string s)
+            {
+              expect(!ec) << ec;
+              async_value = s;
+            });
+      }
+      usb_device<> moved(std::move(*device));
+      io_context.run();
+
+      expect(value == async_value);
+      expect(moved.is_open());
+      expect(!device->is_open());
+
+      // An open started before a move opens the moved-to device.
+      moved.close();
+      io_context.restart();
+      moved.async_open([](const boost::system::error_code& ec)
+          {
+            expect(!ec) << ec;
+          });
+      usb_device<> reopened(std::move(moved));
+      io_context.run();
+
+      expect(reopened.is_open());
+      expect(!moved.is_open());
+    };
   }; 
+
+  "usb device bulk streams"_test = []
+  {
+    asio::io_context io_context;
+    usb_device_acceptor acceptor(io_context);
+    usb_device<> device(io_context);
+
+    acceptor.async_accept(device.lowest_layer(), 0xdead, 0xbeef,
+        [](const boost::system::error_code& ec)
+        {
+          expect(!ec) << ec;
+        });
+
+    io_context.run();
+
+    usb_device_base::stream_count count;
+    device.set_option(usb_device_base::stream_count(4));
+    device.get_option(count);
+    expect(4_u == count.value());
+
+    // Without open no streams are granted, so any stream id is rejected.
+    std::vector<std::byte> data(512);
+    io_context.restart();
+    device.async_send_stream(1, asio::buffer(data),
+        [](const boost::system::error_code& ec, std::size_t n)
+        {
+          expect(ec == asio::error::invalid_argument) << ec;
+          expect(0_ul == n);
+        });
+    io_context.run();
+
+    device.open();
+    device.get_option(count);
+    expect(count.value() >= 1_u && count.value() <= 4_u);
+
+    int rejected = 0;
+    std::uint32_t ids[2] = { 0, count.value() + 1 };
+    io_context.restart();
+    for (std::uint32_t id : ids)
+    {
+      device.async_send_stream(id, asio::buffer(data),
+          [&](const boost::system::error_code& ec, std::size_t n)
+          {
+            rejected += ec == asio::error::invalid_argument && n == 0;
+          });
+      device.async_receive_stream(id, asio::buffer(data),
+          [&](const boost::system::error_code& ec, std::size_t n)
+          {
+            rejected += ec == asio::error::invalid_argument && n == 0;
+          });
+    }
+    io_context.run();
+    expect(4_i == rejected);
+
+    // Closing frees the streams; the option reads the request again.
+    device.close();
+    device.get_option(count);
+    expect(4_u == count.value());
+  };
+
+  "usb device on context shards"_test = []
+  {
+    asio::io_context io_context;
+    set_service_options(io_context, usb_service_options()
+        .context_shards(2));
+    usb_device_acceptor acceptor(io_context);
+    usb_device<> device(io_context);
+
+    acceptor.async_accept(device.lowest_layer(), 0xdead, 0xbeef,
+        [](const boost::system::error_code& ec)
+        {
+          expect(!ec) << ec;
+        });
+
+    io_context.run();
+
+    std::set<struct libusb_context*> contexts;
+    for (int shard = 0; shard < 2; ++shard)
+    {
+      device.set_option(usb_device_base::shard(shard));
+      device.open();
+      expect(device.is_open());
+      contexts.insert(device.native_context());
+      device.close();
+    }
+    expect(2_ul == contexts.size());
+    expect(0_ul == contexts.count(nullptr));
+  };
 }